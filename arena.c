@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#if defined(__linux__)
+
+#include <sys/mman.h>
+
+#define CHUNK_BYTES ((size_t)2 << 20) // one huge page
+#define SLOT_BYTES (MEMORY_MAX * sizeof(uint16))
+
+static char lock; // vms are created and destroyed from any thread
+static void* free_slots; // linked through their first word
+static char* fresh; // untouched slots left in the newest chunk
+static char* fresh_end;
+
+static char* map_chunk() // CHUNK_BYTES, aligned to them
+{
+#ifdef MAP_HUGETLB
+  void* huge = mmap(NULL, CHUNK_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if(huge != MAP_FAILED) return huge;
+#endif
+  // no hugetlbfs pages reserved, align by hand and ask for a THP
+  char* p = mmap(NULL, 2 * CHUNK_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED) return NULL;
+  char* start = (char*)(((uintptr_t)p + CHUNK_BYTES - 1) & ~(uintptr_t)(CHUNK_BYTES - 1));
+  if(start > p) munmap(p, start - p);
+  munmap(start + CHUNK_BYTES, p + CHUNK_BYTES - start);
+#ifdef MADV_HUGEPAGE
+  madvise(start, CHUNK_BYTES, MADV_HUGEPAGE);
+#endif
+  return start;
+}
+
+uint16* arena_alloc()
+{
+  while(__atomic_test_and_set(&lock, __ATOMIC_ACQUIRE)) {}
+  void* slot = free_slots;
+  int dirty = slot != NULL;
+  if(slot)
+  {
+    free_slots = *(void**)slot;
+  }
+  else
+  {
+    if(fresh == fresh_end)
+    {
+      fresh = map_chunk();
+      fresh_end = fresh ? fresh + CHUNK_BYTES : NULL;
+    }
+    if(fresh)
+    {
+      slot = fresh; // new mappings are already zero
+      fresh += SLOT_BYTES;
+    }
+  }
+  __atomic_clear(&lock, __ATOMIC_RELEASE);
+  if(dirty) memset(slot, 0, SLOT_BYTES);
+  return slot;
+}
+
+void arena_free(uint16* memory)
+{
+  if(!memory) return;
+  while(__atomic_test_and_set(&lock, __ATOMIC_ACQUIRE)) {}
+  *(void**)memory = free_slots;
+  free_slots = memory;
+  __atomic_clear(&lock, __ATOMIC_RELEASE);
+}
+
+#else
+
+uint16* arena_alloc()
+{
+  return calloc(MEMORY_MAX, sizeof(uint16));
+}
+
+void arena_free(uint16* memory)
+{
+  free(memory);
+}
+
+#endif
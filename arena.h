@@ -0,0 +1,17 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+/*
+  guest memory pool. every vm's MEMORY_MAX words come out of 2MB chunks
+  backed by huge pages on linux: hugetlbfs pages when some are reserved,
+  else transparent huge pages. 16 guests share one TLB entry instead of
+  32 each. chunks are kept for reuse, never given back to the system.
+  elsewhere it is plain calloc/free.
+*/
+
+#include "opcodes.h"
+
+uint16* arena_alloc(); // MEMORY_MAX zeroed words, NULL when out of memory
+void arena_free(uint16* memory); // thread safe, like arena_alloc()
+
+#endif
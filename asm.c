@@ -0,0 +1,1330 @@
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "asm.h"
+#include "enums.h"
+#include "isa.h"
+
+#define SOURCE_LINE 4096
+#define MAX_TOKENS 8 // mnemonic or directive and its operands
+#define LITERAL_TRIES 3 // pool slots tried per LD before giving up on a pool
+
+enum // operand formats of the mnemonics
+{
+  ARGS_NONE,
+  ARGS_ALU,  // DR, SR1, SR2 or imm5
+  ARGS_NOT,  // DR, SR
+  ARGS_PC9,  // label (BR)
+  ARGS_PC11, // label (JSR)
+  ARGS_RPC,  // DR/SR, label
+  ARGS_RRO,  // DR/SR, BaseR, offset6
+  ARGS_BASE, // BaseR
+  ARGS_TRAP  // trapvect8
+};
+
+static const int8_t arity[] =
+{
+  [ARGS_NONE] = 0, [ARGS_ALU] = 3, [ARGS_NOT] = 2, [ARGS_PC9] = 1, [ARGS_PC11] = 1,
+  [ARGS_RPC] = 2, [ARGS_RRO] = 3, [ARGS_BASE] = 1, [ARGS_TRAP] = 1
+};
+
+static const struct
+{
+  const char* name;
+  uint8_t args;
+  uint16_t word;
+} mnemonics[] =
+{
+  { "ADD", ARGS_ALU, OP_ADD << 12 },
+  { "AND", ARGS_ALU, OP_AND << 12 },
+  { "NOT", ARGS_NOT, OP_NOT << 12 | 0x3F },
+  { "JMP", ARGS_BASE, OP_JMP << 12 },
+  { "RET", ARGS_NONE, OP_JMP << 12 | R_R7 << 6 },
+  { "JSR", ARGS_PC11, OP_JSR << 12 | 1 << 11 },
+  { "JSRR", ARGS_BASE, OP_JSR << 12 },
+  { "LD", ARGS_RPC, OP_LD << 12 },
+  { "LDI", ARGS_RPC, OP_LDI << 12 },
+  { "ST", ARGS_RPC, OP_ST << 12 },
+  { "STI", ARGS_RPC, OP_STI << 12 },
+  { "LEA", ARGS_RPC, OP_LEA << 12 },
+  { "LDR", ARGS_RRO, OP_LDR << 12 },
+  { "STR", ARGS_RRO, OP_STR << 12 },
+  { "TRAP", ARGS_TRAP, OP_TRAP << 12 },
+  { "RTI", ARGS_NONE, OP_RTI << 12 },
+  { "GETC", ARGS_NONE, OP_TRAP << 12 | TRAP_GETC },
+  { "OUT", ARGS_NONE, OP_TRAP << 12 | TRAP_OUT },
+  { "PUTS", ARGS_NONE, OP_TRAP << 12 | TRAP_PUTS },
+  { "IN", ARGS_NONE, OP_TRAP << 12 | TRAP_IN },
+  { "PUTSP", ARGS_NONE, OP_TRAP << 12 | TRAP_PUTSP },
+  { "HALT", ARGS_NONE, OP_TRAP << 12 | TRAP_HALT }
+};
+
+#define MNEMONIC_COUNT (sizeof(mnemonics) / sizeof(mnemonics[0]))
+
+typedef struct // the module being parsed
+{
+  lc3_asm* as;
+  int file;
+  uint32_t line;
+  int section; // 0 before the first one, 1 inside, 2 after .END
+} module;
+
+typedef struct
+{
+  char* s[MAX_TOKENS];
+  int n;
+} tokens;
+
+static void error(lc3_asm* as, int file, uint32_t line, const char* fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  fprintf(stderr, "%s:%u: ", as->files[file], line);
+  vfprintf(stderr, fmt, ap);
+  fputc('\n', stderr);
+  va_end(ap);
+  ++as->errors;
+}
+
+static int grow(void** p, int32_t* cap, int32_t need, size_t size)
+{
+  if(need <= *cap) return 1;
+  int32_t n = *cap ? *cap : 256;
+  while(n < need) n *= 2;
+  void* q = realloc(*p, n * size);
+  if(!q) return 0;
+  *p = q;
+  *cap = n;
+  return 1;
+}
+
+lc3_asm* lc3_asm_create()
+{
+  return calloc(1, sizeof(lc3_asm));
+}
+
+void lc3_asm_free(lc3_asm* as)
+{
+  if(!as) return;
+  for(int32_t i = 0; i < as->nsyms; ++i)
+  {
+    free(as->syms[i].name);
+  }
+  for(int i = 0; i < as->nfiles; ++i)
+  {
+    free(as->files[i]);
+  }
+  free(as->items);
+  free(as->syms);
+  free(as->hash);
+  free(as->text);
+  free(as->files);
+  free(as);
+}
+
+
+/*============== SYMBOLS ===============*/
+
+static uint32_t hash_name(const char* s) // FNV-1a
+{
+  uint32_t h = 2166136261u;
+  for(; *s; ++s)
+  {
+    h = (h ^ (uint8_t)*s) * 16777619u;
+  }
+  return h;
+}
+
+static int32_t* slot(const lc3_asm* as, const char* name)
+{
+  uint32_t mask = as->cap_hash - 1;
+  for(uint32_t h = hash_name(name) & mask;; h = (h + 1) & mask)
+  {
+    int32_t s = as->hash[h] - 1;
+    if(s < 0 || strcmp(as->syms[s].name, name) == 0) return &as->hash[h];
+  }
+}
+
+static int rehash(lc3_asm* as)
+{
+  int32_t* old = as->hash;
+  int32_t cap = as->cap_hash;
+  as->cap_hash = cap ? cap * 2 : 1024;
+  as->hash = calloc(as->cap_hash, sizeof(int32_t));
+  if(!as->hash)
+  {
+    as->hash = old;
+    as->cap_hash = cap;
+    return 0;
+  }
+  for(int32_t i = 0; i < as->nsyms; ++i)
+  {
+    *slot(as, as->syms[i].name) = i + 1;
+  }
+  free(old);
+  return 1;
+}
+
+int32_t lc3_asm_label(lc3_asm* as, const char* name, int hidden)
+{
+  if(as->nsyms * 2 >= as->cap_hash && !rehash(as)) return -1;
+  int32_t* s = slot(as, name);
+  if(*s) return *s - 1;
+  char* copy = malloc(strlen(name) + 1);
+  if(!copy || !grow((void**)&as->syms, &as->cap_syms, as->nsyms + 1, sizeof(lc3_asm_symbol)))
+  {
+    free(copy);
+    return -1;
+  }
+  strcpy(copy, name);
+  lc3_asm_symbol* sym = &as->syms[as->nsyms];
+  sym->name = copy;
+  sym->def = -1;
+  sym->addr = 0;
+  sym->hidden = (uint8_t)hidden;
+  *s = ++as->nsyms;
+  return as->nsyms - 1;
+}
+
+int32_t lc3_asm_new_label(lc3_asm* as)
+{
+  char name[16];
+  snprintf(name, sizeof(name), "$%d", as->nsyms); // can't clash, labels don't start with $
+  return lc3_asm_label(as, name, 1);
+}
+
+
+/*=============== ITEMS ================*/
+
+int lc3_asm_insert(lc3_asm* as, int32_t at, const lc3_asm_item* it, int32_t n)
+{
+  if(!grow((void**)&as->items, &as->cap_items, as->nitems + n, sizeof(lc3_asm_item))) return 0;
+  memmove(&as->items[at + n], &as->items[at], (as->nitems - at) * sizeof(lc3_asm_item));
+  memcpy(&as->items[at], it, n * sizeof(lc3_asm_item));
+  as->nitems += n;
+  return 1;
+}
+
+void lc3_asm_compact(lc3_asm* as)
+{
+  int32_t n = 0;
+  for(int32_t i = 0; i < as->nitems; ++i)
+  {
+    if(as->items[i].kind != LC3_ASM_NONE) as->items[n++] = as->items[i];
+  }
+  as->nitems = n;
+}
+
+int32_t lc3_asm_size(const lc3_asm_item* it)
+{
+  switch(it->kind)
+  {
+    case LC3_ASM_INSN:
+    case LC3_ASM_FILL:
+      return 1;
+    case LC3_ASM_BLKW:
+      return it->count;
+    case LC3_ASM_STRING:
+      return it->flags & LC3_ASM_PACKED ? (it->count + 1) / 2 + 1 : it->count + 1;
+  }
+  return 0;
+}
+
+int lc3_asm_jumps(const lc3_asm_item* it)
+{
+  if(it->kind != LC3_ASM_INSN) return 0;
+  uint16_t op = it->word >> 12;
+  return (op == OP_BR && FIELD_NZP(it->word) == 7) || op == OP_JMP || op == OP_RTI
+         || it->word == (OP_TRAP << 12 | TRAP_HALT);
+}
+
+int lc3_asm_constant(int r, uint16_t value, uint16_t* words)
+{
+  // count up by 15 or down by 16, whichever gets there in fewer steps
+  uint32_t up = value;
+  uint32_t down = 0x10000 - value;
+  int steps_up = (up + 14) / 15;
+  int steps_down = (down + 15) / 16;
+  int down_is_shorter = steps_down < steps_up;
+  int steps = value == 0 ? 0 : down_is_shorter ? steps_down : steps_up;
+  if(!words) return 1 + steps;
+
+  uint16_t add = OP_ADD << 12 | r << 9 | r << 6 | 1 << 5;
+  words[0] = OP_AND << 12 | r << 9 | r << 6 | 1 << 5;
+  uint32_t left = down_is_shorter ? down : up;
+  for(int i = 1; i <= steps; ++i)
+  {
+    uint32_t step = down_is_shorter ? (left > 16 ? 16 : left) : (left > 15 ? 15 : left);
+    left -= step;
+    words[i] = add | ((down_is_shorter ? -(int)step : (int)step) & 0x1F);
+  }
+  return 1 + steps;
+}
+
+
+/*============== PARSING ===============*/
+
+static lc3_asm_item* add_item(module* m, uint8_t kind)
+{
+  lc3_asm* as = m->as;
+  if(!grow((void**)&as->items, &as->cap_items, as->nitems + 1, sizeof(lc3_asm_item)))
+  {
+    error(as, m->file, m->line, "out of memory");
+    return NULL;
+  }
+  lc3_asm_item* it = &as->items[as->nitems++];
+  memset(it, 0, sizeof(*it));
+  it->kind = kind;
+  it->sym = -1;
+  it->file = (uint16_t)m->file;
+  it->line = m->line;
+  return it;
+}
+
+static int same(const char* a, const char* b) // case insensitive
+{
+  for(; *a && *b; ++a, ++b)
+  {
+    if(toupper((unsigned char)*a) != toupper((unsigned char)*b)) return 0;
+  }
+  return *a == *b;
+}
+
+static int find_mnemonic(const char* s)
+{
+  for(size_t i = 0; i < MNEMONIC_COUNT; ++i)
+  {
+    if(same(s, mnemonics[i].name)) return (int)i;
+  }
+  return -1;
+}
+
+static int branch_mask(const char* s) // nzp of BR, BRn, BRzp..., -1 when s is not a branch
+{
+  if(toupper((unsigned char)s[0]) != 'B' || toupper((unsigned char)s[1]) != 'R') return -1;
+  int nzp = 0;
+  for(s += 2; *s; ++s)
+  {
+    int c = toupper((unsigned char)*s);
+    int bit = c == 'N' ? FL_NEG : c == 'Z' ? FL_ZRO : c == 'P' ? FL_POS : 0;
+    if(!bit || (nzp & bit)) return -1;
+    nzp |= bit;
+  }
+  return nzp ? nzp : FL_NEG | FL_ZRO | FL_POS;
+}
+
+static int number(const char* s, long* v) // #decimal, decimal, xHEX or 0xHEX, 1 when s is all number
+{
+  int neg = 0;
+  int base = 10;
+  if(*s == '#') ++s;
+  if(*s == '-')
+  {
+    neg = 1;
+    ++s;
+  }
+  if((*s == 'x' || *s == 'X') && s[1])
+  {
+    base = 16;
+    ++s;
+  }
+  else if(s[0] == '0' && (s[1] == 'x' || s[1] == 'X') && s[2])
+  {
+    base = 16;
+    s += 2;
+  }
+  if(!neg && *s == '-')
+  {
+    neg = 1;
+    ++s;
+  }
+  if(!(base == 16 ? isxdigit((unsigned char)*s) : isdigit((unsigned char)*s))) return 0;
+  char* end;
+  long n = strtol(s, &end, base);
+  if(*end) return 0;
+  *v = neg ? -n : n;
+  return 1;
+}
+
+static int is_register(const char* s)
+{
+  return (s[0] == 'R' || s[0] == 'r') && s[1] >= '0' && s[1] <= '7' && !s[2];
+}
+
+static int is_label(const char* s)
+{
+  long v;
+  if(!(isalpha((unsigned char)*s) || *s == '_') || is_register(s) || number(s, &v)) return 0;
+  for(++s; *s; ++s)
+  {
+    if(!(isalnum((unsigned char)*s) || *s == '_')) return 0;
+  }
+  return 1;
+}
+
+static int reg(module* m, const char* s) // register number, -1 with an error
+{
+  if(is_register(s)) return s[1] - '0';
+  error(m->as, m->file, m->line, "%s is not a register", s);
+  return -1;
+}
+
+static int imm(module* m, const char* s, long lo, long hi, long* v) // 0 with an error
+{
+  if(number(s, v) && *v >= lo && *v <= hi) return 1;
+  error(m->as, m->file, m->line, "%s is not a number from %ld to %ld", s, lo, hi);
+  return 0;
+}
+
+static void pc_operand(module* m, lc3_asm_item* it, const char* s, int bits)
+{
+  long v;
+  if(number(s, &v))
+  {
+    if(!imm(m, s, -(1L << (bits - 1)), (1L << (bits - 1)) - 1, &v)) return;
+    it->flags |= LC3_ASM_OFFSET;
+    it->count = (int32_t)v;
+  }
+  else if(is_label(s))
+  {
+    it->sym = lc3_asm_label(m->as, s, 0);
+    if(it->sym < 0) error(m->as, m->file, m->line, "out of memory");
+  }
+  else error(m->as, m->file, m->line, "%s is not a label or an offset", s);
+}
+
+static int need_section(module* m) // 0 with an error after .END
+{
+  if(m->section == 1) return 1;
+  if(m->section == 2)
+  {
+    error(m->as, m->file, m->line, "outside .ORIG/.END");
+    return 0;
+  }
+  lc3_asm_item* it = add_item(m, LC3_ASM_SECTION);
+  if(!it) return 0;
+  it->count = LC3_ASM_FOLLOW;
+  m->section = 1;
+  return 1;
+}
+
+static int split(module* m, char* p, tokens* t) // 0 with an error
+{
+  t->n = 0;
+  for(;;)
+  {
+    while(*p && strchr(" \t\r\n,", *p)) ++p;
+    if(!*p || *p == ';') return 1;
+    if(t->n == MAX_TOKENS)
+    {
+      error(m->as, m->file, m->line, "too many operands");
+      return 0;
+    }
+    t->s[t->n++] = p;
+    if(*p == '"')
+    {
+      for(++p; *p && *p != '"'; p += p[0] == '\\' && p[1] ? 2 : 1) {}
+      if(*p != '"')
+      {
+        error(m->as, m->file, m->line, "unterminated string");
+        return 0;
+      }
+      ++p;
+      if(*p && !strchr(" \t\r\n,;", *p))
+      {
+        error(m->as, m->file, m->line, "junk after string");
+        return 0;
+      }
+    }
+    else
+    {
+      while(*p && !strchr(" \t\r\n,;", *p)) ++p;
+    }
+    if(!*p) return 1;
+    char c = *p;
+    *p++ = 0;
+    if(c == ';') return 1;
+  }
+}
+
+static void stringz(module* m, const char* s) // s is the quoted string
+{
+  lc3_asm* as = m->as;
+  size_t len = strlen(s);
+  if(len < 2 || s[0] != '"')
+  {
+    error(as, m->file, m->line, ".STRINGZ needs a quoted string");
+    return;
+  }
+  lc3_asm_item* it = add_item(m, LC3_ASM_STRING);
+  if(!it || !grow((void**)&as->text, &as->cap_text, as->ntext + (int32_t)len, 1))
+  {
+    if(it) error(as, m->file, m->line, "out of memory");
+    return;
+  }
+  it->text = as->ntext;
+  for(const char* p = s + 1; p < s + len - 1; ++p)
+  {
+    char c = *p;
+    if(c == '\\')
+    {
+      switch(*++p)
+      {
+        case 'n': c = '\n'; break;
+        case 't': c = '\t'; break;
+        case 'r': c = '\r'; break;
+        case 'e': c = 27; break;
+        case '0': c = 0; break;
+        case '\\': case '"': case '\'': c = *p; break;
+        default:
+          error(as, m->file, m->line, "unknown escape \\%c", *p);
+          return;
+      }
+    }
+    if(!c)
+    {
+      error(as, m->file, m->line, "\\0 would end the string early");
+      return;
+    }
+    as->text[as->ntext++] = c;
+  }
+  it->count = (int32_t)(as->ntext - it->text);
+}
+
+static void directive(module* m, const char* op, char** arg, int n)
+{
+  lc3_asm* as = m->as;
+  int orig = same(op, ".ORIG");
+  int end = same(op, ".END");
+  int fill = same(op, ".FILL");
+  int blkw = same(op, ".BLKW");
+  if(!orig && !end && !fill && !blkw && !same(op, ".STRINGZ"))
+  {
+    error(as, m->file, m->line, "unknown directive %s", op);
+    return;
+  }
+  if(end ? n != 0 : blkw ? n < 1 || n > 2 : n != 1)
+  {
+    error(as, m->file, m->line, "wrong number of operands for %s", op);
+    return;
+  }
+
+  long v, value = 0;
+  if(orig)
+  {
+    if(!imm(m, arg[0], 0, 0xFFFF, &v)) return;
+    lc3_asm_item* it = add_item(m, LC3_ASM_SECTION);
+    if(it) it->count = (int32_t)v;
+    m->section = 1; // a second .ORIG ends the section before it
+  }
+  else if(end)
+  {
+    if(m->section != 1) error(as, m->file, m->line, ".END outside a section");
+    m->section = 2;
+  }
+  else if(!need_section(m)) return;
+  else if(fill)
+  {
+    lc3_asm_item* it = add_item(m, LC3_ASM_FILL);
+    if(!it) return;
+    if(is_label(arg[0])) it->sym = lc3_asm_label(as, arg[0], 0);
+    else if(imm(m, arg[0], -0x8000, 0xFFFF, &v)) it->word = (uint16_t)v;
+  }
+  else if(blkw)
+  {
+    if(!imm(m, arg[0], 1, 0xFFFF, &v) || (n == 2 && !imm(m, arg[1], -0x8000, 0xFFFF, &value))) return;
+    lc3_asm_item* it = add_item(m, LC3_ASM_BLKW);
+    if(!it) return;
+    it->count = (int32_t)v;
+    it->word = (uint16_t)value;
+  }
+  else stringz(m, arg[0]);
+}
+
+static void instruction(module* m, const char* op, char** arg, int n)
+{
+  int k = find_mnemonic(op);
+  int nzp = k < 0 ? branch_mask(op) : -1;
+  if(k < 0 && nzp < 0)
+  {
+    error(m->as, m->file, m->line, "unknown instruction %s", op);
+    return;
+  }
+  int args = nzp >= 0 ? ARGS_PC9 : mnemonics[k].args;
+  if(n != arity[args])
+  {
+    error(m->as, m->file, m->line, "%s takes %d operands", op, arity[args]);
+    return;
+  }
+  if(!need_section(m)) return;
+  lc3_asm_item* it = add_item(m, LC3_ASM_INSN);
+  if(!it) return;
+  it->word = nzp >= 0 ? (uint16_t)(OP_BR << 12 | nzp << 9) : mnemonics[k].word;
+
+  int r0, r1;
+  long v;
+  switch(args)
+  {
+    case ARGS_ALU:
+      if((r0 = reg(m, arg[0])) < 0 || (r1 = reg(m, arg[1])) < 0) break;
+      it->word |= r0 << 9 | r1 << 6;
+      if(is_register(arg[2])) it->word |= arg[2][1] - '0';
+      else if(imm(m, arg[2], -16, 15, &v)) it->word |= 1 << 5 | (v & 0x1F);
+      break;
+    case ARGS_NOT:
+      if((r0 = reg(m, arg[0])) < 0 || (r1 = reg(m, arg[1])) < 0) break;
+      it->word |= r0 << 9 | r1 << 6;
+      break;
+    case ARGS_PC9:
+      pc_operand(m, it, arg[0], 9);
+      break;
+    case ARGS_PC11:
+      pc_operand(m, it, arg[0], 11);
+      break;
+    case ARGS_RPC:
+      if((r0 = reg(m, arg[0])) < 0) break;
+      it->word |= r0 << 9;
+      pc_operand(m, it, arg[1], 9);
+      break;
+    case ARGS_RRO:
+      if((r0 = reg(m, arg[0])) < 0 || (r1 = reg(m, arg[1])) < 0) break;
+      if(imm(m, arg[2], -32, 31, &v)) it->word |= r0 << 9 | r1 << 6 | (v & 0x3F);
+      break;
+    case ARGS_BASE:
+      if((r1 = reg(m, arg[0])) >= 0) it->word |= r1 << 6;
+      break;
+    case ARGS_TRAP:
+      if(imm(m, arg[0], 0, 0xFF, &v)) it->word |= v;
+      break;
+  }
+}
+
+static void parse_line(module* m, char* line)
+{
+  tokens t;
+  if(!split(m, line, &t) || !t.n) return;
+  int i = 0;
+  char* first = t.s[0];
+  if(first[0] != '.' && find_mnemonic(first) < 0 && branch_mask(first) < 0)
+  {
+    size_t len = strlen(first);
+    if(len > 1 && first[len - 1] == ':') first[len - 1] = 0;
+    if(!is_label(first))
+    {
+      error(m->as, m->file, m->line, "%s is not a valid label", first);
+      return;
+    }
+    if(!need_section(m)) return;
+    int32_t s = lc3_asm_label(m->as, first, 0);
+    if(s < 0)
+    {
+      error(m->as, m->file, m->line, "out of memory");
+      return;
+    }
+    if(m->as->syms[s].def >= 0)
+    {
+      const lc3_asm_item* def = &m->as->items[m->as->syms[s].def];
+      error(m->as, m->file, m->line, "%s already defined at %s:%u", first, m->as->files[def->file], def->line);
+      return;
+    }
+    lc3_asm_item* it = add_item(m, LC3_ASM_LABEL);
+    if(!it) return;
+    it->sym = s;
+    m->as->syms[s].def = m->as->nitems - 1;
+    i = 1;
+  }
+  if(i == t.n) return;
+  if(t.s[i][0] == '.') directive(m, t.s[i], &t.s[i + 1], t.n - i - 1);
+  else instruction(m, t.s[i], &t.s[i + 1], t.n - i - 1);
+}
+
+typedef struct // a label a numeric offset gets
+{
+  int32_t at; // inserted before this item
+  int32_t sym;
+} offset_label;
+
+static int by_place(const void* x, const void* y) // latest first
+{
+  const offset_label* a = x;
+  const offset_label* b = y;
+  return (a->at < b->at) - (a->at > b->at);
+}
+
+// numeric PC offsets into the same section become labels, so the optimizer
+// can move code around them. the others pin the layout.
+static void offsets_to_labels(lc3_asm* as, int32_t first)
+{
+  int32_t n = as->nitems - first;
+  int32_t* pos = malloc((n + 1) * sizeof(int32_t));
+  offset_label* labels = malloc((n + 1) * sizeof(offset_label));
+  if(!pos || !labels)
+  {
+    free(pos);
+    free(labels);
+    as->pinned = 1;
+    return;
+  }
+  int32_t p = 0;
+  for(int32_t i = first; i < as->nitems; ++i)
+  {
+    if(as->items[i].kind == LC3_ASM_SECTION) p = 0;
+    pos[i - first] = p;
+    p += lc3_asm_size(&as->items[i]);
+  }
+
+  int nlabels = 0;
+  for(int32_t i = first; i < as->nitems; ++i)
+  {
+    lc3_asm_item* it = &as->items[i];
+    if(!(it->flags & LC3_ASM_OFFSET)) continue;
+    int32_t target = pos[i - first] + 1 + it->count;
+    int32_t at = -1;
+    int32_t j = i;
+    int32_t step = target > pos[i - first] ? 1 : -1;
+    for(j += step; j > first && j < as->nitems && as->items[j].kind != LC3_ASM_SECTION; j += step)
+    {
+      if(!lc3_asm_size(&as->items[j])) continue;
+      if(pos[j - first] == target) at = j;
+      if(pos[j - first] == target || (pos[j - first] > target) == (step > 0)) break;
+    }
+    if(at < 0 && step > 0 && (j == as->nitems || as->items[j].kind == LC3_ASM_SECTION)
+       && pos[j - 1 - first] + lc3_asm_size(&as->items[j - 1]) == target)
+    {
+      at = j; // just past the end of the section
+    }
+    if(at < 0)
+    {
+      as->pinned = 1; // mid-data or outside the section
+      continue;
+    }
+    int k = 0;
+    while(k < nlabels && labels[k].at != at) ++k;
+    if(k == nlabels)
+    {
+      labels[nlabels].at = at;
+      labels[nlabels].sym = lc3_asm_new_label(as);
+      if(labels[nlabels].sym < 0)
+      {
+        as->pinned = 1;
+        continue;
+      }
+      ++nlabels;
+    }
+    it->sym = labels[k].sym;
+    it->flags &= ~LC3_ASM_OFFSET;
+  }
+
+  qsort(labels, nlabels, sizeof(offset_label), by_place);
+  for(int k = 0; k < nlabels; ++k)
+  {
+    lc3_asm_item label = as->items[labels[k].at < as->nitems ? labels[k].at : labels[k].at - 1];
+    label.kind = LC3_ASM_LABEL;
+    label.flags = 0;
+    label.sym = labels[k].sym;
+    if(!lc3_asm_insert(as, labels[k].at, &label, 1)) as->errors++;
+  }
+  free(pos);
+  free(labels);
+}
+
+int lc3_asm_file(lc3_asm* as, const char* path)
+{
+  char** files = realloc(as->files, (as->nfiles + 1) * sizeof(char*));
+  char* name = malloc(strlen(path) + 1);
+  if(!files || !name)
+  {
+    if(files) as->files = files;
+    free(name);
+    fprintf(stderr, "out of memory\n");
+    ++as->errors;
+    return 0;
+  }
+  as->files = files;
+  strcpy(name, path);
+  as->files[as->nfiles] = name;
+
+  FILE* file = fopen(path, "r");
+  if(!file)
+  {
+    fprintf(stderr, "can't open %s\n", path);
+    free(name);
+    ++as->errors;
+    return 0;
+  }
+  module m = { as, as->nfiles++, 0, 0 };
+  int errors = as->errors;
+  int32_t first = as->nitems;
+  char line[SOURCE_LINE];
+  while(fgets(line, sizeof(line), file))
+  {
+    ++m.line;
+    size_t len = strlen(line);
+    if(len == sizeof(line) - 1 && line[len - 1] != '\n')
+    {
+      error(as, m.file, m.line, "line too long");
+      int c;
+      while((c = fgetc(file)) != EOF && c != '\n') {}
+      continue;
+    }
+    parse_line(&m, line);
+  }
+  fclose(file);
+  offsets_to_labels(as, first);
+  return as->errors == errors;
+}
+
+
+/*=============== LAYOUT ===============*/
+
+typedef struct
+{
+  uint32_t start;
+  uint32_t end;
+  int32_t item;
+} span;
+
+static int by_start(const void* x, const void* y)
+{
+  const span* a = x;
+  const span* b = y;
+  return (a->start > b->start) - (a->start < b->start);
+}
+
+int lc3_asm_layout(lc3_asm* as, int report)
+{
+  int32_t nsections = 0;
+  for(int32_t i = 0; i < as->nitems; ++i)
+  {
+    nsections += as->items[i].kind == LC3_ASM_SECTION;
+  }
+  span* spans = malloc((nsections + 1) * sizeof(span));
+  if(!spans)
+  {
+    if(report) fprintf(stderr, "out of memory\n");
+    return 0;
+  }
+  for(int32_t s = 0; s < as->nsyms; ++s)
+  {
+    as->syms[s].def = -1;
+  }
+
+  int ok = 1;
+  int32_t n = 0;
+  uint32_t cur = PC_START;
+  for(int32_t i = 0; i < as->nitems; ++i)
+  {
+    lc3_asm_item* it = &as->items[i];
+    if(it->kind == LC3_ASM_SECTION)
+    {
+      if(n) spans[n - 1].end = cur;
+      if(it->count != LC3_ASM_FOLLOW) cur = (uint32_t)it->count;
+      spans[n].start = cur;
+      spans[n].item = i;
+      ++n;
+      continue;
+    }
+    if(it->kind == LC3_ASM_LABEL)
+    {
+      as->syms[it->sym].def = i;
+      as->syms[it->sym].addr = (uint16_t)cur;
+      continue;
+    }
+    int32_t size = lc3_asm_size(it);
+    it->addr = (uint16_t)cur;
+    if(cur + size > 0x10000 && ok)
+    {
+      if(report) error(as, it->file, it->line, "runs past xFFFF");
+      ok = 0;
+    }
+    cur += size;
+  }
+  if(n) spans[n - 1].end = cur;
+
+  qsort(spans, n, sizeof(span), by_start);
+  for(int32_t k = 1, last = 0; k < n && ok; ++k)
+  {
+    if(spans[k].start == spans[k].end) continue;
+    if(spans[k].start < spans[last].end)
+    {
+      const lc3_asm_item* a = &as->items[spans[k].item];
+      const lc3_asm_item* b = &as->items[spans[last].item];
+      if(report) error(as, a->file, a->line, "section overlaps the one at %s:%u", as->files[b->file], b->line);
+      ok = 0;
+    }
+    if(spans[k].end > spans[last].end) last = k;
+  }
+  free(spans);
+  return ok;
+}
+
+static int pc_bits(uint16_t word) // width of the PC offset of an instruction with a label operand
+{
+  return word >> 12 == OP_JSR ? 11 : 9;
+}
+
+int32_t lc3_asm_out_of_range(const lc3_asm* as, int jsr)
+{
+  for(int32_t i = 0; i < as->nitems; ++i)
+  {
+    const lc3_asm_item* it = &as->items[i];
+    if(it->kind != LC3_ASM_INSN || it->sym < 0) continue;
+    if(!jsr && it->word >> 12 == OP_JSR) continue;
+    int off = (int16_t)(as->syms[it->sym].addr - it->addr - 1);
+    int lim = 1 << (pc_bits(it->word) - 1);
+    if(off < -lim || off >= lim) return i;
+  }
+  return -1;
+}
+
+
+/*============== LINKING ===============*/
+
+static lc3_asm_item* snapshot(const lc3_asm* as)
+{
+  lc3_asm_item* copy = malloc((as->nitems + 1) * sizeof(lc3_asm_item));
+  if(copy) memcpy(copy, as->items, as->nitems * sizeof(lc3_asm_item));
+  return copy;
+}
+
+static void restore(lc3_asm* as, const lc3_asm_item* copy, int32_t n) // the program only grows in between
+{
+  memcpy(as->items, copy, n * sizeof(lc3_asm_item));
+  as->nitems = n;
+}
+
+static int in_reach(int32_t from, int32_t to) // of a 9-bit PC offset, from is the incremented PC
+{
+  int off = to - from;
+  return off >= -256 && off <= 255;
+}
+
+// label of a literal the LD at i already reaches holding the address of sym
+// (or value when sym is -1), -1 when there is none
+static int32_t shared_literal(const lc3_asm* as, int32_t i, int32_t sym, uint16_t value)
+{
+  int32_t pc = as->items[i].addr + 1;
+  for(int32_t j = 1; j < as->nitems; ++j)
+  {
+    const lc3_asm_item* it = &as->items[j];
+    if(it->kind != LC3_ASM_FILL || !(it->flags & LC3_ASM_LITERAL)) continue;
+    if(it->sym == sym && (sym >= 0 || it->word == value) && in_reach(pc, it->addr)) return as->items[j - 1].sym;
+  }
+  return -1;
+}
+
+// points the LD at i, on a laid out program, to a literal: shared with an
+// equal one or a new one after the nearest jump within reach, nothing
+// falls through into it there. 0 when there is no room.
+static int place_literal(lc3_asm* as, int32_t i, int32_t sym, uint16_t value)
+{
+  int32_t shared = shared_literal(as, i, sym, value);
+  if(shared >= 0)
+  {
+    as->items[i].sym = shared;
+    return 1;
+  }
+  int32_t label = lc3_asm_new_label(as);
+  int32_t n = as->nitems;
+  lc3_asm_item* saved = label >= 0 ? snapshot(as) : NULL;
+  if(!saved) return 0;
+
+  int32_t tried[LITERAL_TRIES];
+  int ok = 0;
+  for(int t = 0; t < LITERAL_TRIES && !ok; ++t)
+  {
+    int32_t pc = as->items[i].addr + 1;
+    int32_t best = -1;
+    int best_dist = 0;
+    for(int32_t j = 0; j < as->nitems; ++j)
+    {
+      if(!lc3_asm_jumps(&as->items[j])) continue;
+      int32_t at = as->items[j].addr + 1; // the LD moves down a word when the literal goes in before it
+      int32_t from = j < i ? pc + 1 : pc;
+      int dist = abs(at - from);
+      int seen = 0;
+      for(int k = 0; k < t; ++k) seen |= tried[k] == j;
+      if(!seen && in_reach(from, at) && (best < 0 || dist < best_dist))
+      {
+        best = j;
+        best_dist = dist;
+      }
+    }
+    if(best < 0) break;
+    tried[t] = best;
+
+    lc3_asm_item pool[2];
+    pool[0] = as->items[i];
+    pool[0].kind = LC3_ASM_LABEL;
+    pool[0].flags = 0;
+    pool[0].sym = label;
+    pool[1] = pool[0];
+    pool[1].kind = LC3_ASM_FILL;
+    pool[1].flags = LC3_ASM_LITERAL;
+    pool[1].sym = sym;
+    pool[1].word = sym >= 0 ? 0 : value;
+    if(!lc3_asm_insert(as, best + 1, pool, 2)) break;
+    as->items[best < i ? i + 2 : i].sym = label;
+    ok = lc3_asm_layout(as, 0) && lc3_asm_out_of_range(as, 0) < 0;
+    if(!ok)
+    {
+      restore(as, saved, n);
+      lc3_asm_layout(as, 0);
+    }
+  }
+  free(saved);
+  return ok;
+}
+
+static int expand_constant(lc3_asm* as, int32_t i) // AND/ADD form of a pooled LD that found no room
+{
+  lc3_asm_item it = as->items[i];
+  int n = lc3_asm_constant(FIELD_DR(it.word), (uint16_t)it.count, NULL);
+  uint16_t* words = malloc(n * sizeof(uint16_t));
+  lc3_asm_item* adds = malloc(n * sizeof(lc3_asm_item));
+  int ok = words && adds;
+  if(ok)
+  {
+    lc3_asm_constant(FIELD_DR(it.word), (uint16_t)it.count, words);
+    it.flags = 0;
+    it.sym = -1;
+    for(int k = 0; k < n; ++k)
+    {
+      adds[k] = it;
+      adds[k].word = words[k];
+    }
+    as->items[i] = adds[0];
+    ok = lc3_asm_insert(as, i + 1, adds + 1, n - 1);
+  }
+  free(words);
+  free(adds);
+  return ok;
+}
+
+// JSR target out of reach: LD R7, =target / JSRR R7, or when no literal
+// fits in reach either, BRnzp over a literal right in front of them
+static int far_call(lc3_asm* as, int32_t i)
+{
+  lc3_asm_item call = as->items[i];
+  int32_t n = as->nitems;
+  lc3_asm_item* saved = snapshot(as);
+  if(!saved) return 0;
+  lc3_asm_item seq[6];
+  for(int k = 0; k < 6; ++k)
+  {
+    seq[k] = call;
+    seq[k].flags = 0;
+    seq[k].sym = -1;
+  }
+  seq[0].word = OP_LD << 12 | R_R7 << 9;
+  seq[1].word = OP_JSR << 12 | R_R7 << 6;
+  as->items[i] = seq[0];
+  int ok = lc3_asm_insert(as, i + 1, &seq[1], 1) && lc3_asm_layout(as, 0) && place_literal(as, i, call.sym, 0);
+  if(!ok)
+  {
+    restore(as, saved, n);
+    int32_t lit = lc3_asm_new_label(as);
+    int32_t over = lc3_asm_new_label(as);
+    ok = lit >= 0 && over >= 0;
+    seq[0].word = OP_BR << 12 | 7 << 9;
+    seq[0].sym = over;
+    seq[1].kind = LC3_ASM_LABEL;
+    seq[1].sym = lit;
+    seq[2].kind = LC3_ASM_FILL;
+    seq[2].flags = LC3_ASM_LITERAL;
+    seq[2].sym = call.sym;
+    seq[3].kind = LC3_ASM_LABEL;
+    seq[3].sym = over;
+    seq[4].word = OP_LD << 12 | R_R7 << 9;
+    seq[4].sym = lit;
+    seq[5].word = OP_JSR << 12 | R_R7 << 6;
+    if(ok)
+    {
+      as->items[i] = seq[0];
+      ok = lc3_asm_insert(as, i + 1, &seq[1], 5);
+    }
+  }
+  as->stats.far_calls += ok;
+  free(saved);
+  return ok;
+}
+
+static int relax(lc3_asm* as) // pools the optimizer's constants and links far calls, 0 when out of memory
+{
+  for(int32_t i = 0; i < as->nitems; ++i)
+  {
+    lc3_asm_item* it = &as->items[i];
+    if(!(it->flags & LC3_ASM_POOL)) continue;
+    it->flags &= ~LC3_ASM_POOL;
+    if(!lc3_asm_layout(as, 0)) return 1; // reported by the caller
+    if(!place_literal(as, i, -1, (uint16_t)as->items[i].count) && !expand_constant(as, i)) return 0;
+  }
+  for(;;)
+  {
+    if(!lc3_asm_layout(as, 0)) return 1;
+    int32_t i = lc3_asm_out_of_range(as, 1);
+    if(i < 0 || as->items[i].word >> 12 != OP_JSR) return 1;
+    if(!far_call(as, i)) return 0;
+  }
+}
+
+int lc3_asm_link(lc3_asm* as, int optimize)
+{
+  if(as->errors || !lc3_asm_layout(as, 1)) return 0;
+  for(int32_t i = 0; i < as->nitems; ++i)
+  {
+    const lc3_asm_item* it = &as->items[i];
+    if((it->kind == LC3_ASM_INSN || it->kind == LC3_ASM_FILL) && it->sym >= 0 && as->syms[it->sym].def < 0)
+    {
+      error(as, it->file, it->line, "undefined label %s", as->syms[it->sym].name);
+    }
+  }
+  if(as->errors) return 0;
+  if(optimize && as->pinned)
+  {
+    fprintf(stderr, "warning: numeric offsets out of their section or into data, not optimizing\n");
+    optimize = 0;
+  }
+
+  int32_t n = as->nitems;
+  lc3_asm_item* plain = NULL;
+  if(optimize)
+  {
+    plain = snapshot(as);
+    if(!plain)
+    {
+      fprintf(stderr, "out of memory\n");
+      return 0;
+    }
+    lc3_asm_optimize(as);
+    if(lc3_asm_layout(as, 0)) lc3_asm_place(as);
+  }
+  int ok = relax(as) && lc3_asm_layout(as, 0) && lc3_asm_out_of_range(as, 1) < 0;
+  if(!ok && plain)
+  {
+    // something the optimizer moved no longer reaches, the program as written may
+    restore(as, plain, n);
+    memset(&as->stats, 0, sizeof(as->stats));
+    ok = relax(as);
+    if(ok && lc3_asm_layout(as, 0) && lc3_asm_out_of_range(as, 1) < 0)
+    {
+      fprintf(stderr, "warning: the optimized program does not fit, linked as written\n");
+    }
+  }
+  free(plain);
+  if(!ok || !lc3_asm_layout(as, 1)) return 0;
+  int32_t bad = lc3_asm_out_of_range(as, 1);
+  if(bad >= 0)
+  {
+    const lc3_asm_item* it = &as->items[bad];
+    const lc3_asm_symbol* sym = &as->syms[it->sym];
+    if(sym->hidden) error(as, it->file, it->line, "offset out of range");
+    else error(as, it->file, it->line, "%s is out of range", sym->name);
+    return 0;
+  }
+
+  uint32_t lo = 0x10000, hi = 0;
+  for(int32_t i = 0; i < as->nitems; ++i)
+  {
+    int32_t size = lc3_asm_size(&as->items[i]);
+    if(!size) continue;
+    if(as->items[i].addr < lo) lo = as->items[i].addr;
+    if(as->items[i].addr + (uint32_t)size > hi) hi = as->items[i].addr + size;
+  }
+  as->stats.words = hi > lo ? hi - lo : 0;
+  return 1;
+}
+
+
+/*=============== OUTPUT ===============*/
+
+static void emit(const lc3_asm* as, const lc3_asm_item* it, uint16_t* image) // the item's words at image[addr]
+{
+  uint16_t* out = image + it->addr;
+  switch(it->kind)
+  {
+    case LC3_ASM_INSN:
+      {
+        uint16_t mask = (1 << pc_bits(it->word)) - 1;
+        if(it->sym >= 0) *out = it->word | ((as->syms[it->sym].addr - it->addr - 1) & mask);
+        else if(it->flags & LC3_ASM_OFFSET) *out = it->word | (it->count & mask);
+        else *out = it->word;
+        break;
+      }
+    case LC3_ASM_FILL:
+      *out = it->sym >= 0 ? as->syms[it->sym].addr : it->word;
+      break;
+    case LC3_ASM_BLKW:
+      for(int32_t k = 0; k < it->count; ++k) out[k] = it->word;
+      break;
+    case LC3_ASM_STRING:
+      {
+        const uint8_t* s = (const uint8_t*)as->text + it->text;
+        int32_t len = it->count;
+        if(it->flags & LC3_ASM_PACKED)
+        {
+          for(int32_t k = 0; k < len; k += 2) // first character in the low byte
+          {
+            *out++ = s[k] | (k + 1 < len ? s[k + 1] << 8 : 0);
+          }
+        }
+        else
+        {
+          for(int32_t k = 0; k < len; ++k) *out++ = s[k];
+        }
+        *out = 0;
+        break;
+      }
+  }
+}
+
+// one .obj: the origin, then the words from lo up to hi, big endian
+static int write_range(const uint16_t* image, uint32_t lo, uint32_t hi, const char* path)
+{
+  uint8_t* bytes = malloc(2 * (hi - lo + 1));
+  FILE* file = bytes ? fopen(path, "wb") : NULL;
+  int ok = file != NULL;
+  if(ok)
+  {
+    bytes[0] = (uint8_t)(lo >> 8);
+    bytes[1] = (uint8_t)lo;
+    for(uint32_t a = lo; a < hi; ++a)
+    {
+      bytes[2 * (a - lo + 1)] = (uint8_t)(image[a] >> 8);
+      bytes[2 * (a - lo + 1) + 1] = (uint8_t)image[a];
+    }
+    ok = fwrite(bytes, 2, hi - lo + 1, file) == hi - lo + 1;
+    ok = fclose(file) == 0 && ok;
+  }
+  free(bytes);
+  return ok;
+}
+
+static char* range_path(const char* obj_path, uint32_t lo) // prog.obj -> prog-x0180.obj, malloc()ed
+{
+  const char* slash = strrchr(obj_path, '/');
+  const char* dot = strrchr(obj_path, '.');
+  size_t len = dot && (!slash || dot > slash) ? (size_t)(dot - obj_path) : strlen(obj_path);
+  const char* ext = obj_path + len;
+  char* path = malloc(len + strlen(ext) + 7);
+  if(path) sprintf(path, "%.*s-x%04X%s", (int)len, obj_path, (unsigned)lo, ext);
+  return path;
+}
+
+// .obj holds one run of words, sections that don't touch become images
+// of their own so the gaps between them aren't written over with zeros
+static int write_image(const lc3_asm* as, const char* path)
+{
+  uint16_t* image = calloc(0x10000, sizeof(uint16_t));
+  span* spans = malloc((as->nitems + 1) * sizeof(span));
+  if(!image || !spans)
+  {
+    fprintf(stderr, "out of memory\n");
+    free(image);
+    free(spans);
+    return 0;
+  }
+  int32_t n = 0;
+  for(int32_t i = 0; i < as->nitems; ++i)
+  {
+    const lc3_asm_item* it = &as->items[i];
+    int32_t size = lc3_asm_size(it);
+    if(!size) continue;
+    emit(as, it, image);
+    if(n && spans[n - 1].end == it->addr)
+    {
+      spans[n - 1].end += size;
+      continue;
+    }
+    spans[n].start = it->addr;
+    spans[n].end = it->addr + size;
+    spans[n].item = i;
+    ++n;
+  }
+  if(!n) // an empty program is an empty image at the usual origin
+  {
+    spans[0].start = spans[0].end = PC_START;
+    spans[0].item = 0;
+    n = 1;
+  }
+  qsort(spans, n, sizeof(span), by_start);
+  int32_t m = 0;
+  for(int32_t k = 1; k < n; ++k)
+  {
+    if(spans[k].start == spans[m].end)
+    {
+      spans[m].end = spans[k].end;
+      if(spans[k].item < spans[m].item) spans[m].item = spans[k].item;
+    }
+    else spans[++m] = spans[k];
+  }
+  n = m + 1;
+
+  // the one the program starts in keeps the name: the one holding
+  // PC_START, else the one holding the first section
+  int32_t first = 0;
+  for(int32_t k = 1; k < n; ++k)
+  {
+    if(spans[k].item < spans[first].item) first = k;
+  }
+  for(int32_t k = 0; k < n; ++k)
+  {
+    if(spans[k].start <= PC_START && PC_START < spans[k].end) first = k;
+  }
+  int ok = 1;
+  for(int32_t k = 0; k < n && ok; ++k)
+  {
+    char* other = k == first ? NULL : range_path(path, spans[k].start);
+    ok = (k == first || other) && write_range(image, spans[k].start, spans[k].end, other ? other : path);
+    if(ok && other)
+    {
+      fprintf(stderr, "x%04X-x%04X is apart from the rest, written to %s\n",
+              (unsigned)spans[k].start, (unsigned)spans[k].end - 1, other);
+    }
+    else if(!ok)
+    {
+      fprintf(stderr, "can't write %s\n", other ? other : path);
+    }
+    free(other);
+  }
+  free(spans);
+  free(image);
+  return ok;
+}
+
+static int write_symbols(const lc3_asm* as, const char* path)
+{
+  FILE* file = fopen(path, "w");
+  if(!file) return 0;
+  fprintf(file, "lc3sym 1\n");
+  for(int i = 0; i < as->nfiles; ++i)
+  {
+    fprintf(file, "f %d %s\n", i, as->files[i]);
+  }
+  for(int32_t i = 0; i < as->nitems; ++i)
+  {
+    const lc3_asm_item* it = &as->items[i];
+    if(it->kind == LC3_ASM_LABEL && !as->syms[it->sym].hidden)
+    {
+      fprintf(file, "s %04x %s\n", as->syms[it->sym].addr, as->syms[it->sym].name);
+    }
+    else if(lc3_asm_size(it))
+    {
+      fprintf(file, "l %04x %d %u\n", it->addr, it->file, it->line);
+    }
+  }
+  return fclose(file) == 0;
+}
+
+int lc3_asm_write(lc3_asm* as, const char* obj_path, const char* sym_path)
+{
+  if(!write_image(as, obj_path)) return 0; // reported the file that failed
+  if(sym_path && !write_symbols(as, sym_path))
+  {
+    fprintf(stderr, "can't write %s\n", sym_path);
+    return 0;
+  }
+  return 1;
+}
@@ -0,0 +1,143 @@
+#ifndef ASM_H
+#define ASM_H
+
+/*
+  assembler and linker for lc-3 assembly, writes the .obj images that
+  lc3_load_image() reads: the origin and then the words, big endian.
+
+  every source file is one module, labels are global across modules and
+  case sensitive, mnemonics and directives are not. .ORIG starts a
+  section and .END closes it, a module that does not start with .ORIG
+  continues right after the module before it. numbers are #decimal,
+  decimal, xHEX or 0xHEX. PC relative operands are labels or offsets.
+
+  the program is kept as a list of items (instructions whose PC relative
+  operand is a label, data, labels) until the linker lays it out, so the
+  optimizer in asmopt.c can rewrite, drop and move code without fixing
+  up offsets. sections that touch are written as one image, a range
+  apart from the rest goes to its own image next to it (prog-x0180.obj
+  for prog.obj) so no hole is zero filled over memory the program
+  doesn't own. the range holding x3000 keeps the given name.
+
+  a JSR whose target ends up out of its 11-bit range is linked as
+  LD R7, =target / JSRR R7, which unlike JSR sets the condition codes.
+*/
+
+#include <stdint.h>
+
+enum // lc3_asm_item.kind
+{
+  LC3_ASM_NONE,    // dropped by the optimizer
+  LC3_ASM_LABEL,   // no words, names the next item that has some
+  LC3_ASM_INSN,    // word, plus the PC relative offset to sym unless sym is -1
+  LC3_ASM_FILL,    // word, or the address of sym
+  LC3_ASM_BLKW,    // count copies of word
+  LC3_ASM_STRING,  // count characters at text and a terminator
+  LC3_ASM_SECTION  // origin in count, LC3_ASM_FOLLOW to continue the section before
+};
+
+#define LC3_ASM_FOLLOW -1
+
+enum // lc3_asm_item.flags
+{
+  LC3_ASM_PACKED = 1 << 0,  // STRING packed two characters a word for PUTSP
+  LC3_ASM_POOL = 1 << 1,    // INSN LD of the constant in count, its pool word is not placed yet
+  LC3_ASM_LITERAL = 1 << 2, // FILL placed by the linker for an LD, shared by equal ones in range
+  LC3_ASM_OFFSET = 1 << 3   // INSN with a numeric PC offset in count that is not a label
+};
+
+typedef struct
+{
+  uint8_t kind; // LC3_ASM_*
+  uint8_t flags;
+  uint16_t word;
+  int32_t sym; // label operand, or the label a LABEL defines. -1 for none
+  int32_t count;
+  uint32_t text; // STRING characters, offset into lc3_asm.text
+  uint16_t addr; // set by the layout
+  uint16_t file;
+  uint32_t line;
+} lc3_asm_item;
+
+typedef struct
+{
+  char* name;
+  int32_t def; // defining LABEL item, -1 while undefined. only valid right after lc3_asm_layout()
+  uint16_t addr;
+  uint8_t hidden; // made up by the assembler, left out of the sidecar
+} lc3_asm_symbol;
+
+typedef struct
+{
+  uint32_t flags;     // ADD/AND dropped that only set condition codes nobody reads
+  uint32_t constants; // constant loads rewritten into a shorter form
+  uint32_t branches;  // branches retargeted past a branch, merged or dropped
+  uint32_t moved;     // subroutines moved closer to their callers
+  uint32_t far_calls; // JSR out of range, linked as LD + JSRR
+  uint32_t strings;   // strings packed for PUTSP
+  uint32_t words;     // image size
+} lc3_asm_stats;
+
+typedef struct
+{
+  lc3_asm_item* items;
+  int32_t nitems;
+  int32_t cap_items;
+  lc3_asm_symbol* syms;
+  int32_t nsyms;
+  int32_t cap_syms;
+  int32_t* hash; // symbol index + 1 by name, open addressing
+  int32_t cap_hash;
+  char* text; // STRING characters
+  int32_t ntext;
+  int32_t cap_text;
+  char** files;
+  int nfiles;
+  int errors;
+  int pinned; // an offset that is not a label, the layout can't change
+  lc3_asm_stats stats;
+} lc3_asm;
+
+lc3_asm* lc3_asm_create();
+void lc3_asm_free(lc3_asm* as);
+
+// parses one module, errors go to stderr as file:line: message.
+// returns 0 when there were errors or the file can't be read.
+int lc3_asm_file(lc3_asm* as, const char* path);
+// resolves the labels and lays the program out, optimized when optimize is
+// set. 0 on errors (undefined labels, overlapping sections, out of range)
+int lc3_asm_link(lc3_asm* as, int optimize);
+// writes the linked images (see above), and with sym_path the sidecar:
+//
+//   lc3sym 1
+//   f <file number> <path>
+//   s <addr> <label>
+//   l <addr> <file number> <line>
+//
+// addresses are hex, one l line for every item that has words.
+// returns 0 when a file can't be written.
+int lc3_asm_write(lc3_asm* as, const char* obj_path, const char* sym_path);
+
+
+/*======== USED BY THE OPTIMIZER ===========*/
+
+int32_t lc3_asm_size(const lc3_asm_item* it); // in words
+int lc3_asm_jumps(const lc3_asm_item* it); // BRnzp, JMP, RET, RTI or HALT, never falls through
+// AND/ADD words that put value in register r, returns how many. words may be NULL
+int lc3_asm_constant(int r, uint16_t value, uint16_t* words);
+// sets every addr and symbol address, 0 when sections overlap or run
+// past xFFFF (reported when report is set)
+int lc3_asm_layout(lc3_asm* as, int report);
+// first item whose PC relative operand is out of range, -1 when all fit.
+// JSR is only checked with jsr set.
+int32_t lc3_asm_out_of_range(const lc3_asm* as, int jsr);
+int32_t lc3_asm_label(lc3_asm* as, const char* name, int hidden); // the symbol of a label, added when new, -1 when out of memory
+int32_t lc3_asm_new_label(lc3_asm* as); // a fresh hidden symbol, -1 when out of memory
+int lc3_asm_insert(lc3_asm* as, int32_t at, const lc3_asm_item* it, int32_t n); // 0 when out of memory
+void lc3_asm_compact(lc3_asm* as); // drops LC3_ASM_NONE items
+
+// the passes, asmopt.c
+void lc3_asm_optimize(lc3_asm* as); // local rewrites, before the layout
+void lc3_asm_place(lc3_asm* as);    // subroutine order, on a laid out program
+
+#endif
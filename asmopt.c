@@ -0,0 +1,817 @@
+#include <stdlib.h>
+#include <string.h>
+#include "asm.h"
+#include "enums.h"
+#include "isa.h"
+
+/*
+  the optimizer. everything here keeps the program's meaning for code
+  that only reaches data through its labels: words are never added or
+  removed inside a run of data whose labels have their address taken
+  (LEA other than for PUTS, .FILL label), as code may index into it.
+  code that computes jump targets or patches itself should be linked
+  without optimizing.
+*/
+
+#define MAX_ROUNDS 8
+#define LOOP_WEIGHT 8 // a call inside a loop counts like this many outside of it
+#define MAX_DEPTH 5
+
+#define OP(it) ((it)->word >> 12)
+#define IS_IMM(w) (((w) >> 5) & 1)
+
+typedef struct // how a label is used
+{
+  uint32_t jumps;   // BR
+  uint32_t calls;   // JSR
+  uint32_t loads;   // LD/LDI
+  uint32_t stores;  // ST/STI
+  uint32_t puts;    // LEA R0 right before PUTS
+  uint32_t address; // other LEA, .FILL
+} uses;
+
+typedef struct // register values known at one point
+{
+  uint16_t val[8];
+  uint8_t known; // bit r set when val[r] is R r
+} regs;
+
+static void index_labels(lc3_asm* as)
+{
+  for(int32_t s = 0; s < as->nsyms; ++s)
+  {
+    as->syms[s].def = -1;
+  }
+  for(int32_t i = 0; i < as->nitems; ++i)
+  {
+    if(as->items[i].kind == LC3_ASM_LABEL) as->syms[as->items[i].sym].def = i;
+  }
+}
+
+static int32_t next_item(const lc3_asm* as, int32_t i) // next one not dropped, -1 at the end
+{
+  for(++i; i < as->nitems; ++i)
+  {
+    if(as->items[i].kind != LC3_ASM_NONE) return i;
+  }
+  return -1;
+}
+
+static int32_t prev_item(const lc3_asm* as, int32_t i)
+{
+  for(--i; i >= 0; --i)
+  {
+    if(as->items[i].kind != LC3_ASM_NONE) return i;
+  }
+  return -1;
+}
+
+static int32_t next_words(const lc3_asm* as, int32_t i) // next item with words, past labels. -1 at a section end
+{
+  for(++i; i < as->nitems; ++i)
+  {
+    uint8_t kind = as->items[i].kind;
+    if(kind == LC3_ASM_SECTION) return -1;
+    if(kind != LC3_ASM_NONE && kind != LC3_ASM_LABEL) return i;
+  }
+  return -1;
+}
+
+static int32_t target_item(const lc3_asm* as, int32_t sym) // what a label names
+{
+  int32_t def = as->syms[sym].def;
+  return def < 0 ? -1 : next_words(as, def);
+}
+
+static int names(const lc3_asm* as, int32_t sym, int32_t i) // sym labels item i
+{
+  int32_t def = as->syms[sym].def;
+  return def >= 0 && def < i && next_words(as, def) == i;
+}
+
+static int is_data(const lc3_asm_item* it)
+{
+  return it->kind == LC3_ASM_FILL || it->kind == LC3_ASM_BLKW || it->kind == LC3_ASM_STRING;
+}
+
+static int is_puts(const lc3_asm_item* it)
+{
+  return it->kind == LC3_ASM_INSN && it->word == (OP_TRAP << 12 | TRAP_PUTS);
+}
+
+static int lea_for_puts(const lc3_asm* as, int32_t i) // LEA R0 that PUTS follows
+{
+  const lc3_asm_item* it = &as->items[i];
+  int32_t next = next_item(as, i);
+  return OP(it) == OP_LEA && FIELD_DR(it->word) == R_R0 && next >= 0 && is_puts(&as->items[next]);
+}
+
+static uses* count_uses(lc3_asm* as)
+{
+  uses* u = calloc(as->nsyms + 1, sizeof(uses));
+  if(!u) return NULL;
+  for(int32_t i = 0; i < as->nitems; ++i)
+  {
+    const lc3_asm_item* it = &as->items[i];
+    if(it->sym < 0) continue;
+    if(it->kind == LC3_ASM_FILL) u[it->sym].address++;
+    if(it->kind != LC3_ASM_INSN) continue;
+    switch(OP(it))
+    {
+      case OP_BR: u[it->sym].jumps++; break;
+      case OP_JSR: u[it->sym].calls++; break;
+      case OP_LD: case OP_LDI: u[it->sym].loads++; break;
+      case OP_ST: case OP_STI: u[it->sym].stores++; break;
+      case OP_LEA:
+        if(lea_for_puts(as, i)) u[it->sym].puts++;
+        else u[it->sym].address++;
+        break;
+    }
+  }
+  return u;
+}
+
+// no label in the run of data around item i has its address taken,
+// so nothing can index into it
+static int plain_data(const lc3_asm* as, const uses* u, int32_t i)
+{
+  int32_t a = i, b = i;
+  while(a > 0 && (is_data(&as->items[a - 1]) || as->items[a - 1].kind == LC3_ASM_LABEL || as->items[a - 1].kind == LC3_ASM_NONE)) --a;
+  while(b + 1 < as->nitems && (is_data(&as->items[b + 1]) || as->items[b + 1].kind == LC3_ASM_LABEL || as->items[b + 1].kind == LC3_ASM_NONE)) ++b;
+  for(int32_t j = a; j <= b; ++j)
+  {
+    if(as->items[j].kind == LC3_ASM_LABEL && u[as->items[j].sym].address) return 0;
+  }
+  return 1;
+}
+
+static int32_t labels_of(const lc3_asm* as, int32_t i) // first of the labels right before item i
+{
+  int32_t a = i;
+  while(a > 0 && (as->items[a - 1].kind == LC3_ASM_LABEL || as->items[a - 1].kind == LC3_ASM_NONE)) --a;
+  return a;
+}
+
+
+/*=========== PUTSP STRINGS ============*/
+
+// a string only ever printed with LEA R0 / PUTS is stored two characters a
+// word and printed with PUTSP instead
+static void pack_strings(lc3_asm* as, const uses* u)
+{
+  for(int32_t i = 0; i < as->nitems; ++i)
+  {
+    lc3_asm_item* it = &as->items[i];
+    if(it->kind != LC3_ASM_STRING || (it->flags & LC3_ASM_PACKED) || !plain_data(as, u, i)) continue;
+    int printed = 0, other = 0;
+    for(int32_t j = labels_of(as, i); j < i; ++j)
+    {
+      const lc3_asm_item* label = &as->items[j];
+      if(label->kind != LC3_ASM_LABEL) continue;
+      const uses* use = &u[label->sym];
+      printed |= use->puts != 0;
+      other |= use->jumps || use->calls || use->loads || use->stores || use->address;
+    }
+    if(!printed || other) continue;
+    it->flags |= LC3_ASM_PACKED;
+    as->stats.strings++;
+    for(int32_t j = 0; j < as->nitems; ++j)
+    {
+      const lc3_asm_item* lea = &as->items[j];
+      if(lea->kind == LC3_ASM_INSN && lea->sym >= 0 && lea_for_puts(as, j) && names(as, lea->sym, i))
+      {
+        as->items[next_item(as, j)].word = OP_TRAP << 12 | TRAP_PUTSP;
+      }
+    }
+  }
+}
+
+
+/*============= CONSTANTS ==============*/
+
+static int constant_label(const lc3_asm* as, const uses* u, int32_t sym, uint16_t* value) // names a .FILL nothing writes
+{
+  int32_t i = target_item(as, sym);
+  if(i < 0 || as->items[i].kind != LC3_ASM_FILL || as->items[i].sym >= 0 || !plain_data(as, u, i)) return 0;
+  for(int32_t j = labels_of(as, i); j < i; ++j)
+  {
+    const lc3_asm_item* label = &as->items[j];
+    if(label->kind == LC3_ASM_LABEL && (u[label->sym].stores || u[label->sym].address || u[label->sym].jumps || u[label->sym].calls)) return 0;
+  }
+  *value = as->items[i].word;
+  return 1;
+}
+
+static int loads_constant(const lc3_asm* as, const uses* u, const lc3_asm_item* it, uint16_t* value)
+{
+  if(it->kind != LC3_ASM_INSN || OP(it) != OP_LD) return 0;
+  if(it->flags & LC3_ASM_POOL)
+  {
+    *value = (uint16_t)it->count;
+    return 1;
+  }
+  return it->sym >= 0 && constant_label(as, u, it->sym, value);
+}
+
+static void forget_all(regs* r)
+{
+  memset(r, 0, sizeof(*r));
+}
+
+static void track(const lc3_asm* as, const uses* u, const lc3_asm_item* it, regs* r) // r after it runs
+{
+  uint16_t w = it->word;
+  int dr = FIELD_DR(w);
+  int sr = FIELD_SR1(w);
+  int sr2 = FIELD_SR2(w);
+  int known_sr = (r->known >> sr) & 1;
+  int known_sr2 = (r->known >> sr2) & 1;
+  int known = 0;
+  uint16_t val = 0;
+  switch(OP(it))
+  {
+    case OP_ADD:
+      known = known_sr && (IS_IMM(w) || known_sr2);
+      val = r->val[sr] + (IS_IMM(w) ? IMM5(w) : r->val[sr2]);
+      break;
+    case OP_AND:
+      known = (IS_IMM(w) && IMM5(w) == 0) || (known_sr && (IS_IMM(w) || known_sr2));
+      val = known_sr ? r->val[sr] & (IS_IMM(w) ? IMM5(w) : r->val[sr2]) : 0;
+      break;
+    case OP_NOT:
+      known = known_sr;
+      val = ~r->val[sr];
+      break;
+    case OP_LD:
+      known = loads_constant(as, u, it, &val);
+      break;
+    case OP_LDI: case OP_LDR: case OP_LEA:
+      break;
+    case OP_BR: case OP_ST: case OP_STI: case OP_STR:
+      return;
+    default: // calls, traps and jumps
+      forget_all(r);
+      return;
+  }
+  r->known &= ~(1 << dr);
+  if(known)
+  {
+    r->val[dr] = val;
+    r->known |= 1 << dr;
+  }
+}
+
+static int fits_imm5(int d)
+{
+  return d >= -16 && d <= 15;
+}
+
+// a run that only builds a constant in one register: AND R, x, #0 or an
+// LD of a constant, then ADD R, R, #imm. returns the item after the run
+// and its length in instructions, -1 when i starts none.
+static int32_t constant_run(const lc3_asm* as, const uses* u, int32_t i, int* r, uint16_t* value, int* len)
+{
+  const lc3_asm_item* it = &as->items[i];
+  uint16_t w = it->word;
+  if(it->kind != LC3_ASM_INSN) return -1;
+  if(OP(it) == OP_AND && IS_IMM(w) && IMM5(w) == 0) *value = 0;
+  else if(!loads_constant(as, u, it, value)) return -1;
+  *r = FIELD_DR(w);
+  *len = 1;
+  int32_t j = next_item(as, i);
+  for(; j >= 0; j = next_item(as, j))
+  {
+    const lc3_asm_item* add = &as->items[j];
+    uint16_t a = add->word;
+    if(add->kind != LC3_ASM_INSN || OP(add) != OP_ADD || !IS_IMM(a) || FIELD_DR(a) != *r || FIELD_SR1(a) != *r) break;
+    *value += IMM5(a);
+    ++*len;
+  }
+  return j < 0 ? as->nitems : j;
+}
+
+static int constants(lc3_asm* as, const uses* u)
+{
+  int changed = 0;
+  regs r;
+  forget_all(&r);
+  for(int32_t i = 0; i < as->nitems; ++i)
+  {
+    lc3_asm_item* it = &as->items[i];
+    if(it->kind != LC3_ASM_INSN)
+    {
+      if(it->kind != LC3_ASM_NONE) forget_all(&r); // a label can be jumped to
+      continue;
+    }
+    int reg, len;
+    uint16_t v;
+    int32_t end = constant_run(as, u, i, &reg, &v, &len);
+    if(end < 0)
+    {
+      track(as, u, it, &r);
+      continue;
+    }
+    int loads = OP(it) == OP_LD;
+
+    // the shortest way to v: from a register already close to it, AND
+    // for zero, else one LD from a literal pool the linker places
+    uint16_t best = 0;
+    for(int s = -1; s < 8 && !best; ++s)
+    {
+      int src = s < 0 ? reg : s; // the register itself first
+      if(((r.known >> src) & 1) && fits_imm5((int16_t)(v - r.val[src])))
+      {
+        best = OP_ADD << 12 | reg << 9 | src << 6 | 1 << 5 | ((v - r.val[src]) & 0x1F);
+      }
+    }
+    if(!best && v == 0) best = OP_AND << 12 | reg << 9 | reg << 6 | 1 << 5;
+
+    // one instruction without a load beats anything longer, a pooled LD
+    // beats a longer run of ADDs
+    int pool = !best && len > 1;
+    if((best && (len > 1 || loads)) || pool)
+    {
+      it->word = pool ? (uint16_t)(OP_LD << 12 | reg << 9) : best;
+      it->sym = -1;
+      it->flags = pool ? LC3_ASM_POOL : 0;
+      it->count = v;
+      for(int32_t j = next_item(as, i); j >= 0 && j < end; j = next_item(as, j)) as->items[j].kind = LC3_ASM_NONE;
+      as->stats.constants++;
+      changed = 1;
+    }
+    for(int32_t j = i; j >= 0 && j < end; j = next_item(as, j)) track(as, u, &as->items[j], &r);
+    i = end - 1;
+  }
+  return changed;
+}
+
+
+/*=========== CONDITION CODES ==========*/
+
+static int sets_cc(const lc3_asm_item* it) // the register the condition codes come from, -1 for none
+{
+  if(it->kind != LC3_ASM_INSN) return -1;
+  switch(OP(it))
+  {
+    case OP_ADD: case OP_AND: case OP_NOT: case OP_LD: case OP_LDI: case OP_LDR: case OP_LEA:
+      return FIELD_DR(it->word);
+  }
+  return -1;
+}
+
+static int test_of(const lc3_asm_item* it) // ADD R, R, #0 or AND R, R, R: only sets the condition codes
+{
+  uint16_t w = it->word;
+  if(it->kind != LC3_ASM_INSN || FIELD_DR(w) != FIELD_SR1(w)) return -1;
+  if(OP(it) == OP_ADD && IS_IMM(w) && IMM5(w) == 0) return FIELD_DR(w);
+  if(OP(it) == OP_AND && !IS_IMM(w) && FIELD_SR2(w) == FIELD_DR(w)) return FIELD_DR(w);
+  return -1;
+}
+
+static int cc_read(const lc3_asm* as, int32_t i) // can the condition codes set by item i be looked at
+{
+  for(int32_t j = next_item(as, i); j >= 0; j = next_item(as, j))
+  {
+    const lc3_asm_item* it = &as->items[j];
+    if(it->kind != LC3_ASM_INSN) return 1; // a label or data
+    uint16_t op = OP(it);
+    if(op == OP_BR && FIELD_NZP(it->word)) return 1;
+    if(op == OP_JSR || op == OP_JMP || op == OP_RTI || op == OP_TRAP || op == OP_RES) return 1;
+    if(sets_cc(it) >= 0) return 0;
+  }
+  return 1;
+}
+
+static int flags(lc3_asm* as)
+{
+  int changed = 0;
+  for(int32_t i = 0; i < as->nitems; ++i)
+  {
+    lc3_asm_item* it = &as->items[i];
+    int r = test_of(it);
+    if(r < 0) continue;
+    int32_t prev = prev_item(as, i);
+    int redundant = prev >= 0 && sets_cc(&as->items[prev]) == r; // and nothing jumps in between
+    if(redundant || !cc_read(as, i))
+    {
+      it->kind = LC3_ASM_NONE;
+      as->stats.flags++;
+      changed = 1;
+    }
+  }
+  return changed;
+}
+
+
+/*============== BRANCHES ==============*/
+
+static int branches(lc3_asm* as)
+{
+  int changed = 0;
+  for(int32_t i = 0; i < as->nitems; ++i)
+  {
+    lc3_asm_item* it = &as->items[i];
+    if(it->kind != LC3_ASM_INSN || it->sym < 0) continue;
+    uint16_t op = OP(it);
+    uint16_t nzp = FIELD_NZP(it->word);
+    int32_t to = target_item(as, it->sym);
+    if(to < 0 || as->items[to].kind != LC3_ASM_INSN) continue;
+    const lc3_asm_item* t = &as->items[to];
+
+    if(op == OP_JSR)
+    {
+      // a call to a jump calls where it goes
+      if(OP(t) == OP_BR && FIELD_NZP(t->word) == 7 && t->sym >= 0 && t->sym != it->sym)
+      {
+        it->sym = t->sym;
+        as->stats.branches++;
+        changed = 1;
+      }
+      continue;
+    }
+    if(op != OP_BR || !nzp) continue;
+
+    int32_t next = next_words(as, i);
+    if(to == next)
+    {
+      it->kind = LC3_ASM_NONE; // to the next instruction
+      as->stats.branches++;
+      changed = 1;
+      continue;
+    }
+    if(OP(t) == OP_BR && t->sym >= 0 && to != i)
+    {
+      // the condition codes are the same there: a branch taken on them is
+      // taken again, one that can't be falls through
+      uint16_t then = FIELD_NZP(t->word);
+      if((nzp & then) == nzp && t->sym != it->sym)
+      {
+        it->sym = t->sym;
+        as->stats.branches++;
+        changed = 1;
+        continue;
+      }
+      if(!(nzp & then))
+      {
+        int32_t after = next_item(as, to);
+        if(after < 0 || as->items[after].kind != LC3_ASM_LABEL)
+        {
+          lc3_asm_item label = *t;
+          label.kind = LC3_ASM_LABEL;
+          label.flags = 0;
+          label.sym = lc3_asm_new_label(as);
+          if(label.sym < 0 || !lc3_asm_insert(as, to + 1, &label, 1)) return changed;
+          index_labels(as);
+          return 1; // indexes moved, the next round goes on
+        }
+        it->sym = as->items[after].sym;
+        as->stats.branches++;
+        changed = 1;
+        continue;
+      }
+    }
+    if(nzp == 7 && (OP(t) == OP_JMP || OP(t) == OP_RTI))
+    {
+      it->word = t->word; // a jump to a return returns
+      it->sym = -1;
+      as->stats.branches++;
+      changed = 1;
+      continue;
+    }
+    // BRz skip / BRnzp far / skip: becomes BRnp far
+    int32_t u = next_item(as, i);
+    lc3_asm_item* jump = u >= 0 ? &as->items[u] : NULL;
+    if(nzp != 7 && jump && jump->kind == LC3_ASM_INSN && OP(jump) == OP_BR && FIELD_NZP(jump->word) == 7
+       && jump->sym >= 0 && to == next_words(as, u))
+    {
+      it->word = OP_BR << 12 | (~nzp & 7) << 9;
+      it->sym = jump->sym;
+      jump->kind = LC3_ASM_NONE;
+      as->stats.branches++;
+      changed = 1;
+    }
+  }
+  return changed;
+}
+
+void lc3_asm_optimize(lc3_asm* as)
+{
+  for(int round = 0; round < MAX_ROUNDS; ++round)
+  {
+    index_labels(as);
+    uses* u = count_uses(as);
+    if(!u) return;
+    if(round == 0) pack_strings(as, u);
+    int changed = constants(as, u);
+    changed |= flags(as);
+    changed |= branches(as);
+    free(u);
+    lc3_asm_compact(as);
+    if(!changed) break;
+  }
+}
+
+
+/*============== PLACEMENT =============*/
+
+typedef struct
+{
+  int32_t start; // first item
+  int32_t end;
+} chunk;
+
+typedef struct
+{
+  int32_t from; // chunk
+  int32_t to;
+  uint64_t weight;
+} call_edge;
+
+static int heavier(const void* x, const void* y)
+{
+  const call_edge* a = x;
+  const call_edge* b = y;
+  return (a->weight < b->weight) - (a->weight > b->weight);
+}
+
+typedef struct
+{
+  int32_t chunk;
+  uint64_t weight; // of the calls into it
+} chunk_heat;
+
+static int hotter(const void* x, const void* y) // ties keep the order as written
+{
+  const chunk_heat* a = x;
+  const chunk_heat* b = y;
+  if(a->weight != b->weight) return (a->weight < b->weight) - (a->weight > b->weight);
+  return a->chunk - b->chunk;
+}
+
+typedef struct // one section being placed
+{
+  lc3_asm* as;
+  int32_t first; // first item after the SECTION
+  int32_t end;
+  lc3_asm_item* orig; // items as they came
+  uint64_t* weight; // per original item, the weight of a JSR
+  uint64_t* placed; // weight by current position
+  chunk* chunks;
+  int nchunks;
+} section;
+
+static void arrange(section* s, const int* order) // items in chunk order
+{
+  int32_t at = s->first;
+  for(int k = 0; k < s->nchunks; ++k)
+  {
+    const chunk* c = &s->chunks[order[k]];
+    int32_t n = c->end - c->start;
+    memcpy(&s->as->items[at], &s->orig[c->start - s->first], n * sizeof(lc3_asm_item));
+    memcpy(&s->placed[at - s->first], &s->weight[c->start - s->first], n * sizeof(uint64_t));
+    at += n;
+  }
+}
+
+// weight of the calls in the section that do not reach, UINT64_MAX when
+// something else does not reach either
+static uint64_t far_weight(section* s, const int* order)
+{
+  lc3_asm* as = s->as;
+  arrange(s, order);
+  if(!lc3_asm_layout(as, 0) || lc3_asm_out_of_range(as, 0) >= 0) return UINT64_MAX;
+  uint64_t far = 0;
+  for(int32_t i = s->first; i < s->end; ++i)
+  {
+    const lc3_asm_item* it = &as->items[i];
+    if(it->kind != LC3_ASM_INSN || OP(it) != OP_JSR || it->sym < 0 || !s->placed[i - s->first]) continue;
+    int off = (int16_t)(as->syms[it->sym].addr - it->addr - 1);
+    if(off < -1024 || off > 1023) far += s->placed[i - s->first];
+  }
+  return far;
+}
+
+static int find_chunks(section* s, const uses* u) // a new chunk at every subroutine nothing falls into
+{
+  lc3_asm* as = s->as;
+  s->nchunks = 0;
+  s->chunks[s->nchunks++].start = s->first;
+  int32_t last = -1; // last item with words
+  for(int32_t i = s->first; i < s->end; ++i)
+  {
+    const lc3_asm_item* it = &as->items[i];
+    if(it->kind == LC3_ASM_LABEL && u[it->sym].calls && last >= 0
+       && (lc3_asm_jumps(&as->items[last]) || is_data(&as->items[last])))
+    {
+      int32_t start = labels_of(as, i);
+      if(start > s->chunks[s->nchunks - 1].start)
+      {
+        s->chunks[s->nchunks - 1].end = start;
+        s->chunks[s->nchunks++].start = start;
+      }
+    }
+    if(lc3_asm_size(it)) last = i;
+  }
+  s->chunks[s->nchunks - 1].end = s->end;
+  // the last chunk can't move when it runs off the end of the section
+  return last >= 0 && (lc3_asm_jumps(&as->items[last]) || is_data(&as->items[last]));
+}
+
+static void weigh_calls(section* s) // JSR weight grows with its loop depth
+{
+  lc3_asm* as = s->as;
+  int32_t n = s->end - s->first;
+  int32_t* depth = calloc(n + 1, sizeof(int32_t));
+  if(!depth) return;
+  for(int32_t i = s->first; i < s->end; ++i)
+  {
+    const lc3_asm_item* it = &as->items[i];
+    if(it->kind != LC3_ASM_INSN || OP(it) != OP_BR || it->sym < 0) continue;
+    int32_t def = as->syms[it->sym].def;
+    if(def >= s->first && def < i) // a backward branch closes a loop
+    {
+      depth[def - s->first]++;
+      depth[i - s->first + 1]--;
+    }
+  }
+  int32_t d = 0;
+  for(int32_t i = s->first; i < s->end; ++i)
+  {
+    d += depth[i - s->first];
+    const lc3_asm_item* it = &as->items[i];
+    s->weight[i - s->first] = 0;
+    if(it->kind == LC3_ASM_INSN && OP(it) == OP_JSR && it->sym >= 0)
+    {
+      uint64_t w = 1;
+      for(int k = 0; k < d && k < MAX_DEPTH; ++k) w *= LOOP_WEIGHT;
+      s->weight[i - s->first] = w;
+    }
+  }
+  free(depth);
+}
+
+static int chunk_at(const section* s, int32_t i)
+{
+  for(int k = 0; k < s->nchunks; ++k)
+  {
+    if(i >= s->chunks[k].start && i < s->chunks[k].end) return k;
+  }
+  return -1;
+}
+
+// chains of chunks joined along the heaviest calls first (Pettis-Hansen),
+// the one holding the section's start stays in front
+static void chain_order(section* s, int* order)
+{
+  lc3_asm* as = s->as;
+  int n = s->nchunks;
+  call_edge* edges = malloc((s->end - s->first + 1) * sizeof(call_edge));
+  int* chain = malloc(n * sizeof(int));
+  int* next = malloc(n * sizeof(int));
+  int* tail = malloc(n * sizeof(int));
+  int nedges = 0;
+  if(!edges || !chain || !next || !tail)
+  {
+    for(int k = 0; k < n; ++k) order[k] = k;
+    goto done;
+  }
+  for(int32_t i = s->first; i < s->end; ++i)
+  {
+    const lc3_asm_item* it = &as->items[i];
+    if(!s->weight[i - s->first]) continue;
+    int32_t def = as->syms[it->sym].def;
+    int from = chunk_at(s, i);
+    int to = def >= s->first && def < s->end ? chunk_at(s, def) : -1;
+    if(to < 0 || from == to) continue;
+    edges[nedges].from = from;
+    edges[nedges].to = to;
+    edges[nedges].weight = s->weight[i - s->first];
+    ++nedges;
+  }
+  qsort(edges, nedges, sizeof(call_edge), heavier);
+  for(int k = 0; k < n; ++k)
+  {
+    chain[k] = k;
+    next[k] = -1;
+    tail[k] = k;
+  }
+  for(int e = 0; e < nedges; ++e)
+  {
+    int a = chain[edges[e].from];
+    int b = chain[edges[e].to];
+    if(a == b) continue;
+    if(b == chain[0])
+    {
+      int t = a;
+      a = b;
+      b = t;
+    }
+    next[tail[a]] = b; // b's chain goes after a's
+    tail[a] = tail[b];
+    for(int k = b; k >= 0; k = next[k]) chain[k] = a;
+  }
+  int m = 0;
+  for(int head = 0; head < n; ++head) // chains in the order of their first chunk
+  {
+    if(chain[head] != head) continue;
+    for(int k = head; k >= 0; k = next[k]) order[m++] = k;
+  }
+done:
+  free(edges);
+  free(chain);
+  free(next);
+  free(tail);
+}
+
+static void hottest_first(section* s, int* order) // subroutines by how hot their calls are, right after the start
+{
+  lc3_asm* as = s->as;
+  chunk_heat* heat = malloc(s->nchunks * sizeof(chunk_heat));
+  for(int k = 0; k < s->nchunks; ++k) order[k] = k;
+  if(!heat) return;
+  for(int k = 0; k < s->nchunks; ++k)
+  {
+    heat[k].chunk = k;
+    heat[k].weight = 0;
+  }
+  for(int32_t i = s->first; i < s->end; ++i)
+  {
+    if(!s->weight[i - s->first]) continue;
+    int32_t def = as->syms[as->items[i].sym].def;
+    int to = def >= s->first && def < s->end ? chunk_at(s, def) : -1;
+    if(to >= 0) heat[to].weight += s->weight[i - s->first];
+  }
+  qsort(heat + 1, s->nchunks - 1, sizeof(chunk_heat), hotter);
+  for(int k = 1; k < s->nchunks; ++k) order[k] = heat[k].chunk;
+  free(heat);
+}
+
+static void place_section(lc3_asm* as, int32_t first, int32_t end, const uses* u)
+{
+  int32_t n = end - first;
+  section s = { as, first, end, NULL, NULL, NULL, NULL, 0 };
+  s.orig = malloc(n * sizeof(lc3_asm_item));
+  s.weight = malloc(n * sizeof(uint64_t));
+  s.placed = malloc(n * sizeof(uint64_t));
+  s.chunks = malloc((n + 1) * sizeof(chunk));
+  int* orders = malloc(3 * (n + 1) * sizeof(int));
+  if(!s.orig || !s.weight || !s.placed || !s.chunks || !orders) goto done;
+  memcpy(s.orig, &as->items[first], n * sizeof(lc3_asm_item));
+  if(!find_chunks(&s, u) || s.nchunks < 3) goto done;
+  weigh_calls(&s);
+
+  int* as_is = orders;
+  int* chained = orders + (n + 1);
+  int* hottest = orders + 2 * (n + 1);
+  for(int k = 0; k < s.nchunks; ++k) as_is[k] = k;
+  chain_order(&s, chained);
+  hottest_first(&s, hottest);
+
+  int* best = as_is;
+  uint64_t best_far = far_weight(&s, as_is);
+  uint64_t far = far_weight(&s, chained);
+  if(far < best_far)
+  {
+    best = chained;
+    best_far = far;
+  }
+  if(far_weight(&s, hottest) < best_far) best = hottest;
+  far_weight(&s, best); // leaves it laid out
+  for(int k = 0; k < s.nchunks; ++k)
+  {
+    as->stats.moved += best[k] != k && s.chunks[best[k]].start != s.first;
+  }
+done:
+  free(s.orig);
+  free(s.weight);
+  free(s.placed);
+  free(s.chunks);
+  free(orders);
+}
+
+void lc3_asm_place(lc3_asm* as)
+{
+  int far = 0;
+  for(int32_t i = 0; i < as->nitems && !far; ++i)
+  {
+    const lc3_asm_item* it = &as->items[i];
+    if(it->kind != LC3_ASM_INSN || OP(it) != OP_JSR || it->sym < 0) continue;
+    int off = (int16_t)(as->syms[it->sym].addr - it->addr - 1);
+    far = off < -1024 || off > 1023;
+  }
+  if(!far) return; // every call reaches already
+
+  index_labels(as);
+  uses* u = count_uses(as);
+  if(!u) return;
+  for(int32_t i = 0; i < as->nitems; ++i)
+  {
+    if(as->items[i].kind != LC3_ASM_SECTION) continue;
+    int32_t end = i + 1;
+    while(end < as->nitems && as->items[end].kind != LC3_ASM_SECTION) ++end;
+    index_labels(as);
+    place_section(as, i + 1, end, u);
+  }
+  free(u);
+  lc3_asm_layout(as, 0);
+}
@@ -0,0 +1,345 @@
+#include <stdlib.h>
+#include <string.h>
+#include "blocks.h"
+#include "exec.h"
+
+#define ARENA_SIZE (1 << 20)
+#define DEVICE_BASE MR_KBSR // device registers are never translated
+
+static size_t block_size(uint32_t len)
+{
+  return (sizeof(block) + len * sizeof(dinsn) + 3) & ~(size_t)3;
+}
+
+
+/*=============== CACHE ================*/
+
+struct block_cache* blocks_get(lc3_vm* vm)
+{
+  if(vm->blocks) return vm->blocks;
+  struct block_cache* bc = calloc(1, sizeof(struct block_cache));
+  uint32_t* code_map = calloc(MEMORY_MAX / 32, sizeof(uint32_t));
+  char* arena = malloc(ARENA_SIZE);
+  if(!bc || !code_map || !arena)
+  {
+    free(bc);
+    free(code_map);
+    free(arena);
+    return NULL;
+  }
+  bc->arena = arena;
+  vm->blocks = bc;
+  vm->code_map = code_map;
+  return bc;
+}
+
+void blocks_flush(lc3_vm* vm)
+{
+  struct block_cache* bc = vm->blocks;
+  for(size_t at = 0; at < bc->used; )
+  {
+    block* b = (block*)(bc->arena + at);
+    bc->map[b->start] = NULL;
+    at += block_size(b->len);
+  }
+  bc->used = 0;
+  bc->flush = 0;
+  memset(vm->code_map, 0, MEMORY_MAX / 8);
+}
+
+void blocks_free(lc3_vm* vm)
+{
+  if(vm->blocks) free(vm->blocks->arena);
+  free(vm->blocks);
+  free(vm->code_map);
+  free(vm->profile);
+  vm->blocks = NULL;
+  vm->code_map = NULL;
+  vm->profile = NULL;
+}
+
+void code_written(lc3_vm* vm)
+{
+  vm->blocks->flush = 1;
+}
+
+void code_range_written(lc3_vm* vm, uint16 address, uint16 n)
+{
+  if(!vm->code_map) return;
+  for(uint16 i = 0; i < n; ++i)
+  {
+    uint16 a = address + i;
+    if(vm->code_map[a >> 5] >> (a & 31) & 1)
+    {
+      code_written(vm);
+      return;
+    }
+  }
+}
+
+void code_changed(lc3_vm* vm)
+{
+  if(vm->blocks) code_written(vm);
+}
+
+
+/*============ TRANSLATION =============*/
+
+// 1 taken, 0 not taken, -1 when the profile shows no clear bias
+static int likely_taken(const lc3_profile* p, uint16 addr)
+{
+  if(!p) return -1;
+  uint32_t t = p->taken[addr];
+  uint32_t f = p->not_taken[addr];
+  if(t + f < HOT_MIN) return -1;
+  if(t >= 3 * f) return 1;
+  if(f >= 3 * t) return 0;
+  return -1;
+}
+
+static int in_trace(const dinsn* code, int len, uint16 addr)
+{
+  for(int i = 0; i < len; ++i)
+  {
+    if((uint16)(code[i].pc - 1) == addr) return 1;
+  }
+  return 0;
+}
+
+block* translate(lc3_vm* vm, uint16 start)
+{
+  struct block_cache* bc = blocks_get(vm);
+  if(!bc || start >= DEVICE_BASE) return NULL;
+
+  const lc3_profile* prof = vm->profile;
+  dinsn code[TRACE_MAX];
+  int len = 0;
+  int extended = 0;
+  uint16 pc = start;
+  int done = 0;
+  while(!done && len < TRACE_MAX && pc < DEVICE_BASE && !in_trace(code, len, pc))
+  {
+    uint16 instr = vm->memory[pc];
+    dinsn* d = &code[len++];
+    d->op = insn_variant[DECODE_KEY(instr)];
+    d->dr = FIELD_DR(instr);
+    d->sr1 = FIELD_SR1(instr);
+    d->sr2 = FIELD_SR2(instr);
+    d->imm = 0;
+    d->pc = pc + 1;
+    d->instr = instr;
+    vm->code_map[pc >> 5] |= 1u << (pc & 31);
+    pc = d->pc;
+
+    switch(d->op)
+    {
+      case V_ADD_IMM:
+      case V_AND_IMM:
+        d->imm = IMM5(instr);
+        break;
+      case V_LDR:
+      case V_STR:
+        d->imm = OFF6(instr);
+        break;
+      case V_LD:
+      case V_LDI:
+      case V_LEA:
+      case V_ST:
+      case V_STI:
+        d->imm = d->pc + OFF9(instr);
+        break;
+      case V_BR:
+      {
+        d->sr2 = FIELD_NZP(instr);
+        d->imm = d->pc + OFF9(instr);
+        int dir = d->sr2 == 0 ? 0 : d->sr2 == 7 ? 1 : likely_taken(prof, d->pc - 1);
+        if(dir < 0 || (d->sr2 != 0 && d->sr2 != 7 && extended == TRACE_EXTEND))
+        {
+          done = 1; // ends the trace, both ways go through the map
+          break;
+        }
+        d->op = (d->sr2 == 0 || d->sr2 == 7) ? T_NOP : T_BR_STAY;
+        d->dr = dir;
+        if(d->op == T_BR_STAY) ++extended;
+        if(dir) pc = d->imm;
+        break;
+      }
+      case V_JSR:
+        d->imm = d->pc + OFF11(instr);
+        if(prof && prof->calls[d->imm] >= HOT_MIN && extended < TRACE_EXTEND)
+        {
+          d->op = T_JSR_STAY;
+          ++extended;
+          pc = d->imm;
+        }
+        else
+        {
+          done = 1;
+        }
+        break;
+      case V_JMP:
+      case V_JSRR:
+      case V_TRAP:
+      case V_RTI:
+      case V_RES:
+        done = 1;
+        break;
+    }
+  }
+
+  size_t size = block_size(len);
+  if(bc->used + size > ARENA_SIZE)
+  {
+    blocks_flush(vm); // full, start over with whatever is hot now
+    for(int i = 0; i < len; ++i)
+    {
+      uint16 a = code[i].pc - 1;
+      vm->code_map[a >> 5] |= 1u << (a & 31);
+    }
+  }
+  block* b = (block*)(bc->arena + bc->used);
+  bc->used += size;
+  b->start = start;
+  b->next = pc;
+  b->len = len;
+  memcpy(b->code, code, len * sizeof(dinsn));
+  bc->map[start] = b;
+  return b;
+}
+
+
+/*============= EXECUTION ==============*/
+
+// runs one trace, returns the instructions it retired. R_PC is only
+// written where the trace is left.
+static uint32_t run_trace(lc3_vm* vm, const block* b)
+{
+  uint16* reg = vm->reg;
+  lc3_profile* prof = vm->profile;
+  const dinsn* d = b->code;
+  const dinsn* end = d + b->len;
+  for(; d < end; ++d)
+  {
+    switch(d->op)
+    {
+      case V_ADD_REG:
+        reg[d->dr] = reg[d->sr1] + reg[d->sr2];
+        update_flags(vm, d->dr);
+        break;
+      case V_ADD_IMM:
+        reg[d->dr] = reg[d->sr1] + d->imm;
+        update_flags(vm, d->dr);
+        break;
+      case V_AND_REG:
+        reg[d->dr] = reg[d->sr1] & reg[d->sr2];
+        update_flags(vm, d->dr);
+        break;
+      case V_AND_IMM:
+        reg[d->dr] = reg[d->sr1] & d->imm;
+        update_flags(vm, d->dr);
+        break;
+      case V_NOT:
+        reg[d->dr] = ~reg[d->sr1];
+        update_flags(vm, d->dr);
+        break;
+      case V_LD:
+        reg[d->dr] = mem_read(vm, d->imm);
+        update_flags(vm, d->dr);
+        break;
+      case V_LDI:
+        reg[d->dr] = mem_read(vm, mem_read(vm, d->imm));
+        update_flags(vm, d->dr);
+        break;
+      case V_LDR:
+        reg[d->dr] = mem_read(vm, reg[d->sr1] + d->imm);
+        update_flags(vm, d->dr);
+        break;
+      case V_LEA:
+        reg[d->dr] = d->imm;
+        update_flags(vm, d->dr);
+        break;
+      case V_ST:
+        mem_write(vm, d->imm, reg[d->dr]);
+        goto stored;
+      case V_STI:
+        mem_write(vm, mem_read(vm, d->imm), reg[d->dr]);
+        goto stored;
+      case V_STR:
+        mem_write(vm, reg[d->sr1] + d->imm, reg[d->dr]);
+        goto stored;
+      case T_NOP:
+        break;
+      case T_BR_STAY:
+      {
+        int taken = (d->sr2 & reg[R_COND]) != 0;
+        if(prof) ++(taken ? prof->taken : prof->not_taken)[(uint16)(d->pc - 1)];
+        if(taken != d->dr)
+        {
+          reg[R_PC] = taken ? d->imm : d->pc; // side exit
+          return d - b->code + 1;
+        }
+        break;
+      }
+      case T_JSR_STAY:
+        reg[R_R7] = d->pc;
+        if(prof) ++prof->calls[d->imm];
+        break;
+      case V_BR:
+      {
+        int taken = (d->sr2 & reg[R_COND]) != 0;
+        if(prof) ++(taken ? prof->taken : prof->not_taken)[(uint16)(d->pc - 1)];
+        reg[R_PC] = taken ? d->imm : d->pc;
+        return d - b->code + 1;
+      }
+      case V_JSR:
+        reg[R_R7] = d->pc;
+        reg[R_PC] = d->imm;
+        if(prof) ++prof->calls[d->imm];
+        return d - b->code + 1;
+      case V_JSRR:
+      {
+        uint16 target = reg[d->sr1];
+        reg[R_R7] = d->pc;
+        reg[R_PC] = target;
+        if(prof) ++prof->calls[target];
+        return d - b->code + 1;
+      }
+      default: // JMP, TRAP and the faulting opcodes need the real PC
+        reg[R_PC] = d->pc;
+        insn_table[DECODE_KEY(d->instr)](vm, d->instr);
+        return d - b->code + 1;
+    }
+    continue;
+  stored:
+    if(vm->blocks->flush || vm->stop)
+    {
+      reg[R_PC] = d->pc; // this trace may be stale now, or a device register changed
+      return d - b->code + 1;
+    }
+  }
+  reg[R_PC] = b->next;
+  return b->len;
+}
+
+uint64_t run_blocks(lc3_vm* vm, uint64_t max_instructions)
+{
+  struct block_cache* bc = blocks_get(vm);
+  if(!bc) return run_switch(vm, max_instructions);
+  lc3_profile* prof = vm->profile;
+  uint64_t n = 0;
+  while(!vm->stop && n < max_instructions)
+  {
+    if(bc->flush) blocks_flush(vm);
+    uint16 pc = vm->reg[R_PC];
+    block* b = bc->map[pc];
+    if(!b) b = translate(vm, pc);
+    if(!b || b->len > max_instructions - n)
+    {
+      n += run_switch(vm, 1); // device page, or the budget ends inside the trace
+      continue;
+    }
+    if(prof) ++prof->hits[pc];
+    n += run_trace(vm, b);
+  }
+  return n;
+}
@@ -0,0 +1,76 @@
+#ifndef BLOCKS_H
+#define BLOCKS_H
+
+/*
+  block backend internals.
+
+  straight-line runs of guest code are decoded once into traces: operand
+  fields are pulled out, immediates sign extended and PC relative
+  addresses made absolute, so running a trace is a plain switch over
+  ready operands. with a profile, a trace keeps going through a branch
+  in its usual direction (the other way becomes a side exit) and into
+  hot subroutines, so the common path is one fall-through run.
+
+  every word that went into a trace has a bit in code_map. a store that
+  hits one drops all traces, guests that write their own code stay
+  correct.
+*/
+
+#include "opcodes.h"
+#include "isa.h"
+
+#define TRACE_MAX 64 // instructions per trace
+#define TRACE_EXTEND 8 // branches and calls followed into one trace
+#define HOT_MIN 8 // profile counts below this are not trusted
+
+enum // trace only ops, numbered after the isa.h variants
+{
+  T_NOP = V_COUNT, // BR that never or always branches, already followed
+  T_BR_STAY,       // BR inside a trace, dr is the expected direction
+  T_JSR_STAY       // JSR followed into its subroutine
+};
+
+typedef struct
+{
+  uint8_t op; // V_* or T_*
+  uint8_t dr;
+  uint8_t sr1;
+  uint8_t sr2; // nzp for branches
+  uint16_t imm; // sign extended immediate or offset, absolute address for PC relative ops
+  uint16_t pc; // address of the next instruction, the PC value this one sees
+  uint16_t instr;
+} dinsn;
+
+typedef struct
+{
+  uint16_t start;
+  uint16_t next; // where a trace that was cut short continues
+  uint32_t len;
+  dinsn code[];
+} block;
+
+struct lc3_profile
+{
+  uint32_t checksum; // of guest memory when profiling started
+  uint32_t hits[MEMORY_MAX]; // trace entries by address
+  uint32_t taken[MEMORY_MAX]; // BR outcomes by address of the BR
+  uint32_t not_taken[MEMORY_MAX];
+  uint32_t calls[MEMORY_MAX]; // JSR/JSRR by target
+};
+
+struct block_cache
+{
+  block* map[MEMORY_MAX]; // by start address
+  char* arena; // traces are laid out back to back in translation order
+  size_t used;
+  int flush; // code was written, drop every trace before running the next one
+};
+
+uint64_t run_switch(lc3_vm* vm, uint64_t max_instructions); // lc3vm.c, steps what can't be translated
+uint64_t run_blocks(lc3_vm* vm, uint64_t max_instructions);
+block* translate(lc3_vm* vm, uint16 start); // NULL when start can't hold code
+struct block_cache* blocks_get(lc3_vm* vm); // creates the cache on first use
+void blocks_flush(lc3_vm* vm); // drop every trace, never while one is running
+void blocks_free(lc3_vm* vm);
+
+#endif
@@ -0,0 +1,703 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cfg.h"
+#include "isa.h"
+
+#define DEVICE_BASE MR_KBSR // device registers are never code or data
+
+// word flags only used while building, above the public LC3_CFG_W_* bits
+#define W_LEADER (1 << 8) // starts a block, set once the word is queued or walked
+#define W_STRING (1 << 9)
+#define W_END (1 << 10)   // instruction ends its block
+#define W_JOIN (1 << 11)  // jumped to, register values carried into it don't hold. kept across passes
+
+typedef struct // register values known at one point of a walk
+{
+  uint16_t val[8];
+  uint8_t known; // bit r set when val[r] is R r
+} regs;
+
+typedef struct // scratch state while finding code
+{
+  lc3_cfg* cfg;
+  const uint16_t* memory;
+  uint16_t* work; // addresses still to walk
+  int nwork;
+  int32_t* target; // resolved JMP/JSRR target by address, -1 when unknown
+  lc3_cfg_smc* stores; // every store with a known address
+  int nstores;
+  int cap_stores;
+  int redo; // a word walked with carried register values turned out to be a W_JOIN
+} walker;
+
+
+/*============ FINDING CODE ============*/
+
+static void push(walker* w, uint16_t addr, uint16_t flags)
+{
+  if(addr >= DEVICE_BASE) return;
+  if(!(w->cfg->flags[addr] & W_JOIN) && w->cfg->kind[addr] == LC3_CFG_CODE) w->redo = 1;
+  w->cfg->flags[addr] |= flags | W_JOIN;
+  if(!(w->cfg->flags[addr] & W_LEADER))
+  {
+    w->cfg->flags[addr] |= W_LEADER;
+    w->work[w->nwork++] = addr;
+  }
+}
+
+static void leader(walker* w, uint16_t addr) // the walk goes on here, a new block starts
+{
+  if(addr < DEVICE_BASE) w->cfg->flags[addr] |= W_LEADER;
+}
+
+static void set(regs* r, int n, uint16_t val)
+{
+  r->val[n] = val;
+  r->known |= 1 << n;
+}
+
+static void forget(regs* r, int n)
+{
+  r->known &= ~(1 << n);
+}
+
+static int known(const regs* r, int n)
+{
+  return r->known >> n & 1;
+}
+
+static void note_read(walker* w, uint16_t pc, uint16_t addr)
+{
+  if(addr == MR_KBSR) w->cfg->flags[pc] |= LC3_CFG_W_KBSR;
+  else if(addr == MR_KBDR) w->cfg->flags[pc] |= LC3_CFG_W_KBDR;
+  else if(addr < DEVICE_BASE) w->cfg->flags[addr] |= LC3_CFG_W_READ;
+}
+
+static void note_store(walker* w, uint16_t pc, uint16_t addr)
+{
+  if(addr >= DEVICE_BASE) return;
+  w->cfg->flags[addr] |= LC3_CFG_W_WRITTEN;
+  if(w->nstores == w->cap_stores)
+  {
+    int cap = w->cap_stores ? w->cap_stores * 2 : 256;
+    lc3_cfg_smc* stores = realloc(w->stores, cap * sizeof(lc3_cfg_smc));
+    if(!stores) return; // only costs the code check on this store
+    w->stores = stores;
+    w->cap_stores = cap;
+  }
+  w->stores[w->nstores].store = pc;
+  w->stores[w->nstores].target = addr;
+  ++w->nstores;
+}
+
+static void note_string(walker* w, uint16_t addr, int packed) // PUTS/PUTSP argument, up to the terminator
+{
+  for(; addr < DEVICE_BASE; ++addr)
+  {
+    uint16_t c = w->memory[addr];
+    w->cfg->flags[addr] |= W_STRING | LC3_CFG_W_READ;
+    if(!c || (packed && (!(c & 0xFF) || !(c >> 8)))) break;
+  }
+}
+
+// one straight run of code from pc, until it ends or joins code walked before.
+// register values are forgotten at every jump target, other paths lead there too
+static void walk(walker* w, uint16_t pc)
+{
+  lc3_cfg* cfg = w->cfg;
+  const uint16_t* memory = w->memory;
+  regs r = { {0}, 0 };
+  for(; pc < DEVICE_BASE; ++pc)
+  {
+    if(cfg->kind[pc] == LC3_CFG_CODE)
+    {
+      cfg->flags[pc] |= W_LEADER;
+      return;
+    }
+    if(cfg->flags[pc] & W_JOIN) r.known = 0;
+    cfg->kind[pc] = LC3_CFG_CODE;
+    uint16_t instr = memory[pc];
+    uint16_t next = pc + 1;
+    int dr = FIELD_DR(instr);
+    int sr1 = FIELD_SR1(instr);
+    int sr2 = FIELD_SR2(instr);
+    switch(insn_variant[DECODE_KEY(instr)])
+    {
+      case V_BR:
+      {
+        uint16_t nzp = FIELD_NZP(instr);
+        if(!nzp) break; // NOP
+        cfg->flags[pc] |= W_END;
+        push(w, next + OFF9(instr), 0);
+        if(nzp == (FL_NEG | FL_ZRO | FL_POS)) return;
+        leader(w, next);
+        break;
+      }
+      case V_JSR:
+        w->target[pc] = (uint16_t)(next + OFF11(instr));
+        push(w, w->target[pc], LC3_CFG_W_ENTRY);
+        cfg->flags[pc] |= W_END;
+        r.known = 0; // whatever the routine changes
+        leader(w, next);
+        break;
+      case V_JSRR:
+        if(known(&r, sr1))
+        {
+          w->target[pc] = r.val[sr1];
+          push(w, r.val[sr1], LC3_CFG_W_ENTRY);
+        }
+        cfg->flags[pc] |= W_END;
+        r.known = 0;
+        leader(w, next);
+        break;
+      case V_JMP:
+        cfg->flags[pc] |= W_END;
+        if(sr1 != R_R7 && known(&r, sr1))
+        {
+          w->target[pc] = r.val[sr1];
+          push(w, r.val[sr1], 0);
+        }
+        return;
+      case V_TRAP:
+        switch(FIELD_TRAPVECT(instr))
+        {
+          case TRAP_HALT:
+            cfg->flags[pc] |= W_END;
+            return;
+          case TRAP_PUTS:
+          case TRAP_PUTSP:
+            if(known(&r, R_R0)) note_string(w, r.val[R_R0], FIELD_TRAPVECT(instr) == TRAP_PUTSP);
+            break;
+          case TRAP_MEMCPY:
+          case TRAP_MEMSET:
+            ++cfg->wild_stores;
+            break;
+          case TRAP_MUL:
+          case TRAP_DIV:
+            forget(&r, R_R1);
+            break;
+        }
+        forget(&r, R_R0);
+        forget(&r, R_R7);
+        break;
+      case V_RTI:
+      case V_RES:
+        cfg->flags[pc] |= W_END;
+        return;
+      case V_LD:
+      {
+        uint16_t addr = next + OFF9(instr);
+        note_read(w, pc, addr);
+        if(addr < DEVICE_BASE) set(&r, dr, memory[addr]);
+        else forget(&r, dr);
+        break;
+      }
+      case V_LDI:
+      {
+        uint16_t addr = next + OFF9(instr);
+        if(addr < DEVICE_BASE)
+        {
+          cfg->flags[addr] |= LC3_CFG_W_POINTER | LC3_CFG_W_READ;
+          note_read(w, pc, memory[addr]);
+        }
+        forget(&r, dr);
+        break;
+      }
+      case V_LDR:
+        if(known(&r, sr1)) note_read(w, pc, r.val[sr1] + OFF6(instr));
+        forget(&r, dr);
+        break;
+      case V_LEA:
+        set(&r, dr, next + OFF9(instr));
+        break;
+      case V_ST:
+        note_store(w, pc, next + OFF9(instr));
+        break;
+      case V_STI:
+      {
+        uint16_t addr = next + OFF9(instr);
+        if(addr < DEVICE_BASE)
+        {
+          cfg->flags[addr] |= LC3_CFG_W_POINTER | LC3_CFG_W_READ;
+          note_store(w, pc, memory[addr]);
+        }
+        break;
+      }
+      case V_STR:
+        if(known(&r, sr1)) note_store(w, pc, r.val[sr1] + OFF6(instr));
+        else ++cfg->wild_stores;
+        break;
+      case V_ADD_IMM:
+        if(known(&r, sr1)) set(&r, dr, r.val[sr1] + IMM5(instr));
+        else forget(&r, dr);
+        break;
+      case V_AND_IMM:
+        if(IMM5(instr) == 0) set(&r, dr, 0); // the usual way to clear a register
+        else if(known(&r, sr1)) set(&r, dr, r.val[sr1] & IMM5(instr));
+        else forget(&r, dr);
+        break;
+      case V_ADD_REG:
+        if(known(&r, sr1) && known(&r, sr2)) set(&r, dr, r.val[sr1] + r.val[sr2]);
+        else forget(&r, dr);
+        break;
+      case V_AND_REG:
+        if(known(&r, sr1) && known(&r, sr2)) set(&r, dr, r.val[sr1] & r.val[sr2]);
+        else forget(&r, dr);
+        break;
+      case V_NOT:
+        if(known(&r, sr1)) set(&r, dr, ~r.val[sr1]);
+        else forget(&r, dr);
+        break;
+    }
+  }
+}
+
+
+/*=============== BLOCKS ===============*/
+
+static int add_block(lc3_cfg* cfg, int* cap, uint16_t start)
+{
+  if(cfg->nblocks == *cap)
+  {
+    int n = *cap ? *cap * 2 : 256;
+    lc3_cfg_block* blocks = realloc(cfg->blocks, n * sizeof(lc3_cfg_block));
+    if(!blocks) return 0;
+    cfg->blocks = blocks;
+    *cap = n;
+  }
+  lc3_cfg_block* b = &cfg->blocks[cfg->nblocks++];
+  memset(b, 0, sizeof(*b));
+  b->start = start;
+  b->succ[0] = b->succ[1] = -1;
+  b->idom = -1;
+  b->loop = -1;
+  if(cfg->flags[start] & LC3_CFG_W_ENTRY) b->flags |= LC3_CFG_B_ENTRY;
+  return 1;
+}
+
+static int block_at(const lc3_cfg* cfg, uint32_t addr)
+{
+  return addr < DEVICE_BASE ? cfg->block_of[addr] : -1;
+}
+
+static void finish_block(lc3_cfg* cfg, lc3_cfg_block* b, const uint16_t* memory, const int32_t* target)
+{
+  for(uint16_t a = b->start; a < b->start + b->len; ++a)
+  {
+    uint16_t instr = memory[a];
+    uint8_t v = insn_variant[DECODE_KEY(instr)];
+    if(v == V_ST || v == V_STI || v == V_STR) b->flags |= LC3_CFG_B_STORE;
+    if(v == V_TRAP && FIELD_TRAPVECT(instr) != TRAP_HALT) b->flags |= LC3_CFG_B_TRAP;
+    if(cfg->flags[a] & LC3_CFG_W_KBSR) b->flags |= LC3_CFG_B_KBSR;
+    if(cfg->flags[a] & LC3_CFG_W_SMC) b->flags |= LC3_CFG_B_SMC;
+  }
+
+  uint16_t last = b->start + b->len - 1;
+  uint16_t instr = memory[last];
+  int fall = block_at(cfg, last + 1);
+  switch(insn_variant[DECODE_KEY(instr)])
+  {
+    case V_BR:
+    {
+      uint16_t nzp = FIELD_NZP(instr);
+      if(nzp) b->succ[0] = block_at(cfg, (uint16_t)(last + 1 + OFF9(instr)));
+      if(nzp != (FL_NEG | FL_ZRO | FL_POS)) b->succ[1] = fall;
+      break;
+    }
+    case V_JSR:
+    case V_JSRR:
+      b->flags |= LC3_CFG_B_CALL;
+      if(target[last] >= 0) b->call = target[last];
+      else b->flags |= LC3_CFG_B_INDIRECT;
+      b->succ[1] = fall;
+      break;
+    case V_JMP:
+      if(FIELD_SR1(instr) == R_R7) b->flags |= LC3_CFG_B_RETURN;
+      else if(target[last] >= 0) b->succ[0] = block_at(cfg, target[last]);
+      else b->flags |= LC3_CFG_B_INDIRECT;
+      break;
+    case V_TRAP:
+      if(FIELD_TRAPVECT(instr) == TRAP_HALT) b->flags |= LC3_CFG_B_HALT;
+      else b->succ[1] = fall;
+      break;
+    case V_RTI: // from an interrupt, the return point is on the stack
+      b->flags |= LC3_CFG_B_RETURN;
+      break;
+    case V_RES:
+      b->flags |= LC3_CFG_B_FAULT;
+      break;
+    default:
+      b->succ[1] = fall; // the next word is a leader
+      break;
+  }
+}
+
+static int build_blocks(lc3_cfg* cfg, const uint16_t* memory, const int32_t* target)
+{
+  int cap = 0;
+  int ended = 1;
+  for(uint32_t a = 0; a < LC3_MEMORY_WORDS; ++a)
+  {
+    cfg->block_of[a] = -1;
+    if(a >= DEVICE_BASE || cfg->kind[a] != LC3_CFG_CODE)
+    {
+      ended = 1;
+      continue;
+    }
+    if((ended || (cfg->flags[a] & W_LEADER)) && !add_block(cfg, &cap, a)) return 0;
+    cfg->block_of[a] = cfg->nblocks - 1;
+    ++cfg->blocks[cfg->nblocks - 1].len;
+    ended = cfg->flags[a] & W_END;
+  }
+  for(int i = 0; i < cfg->nblocks; ++i)
+  {
+    finish_block(cfg, &cfg->blocks[i], memory, target);
+  }
+  return 1;
+}
+
+
+/*======= DOMINATORS AND LOOPS =========*/
+
+typedef struct // predecessor lists, node nblocks is a root above every entry
+{
+  int* start; // preds of n are pred[start[n] .. start[n+1]-1]
+  int* pred;
+  int* rpo; // reverse postorder number, -1 when unreachable
+  int* idom;
+} graph;
+
+static int succ_of(const lc3_cfg* cfg, int n, int i) // i-th successor of n, the root leads to every entry
+{
+  if(n == cfg->nblocks)
+  {
+    for(int b = 0; b < cfg->nblocks; ++b)
+    {
+      if((cfg->blocks[b].flags & LC3_CFG_B_ENTRY) && i-- == 0) return b;
+    }
+    return -2;
+  }
+  return i < 2 ? cfg->blocks[n].succ[i] : -2;
+}
+
+static int intersect(const graph* g, int a, int b)
+{
+  while(a != b)
+  {
+    while(g->rpo[a] > g->rpo[b]) a = g->idom[a];
+    while(g->rpo[b] > g->rpo[a]) b = g->idom[b];
+  }
+  return a;
+}
+
+static int dominators(lc3_cfg* cfg, graph* g)
+{
+  int nodes = cfg->nblocks + 1;
+  int root = cfg->nblocks;
+  int* order = malloc(nodes * sizeof(int)); // postorder
+  int* stack = malloc(nodes * 2 * sizeof(int));
+  g->start = calloc(nodes + 1, sizeof(int));
+  g->pred = malloc((cfg->nblocks * 2 + nodes) * sizeof(int));
+  g->rpo = malloc(nodes * sizeof(int));
+  g->idom = malloc(nodes * sizeof(int));
+  if(!order || !stack || !g->start || !g->pred || !g->rpo || !g->idom)
+  {
+    free(order);
+    free(stack);
+    return 0;
+  }
+
+  // predecessors, counted then placed
+  for(int n = 0; n < nodes; ++n)
+  {
+    for(int i = 0, s; (s = succ_of(cfg, n, i)) != -2; ++i)
+    {
+      if(s >= 0) ++g->start[s + 1];
+    }
+  }
+  for(int n = 0; n < nodes; ++n) g->start[n + 1] += g->start[n];
+  int* fill = stack; // borrowed, the dfs below starts over
+  memcpy(fill, g->start, nodes * sizeof(int));
+  for(int n = 0; n < nodes; ++n)
+  {
+    for(int i = 0, s; (s = succ_of(cfg, n, i)) != -2; ++i)
+    {
+      if(s >= 0) g->pred[fill[s]++] = n;
+    }
+  }
+
+  // depth first from the root for the reverse postorder
+  int count = 0;
+  int sp = 0;
+  for(int n = 0; n < nodes; ++n) g->rpo[n] = -1;
+  g->rpo[root] = 0; // visited
+  stack[sp++] = root;
+  stack[sp++] = 0;
+  while(sp)
+  {
+    int n = stack[sp - 2];
+    int i = stack[sp - 1]++;
+    int s = succ_of(cfg, n, i);
+    if(s == -2)
+    {
+      order[count++] = n;
+      sp -= 2;
+    }
+    else if(s >= 0 && g->rpo[s] < 0)
+    {
+      g->rpo[s] = 0;
+      stack[sp++] = s;
+      stack[sp++] = 0;
+    }
+  }
+  for(int k = 0; k < count; ++k) g->rpo[order[k]] = count - 1 - k;
+
+  // cooper, harvey and kennedy's iterative algorithm
+  for(int n = 0; n < nodes; ++n) g->idom[n] = -1;
+  g->idom[root] = root;
+  for(int changed = 1; changed; )
+  {
+    changed = 0;
+    for(int k = count - 2; k >= 0; --k) // reverse postorder, root excluded
+    {
+      int n = order[k];
+      int dom = -1;
+      for(int p = g->start[n]; p < g->start[n + 1]; ++p)
+      {
+        int pred = g->pred[p];
+        if(g->idom[pred] < 0) continue;
+        dom = dom < 0 ? pred : intersect(g, pred, dom);
+      }
+      if(dom != g->idom[n])
+      {
+        g->idom[n] = dom;
+        changed = 1;
+      }
+    }
+  }
+  for(int b = 0; b < cfg->nblocks; ++b)
+  {
+    cfg->blocks[b].idom = g->idom[b] == root ? -1 : g->idom[b];
+  }
+  free(order);
+  free(stack);
+  return 1;
+}
+
+static int dominates(const graph* g, int h, int n)
+{
+  while(n >= 0 && n != h && g->idom[n] != n) n = g->idom[n];
+  return n == h;
+}
+
+typedef struct
+{
+  int header;
+  int body; // offset into the body list
+  int size;
+} loop_info;
+
+static int larger(const void* x, const void* y)
+{
+  const loop_info* a = x;
+  const loop_info* b = y;
+  return (b->size > a->size) - (b->size < a->size);
+}
+
+static int find_loops(lc3_cfg* cfg, const graph* g)
+{
+  int nb = cfg->nblocks;
+  int* mark = malloc(nb * sizeof(int));
+  int* stack = malloc((nb * 3 + 1) * sizeof(int)); // a block can be pushed once per edge into it
+  int* body = NULL;
+  loop_info* info = NULL;
+  int nbody = 0, cap_body = 0, ninfo = 0, cap_info = 0;
+  int ok = mark && stack;
+  for(int b = 0; b < nb && ok; ++b) mark[b] = -1;
+
+  for(int h = 0; h < nb && ok; ++h)
+  {
+    // natural loop of every back edge into h, merged
+    int sp = 0;
+    for(int p = g->start[h]; p < g->start[h + 1]; ++p)
+    {
+      int u = g->pred[p];
+      if(u < nb && g->rpo[u] >= 0 && dominates(g, h, u)) stack[sp++] = u;
+    }
+    if(!sp) continue;
+    if(ninfo == cap_info)
+    {
+      cap_info = cap_info ? cap_info * 2 : 64;
+      loop_info* grown = realloc(info, cap_info * sizeof(loop_info));
+      if(!(ok = grown != NULL)) break;
+      info = grown;
+    }
+    loop_info* l = &info[ninfo++];
+    l->header = h;
+    l->body = nbody;
+    l->size = 0;
+    mark[h] = -1; // so the header goes in first, and only once
+    stack[sp++] = h;
+    while(sp && ok)
+    {
+      int n = stack[--sp];
+      if(mark[n] == h) continue;
+      mark[n] = h;
+      if(nbody == cap_body)
+      {
+        cap_body = cap_body ? cap_body * 2 : 256;
+        int* grown = realloc(body, cap_body * sizeof(int));
+        if(!(ok = grown != NULL)) break;
+        body = grown;
+      }
+      body[nbody++] = n;
+      ++l->size;
+      if(n == h) continue; // the walk back stops at the header
+      for(int p = g->start[n]; p < g->start[n + 1]; ++p)
+      {
+        int pred = g->pred[p];
+        if(pred < nb && g->rpo[pred] >= 0 && mark[pred] != h) stack[sp++] = pred;
+      }
+    }
+  }
+
+  // outer loops first, so each loop overwrites the blocks of the one around it
+  if(ok && ninfo)
+  {
+    qsort(info, ninfo, sizeof(loop_info), larger);
+    cfg->loops = calloc(ninfo, sizeof(lc3_cfg_loop));
+    ok = cfg->loops != NULL;
+  }
+  for(int i = 0; ok && i < ninfo; ++i)
+  {
+    lc3_cfg_loop* l = &cfg->loops[i];
+    l->header = info[i].header;
+    l->parent = cfg->blocks[l->header].loop;
+    l->depth = l->parent < 0 ? 1 : cfg->loops[l->parent].depth + 1;
+    l->size = info[i].size;
+    for(int k = 0; k < info[i].size; ++k)
+    {
+      cfg->blocks[body[info[i].body + k]].loop = i;
+    }
+    cfg->nloops = i + 1;
+  }
+  free(mark);
+  free(stack);
+  free(body);
+  free(info);
+  return ok;
+}
+
+static void find_polling(lc3_cfg* cfg)
+{
+  for(int b = 0; b < cfg->nblocks; ++b)
+  {
+    int l = cfg->blocks[b].loop;
+    if((cfg->blocks[b].flags & LC3_CFG_B_KBSR) && l >= 0)
+    {
+      cfg->loops[l].flags |= LC3_CFG_L_POLL | LC3_CFG_L_IDLE;
+    }
+  }
+  const uint16_t busy = LC3_CFG_B_STORE | LC3_CFG_B_CALL | LC3_CFG_B_TRAP | LC3_CFG_B_INDIRECT;
+  for(int b = 0; b < cfg->nblocks; ++b)
+  {
+    if(!(cfg->blocks[b].flags & busy)) continue;
+    for(int l = cfg->blocks[b].loop; l >= 0; l = cfg->loops[l].parent)
+    {
+      cfg->loops[l].flags &= ~LC3_CFG_L_IDLE;
+    }
+  }
+}
+
+
+/*================ API =================*/
+
+lc3_cfg* lc3_cfg_build(const uint16_t* memory, const uint16_t* entries, int count)
+{
+  static const uint16_t default_entry = PC_START;
+  lc3_cfg* cfg = calloc(1, sizeof(lc3_cfg));
+  walker w = { cfg, memory, NULL, 0, NULL, NULL, 0, 0, 0 };
+  w.work = malloc(LC3_MEMORY_WORDS * sizeof(uint16_t));
+  w.target = malloc(LC3_MEMORY_WORDS * sizeof(int32_t));
+  graph g = { NULL, NULL, NULL, NULL };
+  int ok = cfg && w.work && w.target;
+  if(ok)
+  {
+    if(count <= 0)
+    {
+      entries = &default_entry;
+      count = 1;
+    }
+    // a jump found into code already walked past means the values carried
+    // into it were wrong, walk everything again knowing where the joins are
+    do
+    {
+      w.redo = 0;
+      w.nstores = 0;
+      cfg->wild_stores = 0;
+      for(uint32_t a = 0; a < LC3_MEMORY_WORDS; ++a)
+      {
+        cfg->kind[a] = LC3_CFG_UNKNOWN;
+        cfg->flags[a] &= W_JOIN;
+        w.target[a] = -1;
+      }
+      for(int i = 0; i < count; ++i) push(&w, entries[i], LC3_CFG_W_ENTRY);
+      while(w.nwork) walk(&w, w.work[--w.nwork]);
+    } while(w.redo);
+
+    // code wins over every other use of a word
+    for(uint32_t a = 0; a < DEVICE_BASE; ++a)
+    {
+      if(cfg->kind[a] == LC3_CFG_CODE) continue;
+      if(cfg->flags[a] & W_STRING) cfg->kind[a] = LC3_CFG_STRING;
+      else if(cfg->flags[a] & (LC3_CFG_W_READ | LC3_CFG_W_WRITTEN | LC3_CFG_W_POINTER)) cfg->kind[a] = LC3_CFG_DATA;
+    }
+    int nsmc = 0;
+    for(int i = 0; i < w.nstores; ++i)
+    {
+      if(cfg->kind[w.stores[i].target] != LC3_CFG_CODE) continue;
+      cfg->flags[w.stores[i].store] |= LC3_CFG_W_SMC;
+      cfg->flags[w.stores[i].target] |= LC3_CFG_W_PATCHED;
+      w.stores[nsmc++] = w.stores[i];
+    }
+    if(nsmc)
+    {
+      cfg->smc = malloc(nsmc * sizeof(lc3_cfg_smc));
+      ok = cfg->smc != NULL;
+      if(ok) memcpy(cfg->smc, w.stores, nsmc * sizeof(lc3_cfg_smc));
+      cfg->nsmc = ok ? nsmc : 0;
+    }
+  }
+  ok = ok && build_blocks(cfg, memory, w.target);
+  ok = ok && dominators(cfg, &g) && find_loops(cfg, &g);
+  if(ok)
+  {
+    find_polling(cfg);
+    for(uint32_t a = 0; a < LC3_MEMORY_WORDS; ++a)
+    {
+      cfg->flags[a] &= 0xFF; // drop the build-only bits
+    }
+  }
+  free(w.work);
+  free(w.target);
+  free(w.stores);
+  free(g.start);
+  free(g.pred);
+  free(g.rpo);
+  free(g.idom);
+  if(!ok)
+  {
+    lc3_cfg_free(cfg);
+    return NULL;
+  }
+  return cfg;
+}
+
+void lc3_cfg_free(lc3_cfg* cfg)
+{
+  if(!cfg) return;
+  free(cfg->blocks);
+  free(cfg->loops);
+  free(cfg->smc);
+  free(cfg);
+}
@@ -0,0 +1,109 @@
+#ifndef CFG_H
+#define CFG_H
+
+/*
+  static control flow analysis of a loaded memory image.
+
+  code is found by walking from the entry points and following BR, JSR,
+  JSRR, JMP and TRAP. register values set by LEA, LD and small immediate
+  arithmetic are tracked inside each run of code up to the next jump
+  target, which resolves JMP/JSRR targets, the strings handed to
+  PUTS/PUTSP and the addresses behind LDI/STI/LDR/STR. what is read or
+  written but never reached as code is data.
+
+  the result is a plain structure meant to be consumed by execution
+  engines: basic blocks with successors and dominators, loops with their
+  nesting, keyboard polling loops (idle when they do nothing else), and
+  every store known to land on code.
+*/
+
+#include <stdint.h>
+#include "lc3vm.h"
+
+enum // lc3_cfg.kind[addr]
+{
+  LC3_CFG_UNKNOWN = 0, // never reached or referenced
+  LC3_CFG_CODE,
+  LC3_CFG_DATA,
+  LC3_CFG_STRING // consumed by PUTS/PUTSP
+};
+
+enum // lc3_cfg.flags[addr]
+{
+  LC3_CFG_W_ENTRY = 1 << 0,   // entry point or call target
+  LC3_CFG_W_READ = 1 << 1,    // loaded from (LD/LDI/LDR)
+  LC3_CFG_W_WRITTEN = 1 << 2, // stored to (ST/STI/STR)
+  LC3_CFG_W_POINTER = 1 << 3, // address word used by LDI/STI
+  LC3_CFG_W_KBSR = 1 << 4,    // instruction that reads KBSR
+  LC3_CFG_W_KBDR = 1 << 5,    // instruction that reads KBDR
+  LC3_CFG_W_SMC = 1 << 6,     // store that writes code
+  LC3_CFG_W_PATCHED = 1 << 7  // code word written by a store
+};
+
+enum // lc3_cfg_block.flags
+{
+  LC3_CFG_B_ENTRY = 1 << 0,    // starts at an entry point or call target
+  LC3_CFG_B_CALL = 1 << 1,     // ends in JSR/JSRR, succ[1] is the return point
+  LC3_CFG_B_RETURN = 1 << 2,   // ends in RET or RTI
+  LC3_CFG_B_INDIRECT = 1 << 3, // ends in a JMP/JSRR whose target is unknown
+  LC3_CFG_B_HALT = 1 << 4,
+  LC3_CFG_B_FAULT = 1 << 5,    // ends in the reserved opcode
+  LC3_CFG_B_TRAP = 1 << 6,     // has a TRAP other than HALT
+  LC3_CFG_B_STORE = 1 << 7,
+  LC3_CFG_B_KBSR = 1 << 8,     // reads KBSR
+  LC3_CFG_B_SMC = 1 << 9       // has a store that writes code
+};
+
+enum // lc3_cfg_loop.flags
+{
+  LC3_CFG_L_POLL = 1 << 0, // innermost loop around a KBSR read
+  LC3_CFG_L_IDLE = 1 << 1  // polling loop without stores, calls or traps, safe to sleep in
+};
+
+typedef struct
+{
+  uint16_t start;
+  uint16_t len; // instructions
+  int32_t succ[2]; // [0] branch or jump target, [1] fall-through or return point, -1 for none
+  uint16_t call; // JSR/JSRR target with LC3_CFG_B_CALL, unless LC3_CFG_B_INDIRECT
+  uint16_t flags; // LC3_CFG_B_*
+  int32_t idom; // immediate dominator within its routine, -1 for entries and unreachable blocks
+  int32_t loop; // innermost loop, -1 outside any loop
+} lc3_cfg_block;
+
+typedef struct
+{
+  int32_t header; // block
+  int32_t parent; // enclosing loop, always a lower index, -1 for outermost
+  int32_t depth; // 1 for outermost
+  int32_t size; // blocks, nested loops included
+  uint16_t flags; // LC3_CFG_L_*
+} lc3_cfg_loop;
+
+typedef struct
+{
+  uint16_t store; // the ST/STI/STR
+  uint16_t target; // the code word it writes
+} lc3_cfg_smc;
+
+typedef struct
+{
+  uint8_t kind[LC3_MEMORY_WORDS]; // LC3_CFG_*
+  uint16_t flags[LC3_MEMORY_WORDS]; // LC3_CFG_W_*
+  int32_t block_of[LC3_MEMORY_WORDS]; // block holding a code word, -1 elsewhere
+  lc3_cfg_block* blocks; // in address order
+  int nblocks;
+  lc3_cfg_loop* loops; // outer loops before the loops they contain
+  int nloops;
+  lc3_cfg_smc* smc;
+  int nsmc;
+  // stores whose address could not be worked out. while this is 0 only
+  // words flagged LC3_CFG_W_WRITTEN are ever written by guest code.
+  int wild_stores;
+} lc3_cfg;
+
+// entries defaults to PC_START when count is 0. NULL when out of memory.
+lc3_cfg* lc3_cfg_build(const uint16_t* memory, const uint16_t* entries, int count);
+void lc3_cfg_free(lc3_cfg* cfg);
+
+#endif
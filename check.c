@@ -0,0 +1,450 @@
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "opcodes.h"
+#include "disasm.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+enum { EV_READY, EV_GETC }; // console_event.type
+
+typedef struct // one answer the reference's console gave
+{
+  int type;
+  int value;
+} console_event;
+
+typedef struct // what lc3_restore() would reset, kept with the good state
+{
+  uint64_t deadline[DEV_COUNT]; // UINT64_MAX when not scheduled
+  uint16 pending;
+  uint16 timer_period[TIMER_COUNT];
+  int kbd_latched;
+} devices_state;
+
+typedef struct // a console that gives the logged answers again
+{
+  lc3_check* c;
+  size_t cursor;
+  uint64_t output; // hash of what was written
+  int overrun; // asked something the log doesn't hold
+} replay;
+
+struct lc3_check
+{
+  lc3_vm* ref;
+  lc3_vm* cand;
+  uint64_t interval;
+  lc3_io ref_console; // the real ones, given back by lc3_check_free()
+  lc3_io cand_console;
+  uint64_t ref_output; // hash of the reference's output since the good state
+  console_event* log; // the reference's console answers since the good state
+  size_t nlog;
+  size_t cap;
+  int log_failed; // out of memory, the log has a hole
+  replay cand_io;
+  replay ref_replay; // the reference's console while bisecting
+  lc3_state* good; // where both last agreed
+  devices_state good_devices;
+  uint64_t good_retired;
+  uint8_t pages[LC3_PAGE_COUNT];
+  int diverged;
+  lc3_divergence report;
+};
+
+static uint64_t hash_bytes(uint64_t h, const char* buf, size_t n)
+{
+  for(size_t i = 0; i < n; ++i)
+  {
+    h = (h ^ (unsigned char)buf[i]) * FNV_PRIME;
+  }
+  return h;
+}
+
+
+/*============== CONSOLES ==============*/
+
+static void log_event(lc3_check* c, int type, int value)
+{
+  if(c->nlog == c->cap)
+  {
+    size_t cap = c->cap ? 2 * c->cap : 256;
+    console_event* log = realloc(c->log, cap * sizeof(console_event));
+    if(!log)
+    {
+      c->log_failed = 1;
+      return;
+    }
+    c->log = log;
+    c->cap = cap;
+  }
+  c->log[c->nlog++] = (console_event){ type, value };
+}
+
+static int record_getc(void* ctx)
+{
+  lc3_check* c = ctx;
+  int ch = c->ref_console.getc(c->ref_console.ctx);
+  log_event(c, EV_GETC, ch);
+  return ch;
+}
+
+static int record_key_ready(void* ctx)
+{
+  lc3_check* c = ctx;
+  int ready = c->ref_console.key_ready(c->ref_console.ctx);
+  log_event(c, EV_READY, ready);
+  return ready;
+}
+
+static void record_write(void* ctx, const char* buf, size_t n)
+{
+  lc3_check* c = ctx;
+  c->ref_output = hash_bytes(c->ref_output, buf, n);
+  c->ref_console.write(c->ref_console.ctx, buf, n);
+}
+
+static void record_flush(void* ctx)
+{
+  lc3_check* c = ctx;
+  c->ref_console.flush(c->ref_console.ctx);
+}
+
+static int next_event(replay* r, int type)
+{
+  const lc3_check* c = r->c;
+  if(r->cursor >= c->nlog || c->log[r->cursor].type != type)
+  {
+    r->overrun = 1;
+    return type == EV_GETC ? -1 : 0;
+  }
+  return c->log[r->cursor++].value;
+}
+
+static int replay_getc(void* ctx)
+{
+  return next_event(ctx, EV_GETC);
+}
+
+static int replay_key_ready(void* ctx)
+{
+  return next_event(ctx, EV_READY);
+}
+
+static void replay_write(void* ctx, const char* buf, size_t n)
+{
+  replay* r = ctx;
+  r->output = hash_bytes(r->output, buf, n);
+}
+
+static void replay_flush(void* ctx)
+{
+}
+
+static void replay_start(replay* r, lc3_vm* vm)
+{
+  lc3_check* c = r->c;
+  r->cursor = 0;
+  r->output = FNV_OFFSET;
+  r->overrun = c->log_failed;
+  lc3_io io = { replay_getc, replay_key_ready, replay_write, replay_flush, r };
+  lc3_set_io(vm, &io);
+}
+
+
+/*============= COMPARING ==============*/
+
+// 1 when they differ, with the first difference in *d. ref_reads is how
+// far into the log the reference got. all_pages compares every page
+// instead of the ones written since the last look.
+static int differ(lc3_check* c, int ref_stop, int cand_stop, size_t ref_reads, uint64_t ref_output,
+                  int all_pages, lc3_divergence* d)
+{
+  lc3_vm* ref = c->ref;
+  lc3_vm* cand = c->cand;
+  memset(d, 0, sizeof(*d));
+  memcpy(d->ref_reg, ref->reg, sizeof(d->ref_reg));
+  memcpy(d->cand_reg, cand->reg, sizeof(d->cand_reg));
+
+  uint8_t cand_pages[LC3_PAGE_COUNT];
+  lc3_dirty_pages(ref, LC3_DIRTY_CHECK, c->pages);
+  lc3_dirty_pages(cand, LC3_DIRTY_CHECK, cand_pages);
+  for(int p = 0; p < LC3_PAGE_COUNT; ++p)
+  {
+    c->pages[p] |= cand_pages[p] | all_pages;
+  }
+
+  if(ref_stop != cand_stop || ref->retired != cand->retired)
+  {
+    d->kind = LC3_DIVERGE_STOP;
+    d->ref_value = ref_stop;
+    d->cand_value = cand_stop;
+    return 1;
+  }
+  if(c->cand_io.overrun || c->cand_io.cursor != ref_reads)
+  {
+    d->kind = LC3_DIVERGE_INPUT;
+    d->ref_value = ref_reads;
+    d->cand_value = c->cand_io.cursor;
+    return 1;
+  }
+  for(int r = 0; r < R_COUNT; ++r)
+  {
+    if(ref->reg[r] != cand->reg[r])
+    {
+      d->kind = LC3_DIVERGE_REG;
+      d->index = r;
+      d->ref_value = ref->reg[r];
+      d->cand_value = cand->reg[r];
+      return 1;
+    }
+  }
+  if(ref->psr != cand->psr)
+  {
+    d->kind = LC3_DIVERGE_PSR;
+    d->ref_value = ref->psr;
+    d->cand_value = cand->psr;
+    return 1;
+  }
+  if(ref_output != c->cand_io.output)
+  {
+    d->kind = LC3_DIVERGE_OUTPUT;
+    return 1;
+  }
+  for(int p = 0; p < LC3_PAGE_COUNT; ++p)
+  {
+    const uint16* a = ref->memory + p * LC3_PAGE_WORDS;
+    const uint16* b = cand->memory + p * LC3_PAGE_WORDS;
+    if(!c->pages[p] || memcmp(a, b, LC3_PAGE_WORDS * sizeof(uint16)) == 0) continue;
+    int i = 0;
+    while(a[i] == b[i]) ++i;
+    d->kind = LC3_DIVERGE_MEMORY;
+    d->address = p * LC3_PAGE_WORDS + i;
+    d->ref_value = a[i];
+    d->cand_value = b[i];
+    return 1;
+  }
+  return 0;
+}
+
+static void save_devices(devices_state* d, const lc3_vm* vm)
+{
+  devices_deadlines(vm, d->deadline);
+  d->pending = vm->pending;
+  memcpy(d->timer_period, vm->timer_period, sizeof(d->timer_period));
+  d->kbd_latched = vm->kbd_latched;
+}
+
+static void agreed(lc3_check* c) // the pages differ() looked at are the ones to copy
+{
+  lc3_vm* ref = c->ref;
+  memcpy(c->good->reg, ref->reg, sizeof(c->good->reg));
+  c->good->psr = ref->psr;
+  c->good->saved_usp = ref->saved_usp;
+  c->good->saved_ssp = ref->saved_ssp;
+  c->good->running = ref->running;
+  save_devices(&c->good_devices, ref);
+  for(int p = 0; p < LC3_PAGE_COUNT; ++p)
+  {
+    if(c->pages[p])
+    {
+      memcpy(c->good->memory + p * LC3_PAGE_WORDS, ref->memory + p * LC3_PAGE_WORDS, LC3_PAGE_WORDS * sizeof(uint16));
+    }
+  }
+  c->good_retired = ref->retired;
+  c->nlog = 0;
+  c->log_failed = 0;
+  c->ref_output = FNV_OFFSET;
+  c->cand_io.cursor = 0;
+  c->cand_io.output = FNV_OFFSET;
+  c->cand_io.overrun = 0;
+}
+
+
+/*============= BISECTING ==============*/
+
+static void restore_good(lc3_check* c, lc3_vm* vm)
+{
+  const devices_state* d = &c->good_devices;
+  vm->retired = c->good_retired;
+  lc3_restore(vm, c->good);
+  // lc3_restore() restarted the timers and dropped what was pending, put it back
+  memcpy(vm->timer_period, d->timer_period, sizeof(vm->timer_period));
+  devices_set_deadlines(vm, d->deadline);
+  vm->pending = d->pending;
+  vm->kbd_latched = d->kbd_latched;
+}
+
+// runs both n instructions from the good state, 1 when they differ then
+static int replay_to(lc3_check* c, uint64_t n, lc3_divergence* d)
+{
+  restore_good(c, c->ref);
+  restore_good(c, c->cand);
+  replay_start(&c->ref_replay, c->ref);
+  replay_start(&c->cand_io, c->cand);
+  int ref_stop = lc3_run(c->ref, n);
+  int cand_stop = lc3_run(c->cand, n);
+  return differ(c, ref_stop, cand_stop, c->ref_replay.cursor, c->ref_replay.output, 1, d);
+}
+
+// n is how far past the good state the failed check was
+static void locate(lc3_check* c, uint64_t n, lc3_divergence* d)
+{
+  d->good = c->good_retired;
+  d->at = c->good_retired + n;
+  lc3_divergence probe;
+  if(!replay_to(c, n, &probe))
+  {
+    return; // not deterministic, keep what the check saw
+  }
+  uint64_t lo = 0; // they agree after lo instructions, differ after hi
+  uint64_t hi = n;
+  while(hi - lo > 1)
+  {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if(replay_to(c, mid, &probe)) hi = mid;
+    else lo = mid;
+  }
+
+  restore_good(c, c->ref);
+  replay_start(&c->ref_replay, c->ref);
+  lc3_run(c->ref, hi - 1);
+  uint16 pc = c->ref->reg[R_PC];
+  uint16 instr = c->ref->memory[pc];
+
+  replay_to(c, hi, d); // and leave both there
+  d->good = c->good_retired;
+  d->at = c->good_retired + hi;
+  d->exact = 1;
+  d->last_pc = pc;
+  d->last_instr = instr;
+}
+
+
+/*================ API =================*/
+
+lc3_check* lc3_check_create(lc3_vm* ref, lc3_vm* cand, uint64_t interval)
+{
+  lc3_check* c = calloc(1, sizeof(lc3_check));
+  lc3_state* good = malloc(sizeof(lc3_state));
+  if(!c || !good)
+  {
+    free(c);
+    free(good);
+    return NULL;
+  }
+  c->ref = ref;
+  c->cand = cand;
+  c->interval = interval ? interval : 1;
+  c->good = good;
+  lc3_snapshot(ref, good);
+  save_devices(&c->good_devices, ref);
+  c->good_retired = ref->retired;
+  lc3_dirty_pages(ref, LC3_DIRTY_CHECK, c->pages); // the snapshot has them all
+  lc3_dirty_pages(cand, LC3_DIRTY_CHECK, c->pages);
+  c->ref_output = FNV_OFFSET;
+
+  lc3_get_io(ref, &c->ref_console);
+  lc3_get_io(cand, &c->cand_console);
+  lc3_io record = { record_getc, record_key_ready, record_write, record_flush, c };
+  lc3_set_io(ref, &record);
+  c->cand_io.c = c;
+  c->ref_replay.c = c;
+  replay_start(&c->cand_io, cand);
+  return c;
+}
+
+void lc3_check_free(lc3_check* c)
+{
+  if(!c) return;
+  lc3_set_io(c->ref, &c->ref_console);
+  lc3_set_io(c->cand, &c->cand_console);
+  free(c->log);
+  free(c->good);
+  free(c);
+}
+
+int lc3_check_run(lc3_check* c, uint64_t max_instructions, lc3_divergence* out)
+{
+  if(c->diverged)
+  {
+    *out = c->report;
+    return LC3_CHECK_DIVERGED;
+  }
+  int stop = LC3_STOP_BUDGET;
+  for(uint64_t done = 0; done < max_instructions && stop == LC3_STOP_BUDGET; )
+  {
+    uint64_t slice = max_instructions - done < c->interval ? max_instructions - done : c->interval;
+    stop = lc3_run(c->ref, slice);
+    int cand_stop = lc3_run(c->cand, slice);
+    done += slice;
+    if(differ(c, stop, cand_stop, c->nlog, c->ref_output, 0, out))
+    {
+      uint64_t ran = c->ref->retired > c->cand->retired ? c->ref->retired : c->cand->retired;
+      ran -= c->good_retired;
+      locate(c, ran ? ran : 1, out);
+      c->diverged = 1;
+      c->report = *out;
+      return LC3_CHECK_DIVERGED;
+    }
+    agreed(c);
+  }
+  return stop;
+}
+
+static const char* const reg_names[R_COUNT] = { "R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7", "PC", "COND" };
+static const char* const stop_names[] = { "budget", "halt", "input", "fault", "quota" };
+
+static const char* stop_name(int stop)
+{
+  return stop >= 0 && stop <= LC3_STOP_QUOTA ? stop_names[stop] : "?";
+}
+
+void lc3_divergence_print(FILE* out, const lc3_divergence* d)
+{
+  if(d->exact)
+  {
+    char text[64];
+    disassemble(d->last_pc, d->last_instr, text, sizeof(text));
+    fprintf(out, "divergence after instruction %llu (last agreed at %llu)\n",
+            (unsigned long long)d->at, (unsigned long long)d->good);
+    fprintf(out, "  last instruction x%04X  %04X  %s\n", d->last_pc, d->last_instr, text);
+  }
+  else
+  {
+    fprintf(out, "divergence seen at instruction %llu, not repeated on replay (last agreed at %llu)\n",
+            (unsigned long long)d->at, (unsigned long long)d->good);
+  }
+  switch(d->kind)
+  {
+    case LC3_DIVERGE_STOP:
+      fprintf(out, "  stopped: reference %s, candidate %s\n", stop_name(d->ref_value), stop_name(d->cand_value));
+      break;
+    case LC3_DIVERGE_REG:
+      fprintf(out, "  %s: reference x%04X, candidate x%04X\n", reg_names[d->index], d->ref_value, d->cand_value);
+      break;
+    case LC3_DIVERGE_PSR:
+      fprintf(out, "  PSR: reference x%04X, candidate x%04X\n", d->ref_value, d->cand_value);
+      break;
+    case LC3_DIVERGE_MEMORY:
+      fprintf(out, "  x%04X: reference x%04X, candidate x%04X\n", d->address, d->ref_value, d->cand_value);
+      break;
+    case LC3_DIVERGE_OUTPUT:
+      fprintf(out, "  console output differs\n");
+      break;
+    case LC3_DIVERGE_INPUT:
+      fprintf(out, "  console reads: reference %u, candidate %u or out of order\n", d->ref_value, d->cand_value);
+      break;
+  }
+  for(int who = 0; who < 2; ++who)
+  {
+    const uint16_t* reg = who ? d->cand_reg : d->ref_reg;
+    fprintf(out, "  %s", who ? "candidate:" : "reference:");
+    for(int r = 0; r < R_COUNT; ++r)
+    {
+      fprintf(out, " %s=x%04X", reg_names[r], reg[r]);
+    }
+    fprintf(out, "\n");
+  }
+}
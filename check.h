@@ -0,0 +1,65 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+/*
+  differential execution checker.
+
+  a reference vm and a candidate vm (same image, usually different
+  backends) run side by side. the reference keeps the real console, the
+  candidate replays every key_ready/getc answer the reference got, and
+  the output of both is hashed. every interval instructions both stop and
+  are compared: stop reason, registers, PSR, output, and the memory pages
+  either one wrote since the last check, so the cost follows the writes
+  and not the 128KB of memory.
+
+  on a difference both are put back to the last state that matched and
+  the interval is replayed, bisecting down to the first instruction
+  count after which they disagree. the report names that point, the
+  instruction the reference ran last and the first differing value.
+*/
+
+#include <stdio.h>
+#include "lc3vm.h"
+
+#define LC3_CHECK_DIVERGED (-1) // lc3_check_run() result
+
+enum // lc3_divergence.kind
+{
+  LC3_DIVERGE_STOP = 1, // lc3_run() returned different reasons
+  LC3_DIVERGE_REG,      // reg[index], R_COND included
+  LC3_DIVERGE_PSR,
+  LC3_DIVERGE_MEMORY,   // memory[address]
+  LC3_DIVERGE_OUTPUT,   // the console output differs
+  LC3_DIVERGE_INPUT     // the candidate asked the console something the reference didn't
+};
+
+typedef struct
+{
+  int kind; // LC3_DIVERGE_*
+  int index; // register for LC3_DIVERGE_REG
+  uint16_t address; // word for LC3_DIVERGE_MEMORY
+  uint16_t ref_value; // the stop reason, register, PSR or word
+  uint16_t cand_value;
+  uint64_t good; // lc3_retired() of the last state both agreed on
+  uint64_t at; // first lc3_retired() at which they differ
+  int exact; // 0 when the replay did not show it again, at is then where the check caught it
+  uint16_t last_pc; // the last instruction the reference retired before at
+  uint16_t last_instr;
+  uint16_t ref_reg[LC3_REG_COUNT];
+  uint16_t cand_reg[LC3_REG_COUNT];
+} lc3_divergence;
+
+typedef struct lc3_check lc3_check;
+
+// both vms must hold the same state. the candidate's console is replaced
+// and its output dropped. NULL when out of memory.
+lc3_check* lc3_check_create(lc3_vm* ref, lc3_vm* cand, uint64_t interval);
+void lc3_check_free(lc3_check* c); // the reference gets its console back
+
+// lc3_run() for the pair, returns the reference's LC3_STOP_* reason or
+// LC3_CHECK_DIVERGED with *out filled in. after a divergence both vms are
+// left where they first differ and every further call diverges again.
+int lc3_check_run(lc3_check* c, uint64_t max_instructions, lc3_divergence* out);
+void lc3_divergence_print(FILE* out, const lc3_divergence* d);
+
+#endif
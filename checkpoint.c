@@ -0,0 +1,492 @@
+#include <stdlib.h>
+#include <string.h>
+#include "checkpoint.h"
+#include "opcodes.h"
+
+#ifdef WIN32
+#include <io.h>
+#define truncate_file(f, size) _chsize(_fileno(f), (long)(size))
+#define sync_file(f) _commit(_fileno(f))
+#else
+#include <pthread.h>
+#include <unistd.h>
+#define truncate_file(f, size) ftruncate(fileno(f), (off_t)(size))
+#define sync_file(f) fsync(fileno(f))
+#define WRITER_THREAD // without one lc3_checkpoint_take() writes the record itself
+#endif
+
+/*
+  the log is LOG_MAGIC and then records: the packed size, the raw size
+  and an FNV-1a sum of the packed bytes, all 32 bit, then the packed
+  bytes. raw, a record is the instruction count (64 bit), the registers,
+  PSR, saved USP and SSP, running and the page count (16 bit each), the
+  page numbers (a byte each) and the pages. everything little endian.
+*/
+
+#define LOG_MAGIC "lc3ckpt1"
+#define MAGIC_SIZE 8
+#define RECORD_HEADER 12
+#define RAW_HEADER (8 + 2 * (R_COUNT + 5))
+#define RAW_MAX (RAW_HEADER + LC3_PAGE_COUNT + 2 * LC3_MEMORY_WORDS)
+#define PACKED_MAX (RAW_MAX + RAW_MAX / 255 + 16) // incompressible input grows this much at worst
+
+typedef struct // what the vm thread copies aside for the writer
+{
+  uint64_t retired;
+  uint16 reg[R_COUNT];
+  uint16 psr;
+  uint16 saved_usp;
+  uint16 saved_ssp;
+  uint16 running;
+  int npages;
+  uint8_t page[LC3_PAGE_COUNT];
+  uint16 words[LC3_MEMORY_WORDS]; // npages * LC3_PAGE_WORDS of them used
+} staged;
+
+struct lc3_checkpoint
+{
+  FILE* file;
+  const lc3_vm* vm; // whose state the log's last record holds
+  staged next;
+  uint8_t raw[RAW_MAX];
+  uint8_t packed[RECORD_HEADER + PACKED_MAX];
+  int failed;
+#ifdef WRITER_THREAD
+  pthread_mutex_t lock;
+  pthread_cond_t work; // busy or quit set
+  pthread_cond_t done; // busy cleared
+  int busy; // next belongs to the writer
+  int quit;
+  pthread_t writer;
+#endif
+};
+
+static void put16(uint8_t* p, uint16 v)
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static uint16 get16(const uint8_t* p)
+{
+  return (uint16)(p[0] | p[1] << 8);
+}
+
+static void put32(uint8_t* p, uint32_t v)
+{
+  put16(p, (uint16)v);
+  put16(p + 2, (uint16)(v >> 16));
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+  return get16(p) | (uint32_t)get16(p + 2) << 16;
+}
+
+static uint32_t checksum(const uint8_t* p, size_t n) // FNV-1a
+{
+  uint32_t h = 0x811c9dc5u;
+  for(size_t i = 0; i < n; ++i)
+  {
+    h = (h ^ p[i]) * 0x01000193u;
+  }
+  return h;
+}
+
+
+/*================= LZ =================*/
+
+// lz4 style sequences: a token with the literal count in its high nibble
+// and the match length - LZ_MIN_MATCH in the low one, 15 meaning more
+// bytes follow that add up to 255 each. then the literals and a 16 bit
+// offset back to the match. the last sequence is literals only.
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_BAD ((size_t)-1)
+
+static uint32_t read32(const uint8_t* p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static size_t put_length(uint8_t* out, size_t op, size_t n) // what is past the 15 in the token
+{
+  for(n -= 15; n >= 255; n -= 255)
+  {
+    out[op++] = 255;
+  }
+  out[op++] = (uint8_t)n;
+  return op;
+}
+
+static size_t put_sequence(uint8_t* out, size_t op, const uint8_t* lit, size_t nlit, size_t offset, size_t len)
+{
+  size_t extra = len ? len - LZ_MIN_MATCH : 0;
+  out[op++] = (uint8_t)((nlit < 15 ? nlit : 15) << 4 | (extra < 15 ? extra : 15));
+  if(nlit >= 15) op = put_length(out, op, nlit);
+  memcpy(out + op, lit, nlit);
+  op += nlit;
+  if(len)
+  {
+    put16(out + op, (uint16)offset);
+    op += 2;
+    if(extra >= 15) op = put_length(out, op, extra);
+  }
+  return op;
+}
+
+static size_t lz_pack(const uint8_t* in, size_t n, uint8_t* out)
+{
+  uint32_t table[1 << LZ_HASH_BITS]; // last position + 1 of every hashed 4 bytes, 0 for none
+  memset(table, 0, sizeof(table));
+  size_t ip = 0;
+  size_t anchor = 0; // first byte not yet in a sequence
+  size_t op = 0;
+  while(ip + LZ_MIN_MATCH <= n)
+  {
+    uint32_t seq = read32(in + ip);
+    uint32_t h = seq * 2654435761u >> (32 - LZ_HASH_BITS);
+    size_t cand = table[h];
+    table[h] = (uint32_t)ip + 1;
+    if(cand && ip - (cand - 1) <= 0xFFFF && read32(in + cand - 1) == seq)
+    {
+      size_t from = cand - 1;
+      size_t len = LZ_MIN_MATCH;
+      while(ip + len < n && in[from + len] == in[ip + len]) ++len;
+      op = put_sequence(out, op, in + anchor, ip - anchor, ip - from, len);
+      ip += len;
+      anchor = ip;
+    }
+    else
+    {
+      ++ip;
+    }
+  }
+  return put_sequence(out, op, in + anchor, n - anchor, 0, 0);
+}
+
+static int get_length(const uint8_t* in, size_t n, size_t* ip, size_t* len)
+{
+  uint8_t b;
+  do
+  {
+    if(*ip >= n) return 0;
+    b = in[(*ip)++];
+    *len += b;
+  } while(b == 255);
+  return 1;
+}
+
+// the unpacked size, LZ_BAD when in is damaged or unpacks past cap
+static size_t lz_unpack(const uint8_t* in, size_t n, uint8_t* out, size_t cap)
+{
+  size_t ip = 0;
+  size_t op = 0;
+  while(ip < n)
+  {
+    uint8_t token = in[ip++];
+    size_t nlit = token >> 4;
+    if(nlit == 15 && !get_length(in, n, &ip, &nlit)) return LZ_BAD;
+    if(nlit > n - ip || nlit > cap - op) return LZ_BAD;
+    memcpy(out + op, in + ip, nlit);
+    ip += nlit;
+    op += nlit;
+    if(ip == n) break; // the last sequence
+    if(n - ip < 2) return LZ_BAD;
+    size_t offset = get16(in + ip);
+    ip += 2;
+    size_t len = token & 15;
+    if(len == 15 && !get_length(in, n, &ip, &len)) return LZ_BAD;
+    len += LZ_MIN_MATCH;
+    if(offset == 0 || offset > op || len > cap - op) return LZ_BAD;
+    for(size_t i = 0; i < len; ++i, ++op)
+    {
+      out[op] = out[op - offset]; // may overlap, that is how runs are coded
+    }
+  }
+  return op;
+}
+
+
+/*=============== RECORDS ==============*/
+
+static size_t serialize(const staged* s, uint8_t* raw)
+{
+  uint8_t* p = raw;
+  put32(p, (uint32_t)s->retired);
+  put32(p + 4, (uint32_t)(s->retired >> 32));
+  p += 8;
+  for(int r = 0; r < R_COUNT; ++r, p += 2)
+  {
+    put16(p, s->reg[r]);
+  }
+  put16(p, s->psr);
+  put16(p + 2, s->saved_usp);
+  put16(p + 4, s->saved_ssp);
+  put16(p + 6, s->running);
+  put16(p + 8, (uint16)s->npages);
+  p += 10;
+  memcpy(p, s->page, s->npages);
+  p += s->npages;
+  for(size_t i = 0; i < (size_t)s->npages * LC3_PAGE_WORDS; ++i, p += 2)
+  {
+    put16(p, s->words[i]);
+  }
+  return p - raw;
+}
+
+static void apply(const uint8_t* raw, lc3_state* state, uint64_t* retired)
+{
+  const uint8_t* p = raw;
+  *retired = get32(p) | (uint64_t)get32(p + 4) << 32;
+  p += 8;
+  for(int r = 0; r < R_COUNT; ++r, p += 2)
+  {
+    state->reg[r] = get16(p);
+  }
+  state->psr = get16(p);
+  state->saved_usp = get16(p + 2);
+  state->saved_ssp = get16(p + 4);
+  state->running = get16(p + 6);
+  int npages = get16(p + 8);
+  p += 10;
+  const uint8_t* data = p + npages;
+  for(int i = 0; i < npages; ++i)
+  {
+    uint16* page = &state->memory[p[i] * LC3_PAGE_WORDS];
+    for(int w = 0; w < LC3_PAGE_WORDS; ++w, data += 2)
+    {
+      page[w] = get16(data);
+    }
+  }
+}
+
+static void write_staged(lc3_checkpoint* cp)
+{
+  size_t raw = serialize(&cp->next, cp->raw);
+  size_t packed = lz_pack(cp->raw, raw, cp->packed + RECORD_HEADER);
+  put32(cp->packed, (uint32_t)packed);
+  put32(cp->packed + 4, (uint32_t)raw);
+  put32(cp->packed + 8, checksum(cp->packed + RECORD_HEADER, packed));
+  if(fwrite(cp->packed, 1, RECORD_HEADER + packed, cp->file) != RECORD_HEADER + packed
+     || fflush(cp->file) != 0 || sync_file(cp->file) != 0)
+  {
+    cp->failed = 1;
+  }
+}
+
+// reads the next record and unpacks it into raw. 0 at the end of the log
+// or at a record that was torn or damaged
+static int read_record(FILE* f, uint8_t* packed, uint8_t* raw)
+{
+  uint8_t header[RECORD_HEADER];
+  if(fread(header, 1, RECORD_HEADER, f) != RECORD_HEADER) return 0;
+  uint32_t n = get32(header);
+  uint32_t size = get32(header + 4);
+  if(n > PACKED_MAX || size < RAW_HEADER || size > RAW_MAX) return 0;
+  if(fread(packed, 1, n, f) != n || checksum(packed, n) != get32(header + 8)) return 0;
+  if(lz_unpack(packed, n, raw, RAW_MAX) != size) return 0;
+  size_t npages = get16(raw + RAW_HEADER - 2);
+  return npages <= LC3_PAGE_COUNT && size == RAW_HEADER + npages * (1 + 2 * LC3_PAGE_WORDS);
+}
+
+// reads the records up to last (all of them for -1) and applies them to
+// state when it is not NULL. returns how many were read, -1 when f is not
+// a log. *end is where the last one read ends.
+static long scan(FILE* f, uint8_t* packed, uint8_t* raw, long last, lc3_state* state, uint64_t* retired, long* end)
+{
+  char magic[MAGIC_SIZE];
+  if(fread(magic, 1, MAGIC_SIZE, f) != MAGIC_SIZE || memcmp(magic, LOG_MAGIC, MAGIC_SIZE) != 0) return -1;
+  long n = 0;
+  *end = MAGIC_SIZE;
+  while((last < 0 || n <= last) && read_record(f, packed, raw))
+  {
+    if(state) apply(raw, state, retired);
+    ++n;
+    *end = ftell(f);
+  }
+  return n;
+}
+
+static int start_log(FILE* f) // only an empty file becomes a log
+{
+  return fseek(f, 0, SEEK_END) == 0 && ftell(f) == 0 && fwrite(LOG_MAGIC, 1, MAGIC_SIZE, f) == MAGIC_SIZE;
+}
+
+
+/*============== WRITING ===============*/
+
+// copies the pages the vm wrote since the last checkpoint. the log's
+// last record is the base for them only when it came from this vm.
+static void stage(lc3_checkpoint* cp, lc3_vm* vm)
+{
+  staged* s = &cp->next;
+  uint8_t dirty[LC3_PAGE_COUNT];
+  lc3_dirty_pages(vm, LC3_DIRTY_CHECKPOINT, dirty);
+  if(cp->vm != vm)
+  {
+    memset(dirty, 1, sizeof(dirty));
+    cp->vm = vm;
+  }
+  s->retired = vm->retired;
+  memcpy(s->reg, vm->reg, sizeof(s->reg));
+  s->psr = vm->psr;
+  s->saved_usp = vm->saved_usp;
+  s->saved_ssp = vm->saved_ssp;
+  s->running = (uint16)vm->running;
+  s->npages = 0;
+  for(int p = 0; p < LC3_PAGE_COUNT; ++p)
+  {
+    if(!dirty[p]) continue;
+    s->page[s->npages] = (uint8_t)p;
+    memcpy(&s->words[s->npages * LC3_PAGE_WORDS], &vm->memory[p * LC3_PAGE_WORDS], LC3_PAGE_WORDS * sizeof(uint16));
+    ++s->npages;
+  }
+}
+
+#ifdef WRITER_THREAD
+static void* writer(void* arg)
+{
+  lc3_checkpoint* cp = arg;
+  pthread_mutex_lock(&cp->lock);
+  for(;;)
+  {
+    while(!cp->busy && !cp->quit)
+    {
+      pthread_cond_wait(&cp->work, &cp->lock);
+    }
+    if(!cp->busy) break;
+    pthread_mutex_unlock(&cp->lock);
+    write_staged(cp);
+    pthread_mutex_lock(&cp->lock);
+    cp->busy = 0;
+    pthread_cond_broadcast(&cp->done);
+  }
+  pthread_mutex_unlock(&cp->lock);
+  return NULL;
+}
+#endif
+
+lc3_checkpoint* lc3_checkpoint_open(const char* path)
+{
+  lc3_checkpoint* cp = calloc(1, sizeof(lc3_checkpoint));
+  if(!cp) return NULL;
+  cp->file = fopen(path, "r+b");
+  if(!cp->file) cp->file = fopen(path, "w+b");
+  long end = MAGIC_SIZE;
+  if(!cp->file
+     || (scan(cp->file, cp->packed, cp->raw, -1, NULL, NULL, &end) < 0 && !start_log(cp->file))
+     // drop a torn record left by a crash, it would hide everything appended after it
+     || fseek(cp->file, end, SEEK_SET) != 0 || truncate_file(cp->file, end) != 0)
+  {
+    if(cp->file) fclose(cp->file);
+    free(cp);
+    return NULL;
+  }
+#ifdef WRITER_THREAD
+  pthread_mutex_init(&cp->lock, NULL);
+  pthread_cond_init(&cp->work, NULL);
+  pthread_cond_init(&cp->done, NULL);
+  if(pthread_create(&cp->writer, NULL, writer, cp) != 0)
+  {
+    pthread_mutex_destroy(&cp->lock);
+    pthread_cond_destroy(&cp->work);
+    pthread_cond_destroy(&cp->done);
+    fclose(cp->file);
+    free(cp);
+    return NULL;
+  }
+#endif
+  return cp;
+}
+
+void lc3_checkpoint_close(lc3_checkpoint* cp)
+{
+  if(!cp) return;
+  lc3_checkpoint_wait(cp);
+#ifdef WRITER_THREAD
+  pthread_mutex_lock(&cp->lock);
+  cp->quit = 1;
+  pthread_cond_signal(&cp->work);
+  pthread_mutex_unlock(&cp->lock);
+  pthread_join(cp->writer, NULL);
+  pthread_mutex_destroy(&cp->lock);
+  pthread_cond_destroy(&cp->work);
+  pthread_cond_destroy(&cp->done);
+#endif
+  fclose(cp->file);
+  free(cp);
+}
+
+int lc3_checkpoint_take(lc3_checkpoint* cp, lc3_vm* vm)
+{
+#ifdef WRITER_THREAD
+  pthread_mutex_lock(&cp->lock);
+  int busy = cp->busy;
+  pthread_mutex_unlock(&cp->lock);
+  if(busy) return 0;
+  if(cp->failed) return -1;
+  stage(cp, vm);
+  pthread_mutex_lock(&cp->lock);
+  cp->busy = 1;
+  pthread_cond_signal(&cp->work);
+  pthread_mutex_unlock(&cp->lock);
+  return 1;
+#else
+  if(cp->failed) return -1;
+  stage(cp, vm);
+  write_staged(cp);
+  return cp->failed ? -1 : 1;
+#endif
+}
+
+int lc3_checkpoint_wait(lc3_checkpoint* cp)
+{
+#ifdef WRITER_THREAD
+  pthread_mutex_lock(&cp->lock);
+  while(cp->busy)
+  {
+    pthread_cond_wait(&cp->done, &cp->lock);
+  }
+  pthread_mutex_unlock(&cp->lock);
+#endif
+  return !cp->failed;
+}
+
+
+/*============== RESUMING ==============*/
+
+long lc3_checkpoint_count(const char* path)
+{
+  FILE* f = fopen(path, "rb");
+  uint8_t* buf = malloc(PACKED_MAX + RAW_MAX);
+  long end;
+  long n = f && buf ? scan(f, buf, buf + PACKED_MAX, -1, NULL, NULL, &end) : -1;
+  if(f) fclose(f);
+  free(buf);
+  return n;
+}
+
+long lc3_checkpoint_resume(lc3_vm* vm, const char* path, long index)
+{
+  FILE* f = fopen(path, "rb");
+  uint8_t* buf = malloc(PACKED_MAX + RAW_MAX);
+  lc3_state* state = calloc(1, sizeof(lc3_state));
+  uint64_t retired = 0;
+  long end;
+  long n = f && buf && state ? scan(f, buf, buf + PACKED_MAX, index, state, &retired, &end) : -1;
+  long resumed = -1;
+  if(n > 0 && (index < 0 || n == index + 1))
+  {
+    vm->retired = retired; // before lc3_restore() starts the timers
+    lc3_restore(vm, state);
+    resumed = n - 1;
+  }
+  if(f) fclose(f);
+  free(buf);
+  free(state);
+  return resumed;
+}
@@ -0,0 +1,43 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+/*
+  streaming checkpoints for long running guests.
+
+  a checkpoint log is one append-only file. every record holds the
+  registers, PSR and instruction count of the guest and only the memory
+  pages it wrote since the record before, compressed with a small LZ
+  coder. the first record a vm writes to a log, and the first after
+  lc3_restore() or a resume, holds every page.
+
+  taking one copies the dirty pages and the registers aside, which costs
+  the vm thread a few microseconds, and a writer thread compresses them,
+  appends them and syncs the file. a crash can only tear the last record,
+  which is dropped when the log is opened or read again.
+
+  resuming replays the records up to the one asked for onto an empty
+  memory. device timers restart from their period registers, pending
+  interrupts and the console are not part of a checkpoint.
+*/
+
+#include "lc3vm.h"
+
+typedef struct lc3_checkpoint lc3_checkpoint;
+
+// appends to path, creating it. NULL when it can't be opened or is not a log
+lc3_checkpoint* lc3_checkpoint_open(const char* path);
+void lc3_checkpoint_close(lc3_checkpoint* cp); // finishes the write in flight
+
+// call between two lc3_run(). 1 when the checkpoint was taken, 0 when the
+// previous one is still being written (nothing is lost, try again later),
+// -1 once a write failed.
+int lc3_checkpoint_take(lc3_checkpoint* cp, lc3_vm* vm);
+int lc3_checkpoint_wait(lc3_checkpoint* cp); // until the write in flight is on disk, 0 if it failed
+
+// checkpoints are numbered from 0 in the order they were taken
+long lc3_checkpoint_count(const char* path); // -1 when path is not a log
+// puts vm in the state of checkpoint index, -1 for the last one. returns
+// the index resumed, -1 when there is no such checkpoint.
+long lc3_checkpoint_resume(lc3_vm* vm, const char* path, long index);
+
+#endif
@@ -0,0 +1,329 @@
+#include "opcodes.h"
+#include "isa.h"
+
+/*
+  timers and the interrupt controller.
+
+  nothing here runs per instruction. lc3_run() ends every backend run at
+  the next event deadline and calls devices_tick() in between: that is
+  where timers expire, the keyboard is checked for guests that set
+  KBSR_IE, and interrupts are taken. a store to a device register ends
+  the run with STOP_DEVICE so the new setting counts from the next
+  instruction.
+
+  time is lc3_retired(), so a guest gets the same interrupts at the same
+  instructions on every backend and whatever the host's slice size.
+*/
+
+#define KBD_POLL (1 << 14) // instructions between keyboard checks while KBSR_IE is set
+#define KBD_PRIORITY 4
+
+
+/*============= EVENT HEAP =============*/
+
+static int earlier(const dev_event* a, const dev_event* b)
+{
+  return a->deadline < b->deadline || (a->deadline == b->deadline && a->source < b->source);
+}
+
+static void place(lc3_vm* vm, int i, dev_event e)
+{
+  vm->events[i] = e;
+  vm->event_pos[e.source] = i;
+}
+
+static void sift(lc3_vm* vm, int i) // moves events[i] up or down to where it belongs
+{
+  dev_event e = vm->events[i];
+  while(i > 0 && earlier(&e, &vm->events[(i - 1) / 2]))
+  {
+    place(vm, i, vm->events[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+  for(;;)
+  {
+    int c = 2 * i + 1;
+    if(c >= vm->nevents) break;
+    if(c + 1 < vm->nevents && earlier(&vm->events[c + 1], &vm->events[c])) ++c;
+    if(!earlier(&vm->events[c], &e)) break;
+    place(vm, i, vm->events[c]);
+    i = c;
+  }
+  place(vm, i, e);
+}
+
+static void schedule(lc3_vm* vm, int source, uint64_t deadline) // or move it
+{
+  int i = vm->event_pos[source];
+  if(i < 0) i = vm->nevents++;
+  vm->events[i] = (dev_event){ deadline, source };
+  sift(vm, i);
+}
+
+static void cancel(lc3_vm* vm, int source)
+{
+  int i = vm->event_pos[source];
+  if(i < 0) return;
+  vm->event_pos[source] = -1;
+  if(i != --vm->nevents)
+  {
+    vm->events[i] = vm->events[vm->nevents];
+    sift(vm, i);
+  }
+}
+
+
+/*============= INTERRUPTS =============*/
+
+static uint16* timer_control(lc3_vm* vm, int source)
+{
+  return &vm->memory[MR_TMCR + 2 * (source - DEV_TIMER)];
+}
+
+static int priority_of(lc3_vm* vm, int source)
+{
+  if(source == DEV_KBD) return KBD_PRIORITY;
+  return (*timer_control(vm, source) & TMCR_PRIORITY) >> 8;
+}
+
+static int level(const lc3_vm* vm)
+{
+  return (vm->psr & PSR_PRIORITY) >> 8;
+}
+
+static void push(lc3_vm* vm, uint16 val) // onto the supervisor stack
+{
+  uint16 sp = --vm->reg[R_R6];
+  vm->memory[sp] = val;
+  code_range_written(vm, sp, 1);
+  mark_dirty(vm, sp, 1);
+}
+
+// takes the most urgent pending interrupt if it outranks the running
+// code: switch to the supervisor stack, push PSR and PC, jump through
+// the vector table. 0 when none can be taken.
+static int take_interrupt(lc3_vm* vm)
+{
+  int best = -1;
+  int best_level = level(vm);
+  for(int s = 0; s < DEV_COUNT; ++s)
+  {
+    if((vm->pending >> s & 1) && priority_of(vm, s) > best_level)
+    {
+      best = s;
+      best_level = priority_of(vm, s);
+    }
+  }
+  if(best < 0) return 0;
+
+  vm->pending &= ~(1 << best);
+  uint16 psr = vm->psr | vm->reg[R_COND];
+  if(vm->psr & PSR_USER)
+  {
+    vm->saved_usp = vm->reg[R_R6];
+    vm->reg[R_R6] = vm->saved_ssp;
+  }
+  push(vm, psr);
+  push(vm, vm->reg[R_PC]);
+  vm->psr = best_level << 8; // supervisor mode
+  vm->reg[R_COND] = FL_ZRO;
+  uint16 vector = best == DEV_KBD ? INT_KBD : INT_TIMER + best - DEV_TIMER;
+  vm->reg[R_PC] = vm->memory[IVT_BASE + vector];
+  ++vm->stats.interrupts;
+  return 1;
+}
+
+void rti(lc3_vm* vm, uint16 instr)
+{
+  if(vm->psr & PSR_USER)
+  {
+    BAD(vm, instr); // privilege mode violation, stops the guest like any fault
+    return;
+  }
+  uint16 sp = vm->reg[R_R6];
+  vm->reg[R_PC] = mem_read(vm, sp);
+  uint16 psr = mem_read(vm, sp + 1);
+  vm->reg[R_R6] = sp + 2;
+  vm->psr = psr & (PSR_USER | PSR_PRIORITY);
+  vm->reg[R_COND] = psr & FL_NEG ? FL_NEG : psr & FL_POS ? FL_POS : FL_ZRO;
+  if(psr & PSR_USER)
+  {
+    vm->saved_ssp = vm->reg[R_R6];
+    vm->reg[R_R6] = vm->saved_usp;
+  }
+  if(vm->pending)
+  {
+    vm->stop = STOP_DEVICE; // one may outrank the level we are back at
+  }
+}
+
+static int can_interrupt(lc3_vm* vm, int source)
+{
+  uint16 enabled = source == DEV_KBD ? vm->memory[MR_KBSR] & KBSR_IE : *timer_control(vm, source) & TMCR_IE;
+  return enabled && priority_of(vm, source) > level(vm);
+}
+
+
+/*============== DEVICES ===============*/
+
+void devices_reset(lc3_vm* vm)
+{
+  vm->psr = PSR_USER;
+  vm->saved_usp = 0;
+  vm->saved_ssp = SSP_START;
+  vm->pending = 0;
+  vm->dev_written = 0;
+  vm->kbd_latched = 0;
+  vm->nevents = 0;
+  for(int s = 0; s < DEV_COUNT; ++s)
+  {
+    vm->event_pos[s] = -1;
+  }
+  for(int t = 0; t < TIMER_COUNT; ++t)
+  {
+    vm->timer_period[t] = 0;
+  }
+}
+
+void device_written(lc3_vm* vm, uint16 address)
+{
+  if(address == MR_KBSR)
+  {
+    int enabled = (vm->memory[MR_KBSR] & KBSR_IE) != 0;
+    if(enabled == (vm->event_pos[DEV_KBD] >= 0)) return; // polling guests write KBSR too
+  }
+  else if(address < MR_TMCR || address >= MR_TMCR + 2 * TIMER_COUNT)
+  {
+    return;
+  }
+  vm->dev_written |= 1u << (address - MR_KBSR);
+  vm->stop = STOP_DEVICE;
+}
+
+void devices_written(lc3_vm* vm)
+{
+  uint32_t written = vm->dev_written;
+  vm->dev_written = 0;
+  if(written & 1)
+  {
+    if(vm->memory[MR_KBSR] & KBSR_IE)
+    {
+      schedule(vm, DEV_KBD, vm->retired); // look right away
+    }
+    else
+    {
+      cancel(vm, DEV_KBD);
+      vm->pending &= ~(1 << DEV_KBD);
+    }
+  }
+  for(int t = 0; t < TIMER_COUNT; ++t)
+  {
+    int source = DEV_TIMER + t;
+    if(!(*timer_control(vm, source) & TMCR_IE))
+    {
+      vm->pending &= ~(1 << source);
+    }
+    if(written >> (MR_TMPR + 2 * t - MR_KBSR) & 1) // a new period restarts the timer
+    {
+      vm->timer_period[t] = vm->memory[MR_TMPR + 2 * t];
+      if(vm->timer_period[t]) schedule(vm, source, vm->retired + vm->timer_period[t]);
+      else cancel(vm, source);
+    }
+  }
+}
+
+void devices_deadlines(const lc3_vm* vm, uint64_t deadline[DEV_COUNT])
+{
+  for(int s = 0; s < DEV_COUNT; ++s)
+  {
+    deadline[s] = vm->event_pos[s] >= 0 ? vm->events[vm->event_pos[s]].deadline : UINT64_MAX;
+  }
+}
+
+void devices_set_deadlines(lc3_vm* vm, const uint64_t deadline[DEV_COUNT])
+{
+  for(int s = 0; s < DEV_COUNT; ++s)
+  {
+    if(deadline[s] == UINT64_MAX) cancel(vm, s);
+    else schedule(vm, s, deadline[s]);
+  }
+}
+
+// for a guest with KBSR_IE set. GETC/IN and KBSR reads still work as
+// before, but a key taken here waits in KBDR for the handler.
+static void poll_for_interrupt(lc3_vm* vm)
+{
+  if(vm->pending & 1 << DEV_KBD) return; // the last key was not taken yet
+  vm->kbd_latched = 0; // its handler had time to look at it
+  ++vm->stats.device_polls;
+  if(!vm->io.key_ready(vm->io.ctx)) return;
+  vm->memory[MR_KBSR] |= KBSR_READY;
+  vm->memory[MR_KBDR] = vm->io.getc(vm->io.ctx);
+  vm->dirty[MR_KBSR >> PAGE_SHIFT] = 0xFF;
+  vm->kbd_latched = 1;
+  vm->pending |= 1 << DEV_KBD;
+}
+
+static void fire(lc3_vm* vm, dev_event e)
+{
+  if(e.source == DEV_KBD)
+  {
+    schedule(vm, DEV_KBD, vm->retired + KBD_POLL);
+    poll_for_interrupt(vm);
+    return;
+  }
+  uint16* control = timer_control(vm, e.source);
+  *control |= TMCR_READY;
+  vm->dirty[MR_TMCR >> PAGE_SHIFT] = 0xFF;
+  if(*control & TMCR_IE) vm->pending |= 1 << e.source;
+  schedule(vm, e.source, e.deadline + vm->timer_period[e.source - DEV_TIMER]); // no drift
+}
+
+static int idle(lc3_vm* vm) // parked on a taken BR to itself
+{
+  uint16 instr = vm->memory[vm->reg[R_PC]];
+  return (instr >> 12) == OP_BR && (instr & 0x1FF) == 0x1FF && (FIELD_NZP(instr) & vm->reg[R_COND]);
+}
+
+// an idle guest only waits for an interrupt. spinning has no effect but
+// the instruction count, so jump straight to the next timer that can
+// interrupt it, or let the host wait for input when only the keyboard can.
+static void sleep_until_interrupt(lc3_vm* vm, uint64_t end)
+{
+  if(can_interrupt(vm, DEV_KBD))
+  {
+    poll_for_interrupt(vm);
+    if(take_interrupt(vm)) return;
+  }
+  uint64_t wake = UINT64_MAX;
+  for(int i = 0; i < vm->nevents; ++i)
+  {
+    const dev_event* e = &vm->events[i];
+    if(e->source != DEV_KBD && e->deadline < wake && can_interrupt(vm, e->source)) wake = e->deadline;
+  }
+  if(wake != UINT64_MAX)
+  {
+    vm->retired = wake < end ? wake : end;
+  }
+  else if(can_interrupt(vm, DEV_KBD))
+  {
+    vm->stop = LC3_STOP_INPUT;
+  }
+}
+
+uint64_t devices_tick(lc3_vm* vm, uint64_t end)
+{
+  while(vm->nevents && vm->events[0].deadline <= vm->retired)
+  {
+    fire(vm, vm->events[0]);
+  }
+  if(!(vm->pending && take_interrupt(vm)) && vm->nevents && idle(vm))
+  {
+    sleep_until_interrupt(vm, end);
+  }
+  if(vm->nevents && vm->events[0].deadline < end)
+  {
+    return vm->events[0].deadline;
+  }
+  return end;
+}
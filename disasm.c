@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include "disasm.h"
+#include "isa.h"
+
+// mnemonic and operand format for every variant, generated from isa.h
+#define INSN_INFO(name, op, b11, b5, fmt, mn) [V_##name] = { mn, fmt },
+static const struct
+{
+  const char* mnemonic;
+  uint8_t fmt;
+} insn_info[V_COUNT] =
+{
+  LC3_INSNS(INSN_INFO)
+};
+
+static const char* trap_name(uint16_t vect) // service routine aliases
+{
+  switch(vect)
+  {
+    case TRAP_GETC: return "GETC";
+    case TRAP_OUT: return "OUT";
+    case TRAP_PUTS: return "PUTS";
+    case TRAP_IN: return "IN";
+    case TRAP_PUTSP: return "PUTSP";
+    case TRAP_HALT: return "HALT";
+  }
+  return NULL;
+}
+
+int disassemble(uint16_t addr, uint16_t instr, char* buf, size_t size)
+{
+  uint8_t v = insn_variant[DECODE_KEY(instr)];
+  const char* mn = insn_info[v].mnemonic;
+  uint16_t next = addr + 1; // PC relative offsets count from the incremented PC
+
+  switch(insn_info[v].fmt)
+  {
+    case FMT_BR:
+      {
+        uint16_t nzp = FIELD_NZP(instr);
+        if(nzp == 0)
+        {
+          return snprintf(buf, size, "NOP");
+        }
+        return snprintf(buf, size, "BR%s%s%s x%04X",
+                        nzp & FL_NEG ? "n" : "", nzp & FL_ZRO ? "z" : "", nzp & FL_POS ? "p" : "",
+                        (uint16_t)(next + OFF9(instr)));
+      }
+    case FMT_RRR:
+      return snprintf(buf, size, "%s R%d, R%d, R%d", mn, FIELD_DR(instr), FIELD_SR1(instr), FIELD_SR2(instr));
+    case FMT_RRI:
+      return snprintf(buf, size, "%s R%d, R%d, #%d", mn, FIELD_DR(instr), FIELD_SR1(instr), (int16_t)IMM5(instr));
+    case FMT_RR:
+      return snprintf(buf, size, "%s R%d, R%d", mn, FIELD_DR(instr), FIELD_SR1(instr));
+    case FMT_RPC:
+      return snprintf(buf, size, "%s R%d, x%04X", mn, FIELD_DR(instr), (uint16_t)(next + OFF9(instr)));
+    case FMT_RRO:
+      return snprintf(buf, size, "%s R%d, R%d, #%d", mn, FIELD_DR(instr), FIELD_SR1(instr), (int16_t)OFF6(instr));
+    case FMT_BASE:
+      if(v == V_JMP && FIELD_SR1(instr) == R_R7)
+      {
+        return snprintf(buf, size, "RET");
+      }
+      return snprintf(buf, size, "%s R%d", mn, FIELD_SR1(instr));
+    case FMT_PC11:
+      return snprintf(buf, size, "%s x%04X", mn, (uint16_t)(next + OFF11(instr)));
+    case FMT_TRAP:
+      {
+        const char* name = trap_name(FIELD_TRAPVECT(instr));
+        if(name)
+        {
+          return snprintf(buf, size, "%s", name);
+        }
+        return snprintf(buf, size, "TRAP x%02X", FIELD_TRAPVECT(instr));
+      }
+    case FMT_NONE:
+    default:
+      if(v == V_RES)
+      {
+        return snprintf(buf, size, ".FILL x%04X", instr);
+      }
+      return snprintf(buf, size, "%s", mn);
+  }
+}
@@ -0,0 +1,12 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// writes the assembly text for the instruction at addr into buf.
+// PC relative operands are shown as absolute addresses.
+// returns the length snprintf would have written.
+int disassemble(uint16_t addr, uint16_t instr, char* buf, size_t size);
+
+#endif
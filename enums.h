@@ -1,8 +1,33 @@
+#ifndef ENUMS_H
+#define ENUMS_H
+
  enum
  {
   MR_KBSR = 0xFE00, // KEYBOARD STATUS REGISTER
-  MR_KBDR = 0xFE02 // KEYBOARD DATA REGISTER
+  MR_KBDR = 0xFE02, // KEYBOARD DATA REGISTER
+  MR_TMCR = 0xFE10, // TIMER CONTROL REGISTER, timer i at MR_TMCR + 2 * i
+  MR_TMPR = 0xFE11 // TIMER PERIOD REGISTER in instructions, 0 stops it. timer i at MR_TMPR + 2 * i
  };
+
+enum // device register bits
+{
+  KBSR_READY = 1 << 15, // a key is waiting in KBDR
+  KBSR_IE = 1 << 14, // keyboard interrupt enable
+  TMCR_READY = 1 << 15, // set every time the timer expires, the guest clears it
+  TMCR_IE = 1 << 14, // timer interrupt enable
+  TMCR_PRIORITY = 7 << 8 // priority of the timer interrupt, like the PSR
+};
+
+enum // interrupts
+{
+  TIMER_COUNT = 4,
+  INT_KBD = 0x80, // keyboard vector, priority 4
+  INT_TIMER = 0x81, // timer i uses INT_TIMER + i
+  IVT_BASE = 0x0100, // the handler of vector v starts at mem[IVT_BASE + v]
+  SSP_START = 0x3000, // supervisor stack, grows down
+  PSR_USER = 1 << 15, // PROCESSOR STATUS REGISTER, user mode
+  PSR_PRIORITY = 7 << 8 // current priority level, N/Z/P live in R_COND
+};
 enum  // registers
   {
     R_R0 = 0,
@@ -28,7 +53,7 @@ enum   // opcodes
     OP_AND,  // BITWISE AND
     OP_LDR,  // LOAD REGISTER
     OP_STR,  // STORE REGISTER
-    OP_RTI,  // UNUSED
+    OP_RTI,  // RETURN FROM INTERRUPT
     OP_NOT,  // BITWISE NOT
     OP_LDI,  //LOAD INDIRECT
     OP_STI,  // STORE INDIRECT
@@ -54,9 +79,17 @@ enum // TRAP CODES ENUM
   TRAP_PUTS = 0x22,  // OUTPUT A WORD STRING
   TRAP_IN = 0x23, // get character from keyboard, echoed to the terminal
   TRAP_PUTSP = 0x24, // output a byte string
-  TRAP_HALT = 0x25 // halt the program
+  TRAP_HALT = 0x25, // halt the program
+
+  // extended traps, only present after lc3_enable_ext_traps()
+  TRAP_MUL = 0x26, // R0 = low word of R0 * R1, R1 = high word (signed)
+  TRAP_DIV = 0x27, // R0 = R0 / R1, R1 = R0 % R1 (signed, truncating)
+  TRAP_MEMCPY = 0x28, // copy R2 words from [R1] to [R0], overlap safe
+  TRAP_MEMSET = 0x29, // fill R2 words at [R0] with R1
+  TRAP_MEMCMP = 0x2A // compare R2 words at [R0] and [R1], R0 = -1, 0 or 1
 };
 
  enum
  {PC_START = 0x3000}; // R_PC starting position
 
+#endif
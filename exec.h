@@ -0,0 +1,156 @@
+#ifndef EXEC_H
+#define EXEC_H
+
+/*
+  instruction bodies, one per variant in isa.h. every backend is built
+  from these: opcodes.c wraps them into the handler table and the switch
+  backend in lc3vm.c inlines them into its cases.
+*/
+
+#include <stdlib.h>
+#include "opcodes.h"
+#include "isa.h"
+
+// ADD
+static inline void exec_ADD_REG(lc3_vm* vm, uint16 instr)
+{
+  uint16 r0 = FIELD_DR(instr);
+  vm->reg[r0] = vm->reg[FIELD_SR1(instr)] + vm->reg[FIELD_SR2(instr)];
+  update_flags(vm, r0);
+}
+
+static inline void exec_ADD_IMM(lc3_vm* vm, uint16 instr)
+{
+  uint16 r0 = FIELD_DR(instr);
+  vm->reg[r0] = vm->reg[FIELD_SR1(instr)] + IMM5(instr);
+  update_flags(vm, r0);
+}
+
+// bitwise AND
+static inline void exec_AND_REG(lc3_vm* vm, uint16 instr)
+{
+  uint16 r0 = FIELD_DR(instr);
+  vm->reg[r0] = vm->reg[FIELD_SR1(instr)] & vm->reg[FIELD_SR2(instr)];
+  update_flags(vm, r0);
+}
+
+static inline void exec_AND_IMM(lc3_vm* vm, uint16 instr)
+{
+  uint16 r0 = FIELD_DR(instr);
+  vm->reg[r0] = vm->reg[FIELD_SR1(instr)] & IMM5(instr);
+  update_flags(vm, r0);
+}
+
+// bitwise not - flips the each bit
+static inline void exec_NOT(lc3_vm* vm, uint16 instr)
+{
+  uint16 r0 = FIELD_DR(instr);
+  vm->reg[r0] = ~vm->reg[FIELD_SR1(instr)];
+  update_flags(vm, r0);
+}
+
+// branch
+static inline void exec_BR(lc3_vm* vm, uint16 instr)
+{
+  if(FIELD_NZP(instr) & vm->reg[R_COND])
+  {
+    vm->reg[R_PC] += OFF9(instr);
+  }
+}
+
+// jump, this also handles RET => return from a register
+static inline void exec_JMP(lc3_vm* vm, uint16 instr)
+{
+  vm->reg[R_PC] = vm->reg[FIELD_SR1(instr)];
+}
+
+// JSR => Jump to the SUBROUTINE and save return address in R7
+static inline void exec_JSR(lc3_vm* vm, uint16 instr)
+{
+  vm->reg[R_R7] = vm->reg[R_PC];
+  vm->reg[R_PC] += OFF11(instr);
+}
+
+// JSRR =>  Jump to the address in register R1 and save return address in R7
+static inline void exec_JSRR(lc3_vm* vm, uint16 instr)
+{
+  uint16 target = vm->reg[FIELD_SR1(instr)]; // read before R7 is written, JSRR R7 is legal
+  vm->reg[R_R7] = vm->reg[R_PC];
+  vm->reg[R_PC] = target;
+}
+
+// load => loads the data from a given address
+static inline void exec_LD(lc3_vm* vm, uint16 instr)
+{
+  uint16 r0 = FIELD_DR(instr);
+  vm->reg[r0] = mem_read(vm, vm->reg[R_PC] + OFF9(instr));
+  update_flags(vm, r0);
+}
+
+// load indirect, look at PC + offset to get the final address
+static inline void exec_LDI(lc3_vm* vm, uint16 instr)
+{
+  uint16 r0 = FIELD_DR(instr);
+  vm->reg[r0] = mem_read(vm, mem_read(vm, vm->reg[R_PC] + OFF9(instr)));
+  update_flags(vm, r0);
+}
+
+// load register
+static inline void exec_LDR(lc3_vm* vm, uint16 instr)
+{
+  uint16 r0 = FIELD_DR(instr);
+  vm->reg[r0] = mem_read(vm, vm->reg[FIELD_SR1(instr)] + OFF6(instr));
+  update_flags(vm, r0);
+}
+
+// LEA => load effective address
+static inline void exec_LEA(lc3_vm* vm, uint16 instr)
+{
+  uint16 r0 = FIELD_DR(instr);
+  vm->reg[r0] = vm->reg[R_PC] + OFF9(instr);
+  update_flags(vm, r0);
+}
+
+// store
+static inline void exec_ST(lc3_vm* vm, uint16 instr)
+{
+  mem_write(vm, vm->reg[R_PC] + OFF9(instr), vm->reg[FIELD_DR(instr)]);
+}
+
+// Store indirect
+static inline void exec_STI(lc3_vm* vm, uint16 instr)
+{
+  mem_write(vm, mem_read(vm, vm->reg[R_PC] + OFF9(instr)), vm->reg[FIELD_DR(instr)]);
+}
+
+// store register
+static inline void exec_STR(lc3_vm* vm, uint16 instr)
+{
+  mem_write(vm, vm->reg[FIELD_SR1(instr)] + OFF6(instr), vm->reg[FIELD_DR(instr)]);
+}
+
+// trap, dispatched through the vm's vector table
+static inline void exec_TRAP(lc3_vm* vm, uint16 instr)
+{
+  vm->reg[R_R7] = vm->reg[R_PC];
+  trap_fn fn = vm->traps[FIELD_TRAPVECT(instr)];
+  if(fn)
+  {
+    fn(vm);
+  }
+  count_trap(vm, FIELD_TRAPVECT(instr));
+}
+
+// return from interrupt, see devices.c
+static inline void exec_RTI(lc3_vm* vm, uint16 instr)
+{
+  rti(vm, instr);
+}
+
+// unused opcode
+static inline void exec_RES(lc3_vm* vm, uint16 instr)
+{
+  BAD(vm, instr);
+}
+
+#endif
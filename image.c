@@ -0,0 +1,88 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "image.h"
+#include "opcodes.h"
+#include "arena.h"
+
+#define IMAGE_BYTES (MEMORY_MAX * sizeof(uint16))
+
+struct lc3_image
+{
+  int fd; // memfd holding the loaded memory
+};
+
+lc3_image* lc3_image_load(const char* const image_paths[], int count)
+{
+  int fd = memfd_create("lc3-image", MFD_CLOEXEC);
+  if(fd < 0) return NULL;
+  if(ftruncate(fd, IMAGE_BYTES) != 0)
+  {
+    close(fd);
+    return NULL;
+  }
+  uint16* memory = mmap(NULL, IMAGE_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(memory == MAP_FAILED)
+  {
+    close(fd);
+    return NULL;
+  }
+
+  int ok = 1;
+  for(int j = 0; j < count && ok; ++j)
+  {
+    FILE* file = fopen(image_paths[j], "rb");
+    if(!file)
+    {
+      ok = 0;
+      break;
+    }
+    load_image_words(memory, file);
+    fclose(file);
+  }
+  munmap(memory, IMAGE_BYTES);
+
+  lc3_image* img = ok ? malloc(sizeof(lc3_image)) : NULL;
+  if(!img)
+  {
+    close(fd);
+    return NULL;
+  }
+  img->fd = fd;
+  return img;
+}
+
+void lc3_image_free(lc3_image* img)
+{
+  if(!img) return;
+  close(img->fd); // existing private mappings keep the pages alive
+  free(img);
+}
+
+static void unmap_memory(uint16* memory)
+{
+  munmap(memory, IMAGE_BYTES);
+}
+
+lc3_vm* lc3_create_from_image(const lc3_image* img)
+{
+  uint16* memory = mmap(NULL, IMAGE_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE, img->fd, 0);
+  if(memory == MAP_FAILED) return NULL;
+  lc3_vm* vm = vm_new(memory, unmap_memory);
+  if(!vm) unmap_memory(memory);
+  return vm;
+}
+
+lc3_vm* lc3_create_from_image_huge(const lc3_image* img)
+{
+  uint16* memory = arena_alloc();
+  if(!memory) return NULL;
+  lc3_vm* vm = NULL;
+  if(pread(img->fd, memory, IMAGE_BYTES, 0) == IMAGE_BYTES)
+  {
+    vm = vm_new(memory, arena_free);
+  }
+  if(!vm) arena_free(memory);
+  return vm;
+}
@@ -0,0 +1,25 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+/*
+  a memory image loaded once and shared copy-on-write by any number of
+  vms (linux). booting a guest from it is one private mapping instead of
+  reading and byte swapping the .obj files again, and pages the guest
+  never writes stay shared with every other guest.
+*/
+
+#include "lc3vm.h"
+
+typedef struct lc3_image lc3_image;
+
+lc3_image* lc3_image_load(const char* const image_paths[], int count); // NULL if a file can't be read
+void lc3_image_free(lc3_image* img); // vms created from it stay valid
+
+lc3_vm* lc3_create_from_image(const lc3_image* img); // like lc3_create() plus the images loaded
+
+// same, but the guest gets a private copy in the huge page arena (arena.h)
+// instead of a copy-on-write mapping: 128KB more per guest, and no page
+// faults or TLB misses spread over 32 small pages.
+lc3_vm* lc3_create_from_image_huge(const lc3_image* img);
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef ISA_H
+#define ISA_H
+
+#include <stdint.h>
+#include "enums.h"
+
+/*
+  the lc-3 instruction set, described once.
+
+  every row is one instruction variant: the opcode plus the value of
+  bit 11 (JSR vs JSRR) and bit 5 (register vs immediate for ADD/AND)
+  that selects it, ANY when the bit does not matter. the interpreter
+  dispatch tables and the disassembler are generated from this list.
+
+  X(name, opcode, bit11, bit5, format, mnemonic)
+*/
+#define ANY 2
+
+#define LC3_INSNS(X) \
+  X(BR,      OP_BR,   ANY, ANY, FMT_BR,   "BR")   \
+  X(ADD_REG, OP_ADD,  ANY, 0,   FMT_RRR,  "ADD")  \
+  X(ADD_IMM, OP_ADD,  ANY, 1,   FMT_RRI,  "ADD")  \
+  X(LD,      OP_LD,   ANY, ANY, FMT_RPC,  "LD")   \
+  X(ST,      OP_ST,   ANY, ANY, FMT_RPC,  "ST")   \
+  X(JSRR,    OP_JSR,  0,   ANY, FMT_BASE, "JSRR") \
+  X(JSR,     OP_JSR,  1,   ANY, FMT_PC11, "JSR")  \
+  X(AND_REG, OP_AND,  ANY, 0,   FMT_RRR,  "AND")  \
+  X(AND_IMM, OP_AND,  ANY, 1,   FMT_RRI,  "AND")  \
+  X(LDR,     OP_LDR,  ANY, ANY, FMT_RRO,  "LDR")  \
+  X(STR,     OP_STR,  ANY, ANY, FMT_RRO,  "STR")  \
+  X(RTI,     OP_RTI,  ANY, ANY, FMT_NONE, "RTI")  \
+  X(NOT,     OP_NOT,  ANY, ANY, FMT_RR,   "NOT")  \
+  X(LDI,     OP_LDI,  ANY, ANY, FMT_RPC,  "LDI")  \
+  X(STI,     OP_STI,  ANY, ANY, FMT_RPC,  "STI")  \
+  X(JMP,     OP_JMP,  ANY, ANY, FMT_BASE, "JMP")  \
+  X(RES,     OP_RES,  ANY, ANY, FMT_NONE, ".FILL") \
+  X(LEA,     OP_LEA,  ANY, ANY, FMT_RPC,  "LEA")  \
+  X(TRAP,    OP_TRAP, ANY, ANY, FMT_TRAP, "TRAP")
+
+enum // operand formats, used by the disassembler
+{
+  FMT_NONE, // no operands
+  FMT_BR,   // nzp, PCoffset9
+  FMT_RRR,  // DR, SR1, SR2
+  FMT_RRI,  // DR, SR1, imm5
+  FMT_RR,   // DR, SR
+  FMT_RPC,  // DR/SR, PCoffset9
+  FMT_RRO,  // DR/SR, BaseR, offset6
+  FMT_BASE, // BaseR
+  FMT_PC11, // PCoffset11
+  FMT_TRAP  // trapvect8
+};
+
+#define LC3_VARIANT_ENUM(name, op, b11, b5, fmt, mn) V_##name,
+enum // one id per instruction variant
+{
+  LC3_INSNS(LC3_VARIANT_ENUM)
+  V_COUNT
+};
+
+/*======== DECODING ===========*/
+
+// the dispatch key is the opcode plus the two variant selecting bits
+#define KEY_COUNT 64
+#define DECODE_KEY(i) ((((i) >> 10) & 0x3E) | (((i) >> 5) & 0x1))
+#define MAKE_KEY(op, b11, b5) (((op) << 2) | ((b11) << 1) | (b5))
+
+// a fixed bit covers one key value, ANY covers both
+#define KEY_LO(b) ((b) == 1)
+#define KEY_HI(b) ((b) != 0)
+
+// designated initializers for every key a variant covers. rows with ANY bits
+// name the same slot more than once with the same value, which is harmless.
+#define LC3_KEY_INIT(op, b11, b5, val) \
+  [MAKE_KEY(op, KEY_LO(b11), KEY_LO(b5))] = (val), \
+  [MAKE_KEY(op, KEY_HI(b11), KEY_LO(b5))] = (val), \
+  [MAKE_KEY(op, KEY_LO(b11), KEY_HI(b5))] = (val), \
+  [MAKE_KEY(op, KEY_HI(b11), KEY_HI(b5))] = (val),
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+#endif
+
+#define LC3_VARIANT_KEY(name, op, b11, b5, fmt, mn) LC3_KEY_INIT(op, b11, b5, V_##name)
+static const uint8_t insn_variant[KEY_COUNT] = // dispatch key -> variant id
+{
+  LC3_INSNS(LC3_VARIANT_KEY)
+};
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+// field extraction, every width is a compile time constant
+#define FIELD_DR(i)  (((i) >> 9) & 0x7)
+#define FIELD_SR1(i) (((i) >> 6) & 0x7)
+#define FIELD_SR2(i) ((i) & 0x7)
+#define FIELD_NZP(i) (((i) >> 9) & 0x7)
+#define FIELD_TRAPVECT(i) ((i) & 0xFF)
+
+#define SEXT(i, bits) ((uint16_t)((int16_t)((uint16_t)((i) << (16 - (bits)))) >> (16 - (bits))))
+#define IMM5(i)  SEXT(i, 5)
+#define OFF6(i)  SEXT(i, 6)
+#define OFF9(i)  SEXT(i, 9)
+#define OFF11(i) SEXT(i, 11)
+
+#endif
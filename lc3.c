@@ -1,95 +1,273 @@
-// gcc main.c opcodes.c -o program
+// gcc lc3.c lc3vm.c opcodes.c screen.c blocks.c profile.c tail.c arena.c devices.c stats.c check.c disasm.c checkpoint.c -o program -lpthread
 #include <stdlib.h>
+#include <string.h>
 #include "enums.h"
-#include "opcodes.h"
+#include "lc3vm.h"
+#include "screen.h"
+#include "stats.h"
+#include "check.h"
+#include "checkpoint.h"
 
+#ifdef WIN32
+#include "windows.h"
+#elif defined(__linux__)
+#include "linux.h"
+#endif
 
-#define MEMORY_MAX (1<<16)
-uint16 memory[MEMORY_MAX];
-uint16 reg[R_COUNT];
+
+#define SLICE (1 << 20) // instructions between checks for ctrl-c
+#define CHECK_EVERY (1 << 16) // default instructions between --check comparisons
+#define CHECKPOINT_EVERY (1 << 26) // default instructions between --checkpoint records
+
+static volatile sig_atomic_t interrupted;
+
+void handle_interrupt(int signal)
+{
+    interrupted = 1; // the run loop saves the profile and exits
+}
+
+static void usage()
+{
+    printf("lc3 [--ext-traps] [--backend=switch|table|block|tail] [--screen] [--profile] [--quota=N] [--stats=file] [--check=backend] [--check-every=N] [--checkpoint=file] [--checkpoint-every=N] [--resume[=N]] [image-file1] ...\n");
+    exit(2);
+}
 
 int main (int argc, const char* argv[])
 {
-   if(argc<2)
+   lc3_vm* vm = lc3_create();
+   if(!vm)
       {
-        // show usage string
-        printf("lc3 [image-file1] ...\n");
-        exit(2);
+        printf("out of memory\n");
+        exit(1);
+      }
 
+   lc3_screen* screen = NULL;
+   int profile = 0;
+   const char* stats_path = NULL;
+   const char* check_backend = NULL;
+   uint64_t check_every = CHECK_EVERY;
+   uint64_t quota = 0;
+   int ext_traps = 0;
+   const char* checkpoint_path = NULL;
+   uint64_t checkpoint_every = CHECKPOINT_EVERY;
+   long resume = -2; // checkpoint to start from, -1 for the last one
+   int j = 1;
+   for(; j<argc && strncmp(argv[j], "--", 2) == 0; ++j)
+      {
+        if(strcmp(argv[j], "--ext-traps") == 0)
+          {
+            // opt in to the host accelerated TRAP vectors
+            lc3_enable_ext_traps(vm);
+            ext_traps = 1;
+          }
+        else if(strncmp(argv[j], "--backend=", 10) == 0)
+          {
+            if(!lc3_set_backend(vm, lc3_backend_by_name(argv[j] + 10)))
+              {
+                printf("unknown backend: %s\n", argv[j] + 10);
+                exit(2);
+              }
+          }
+        else if(strcmp(argv[j], "--screen") == 0 && !screen)
+          {
+            // only send the cells that changed between key polls
+            lc3_io term;
+            lc3_get_io(vm, &term);
+            screen = lc3_screen_create(80, 24, &term);
+            lc3_io io = lc3_screen_io(screen);
+            lc3_set_io(vm, &io);
+          }
+        else if(strcmp(argv[j], "--profile") == 0)
+          {
+            // keep <last image>.prof and start from it next time
+            profile = 1;
+          }
+        else if(strncmp(argv[j], "--quota=", 8) == 0)
+          {
+            // stop after this many guest instructions
+            quota = strtoull(argv[j] + 8, NULL, 10);
+            lc3_set_quota(vm, quota);
+          }
+        else if(strncmp(argv[j], "--stats=", 8) == 0)
+          {
+            // prometheus text dump of the counters on exit
+            stats_path = argv[j] + 8;
+          }
+        else if(strncmp(argv[j], "--check=", 8) == 0)
+          {
+            // run a second vm on this backend in lockstep and stop where they differ
+            check_backend = argv[j] + 8;
+          }
+        else if(strncmp(argv[j], "--check-every=", 14) == 0)
+          {
+            check_every = strtoull(argv[j] + 14, NULL, 10);
+          }
+        else if(strncmp(argv[j], "--checkpoint=", 13) == 0)
+          {
+            // append the pages written since the last record to this log every so often
+            checkpoint_path = argv[j] + 13;
+          }
+        else if(strncmp(argv[j], "--checkpoint-every=", 19) == 0)
+          {
+            checkpoint_every = strtoull(argv[j] + 19, NULL, 10);
+          }
+        else if(strcmp(argv[j], "--resume") == 0)
+          {
+            // start from the last checkpoint in the log instead of PC_START
+            resume = -1;
+          }
+        else if(strncmp(argv[j], "--resume=", 9) == 0)
+          {
+            resume = strtol(argv[j] + 9, NULL, 10);
+          }
+        else
+          {
+            usage();
+          }
       }
 
-    for(int j = 1; j<argc;++j)
+   if((j>=argc && (resume == -2 || profile)) || (resume != -2 && !checkpoint_path))
       {
-        if(!read_image(argv[j]))
+        // show usage string
+        usage();
+      }
+
+    for(; j<argc;++j)
+      {
+        if(!lc3_load_image(vm, argv[j]))
           {
             printf("failed to load image: %s\n", argv[j]);
             exit(1);
           }
       }
 
+    if(resume != -2 && lc3_checkpoint_resume(vm, checkpoint_path, resume) < 0)
+      {
+        printf("no checkpoint to resume from in %s\n", checkpoint_path);
+        exit(1);
+      }
+    lc3_checkpoint* checkpoint = NULL;
+    uint64_t next_checkpoint = lc3_retired(vm);
+    if(checkpoint_path && !(checkpoint = lc3_checkpoint_open(checkpoint_path)))
+      {
+        printf("can't open checkpoint log: %s\n", checkpoint_path);
+        exit(1);
+      }
+
+    lc3_vm* cand = NULL;
+    lc3_check* check = NULL;
+    if(check_backend)
+      {
+        cand = lc3_create();
+        lc3_state* state = malloc(sizeof(lc3_state));
+        if(!cand || !state)
+          {
+            printf("out of memory\n");
+            exit(1);
+          }
+        if(!lc3_set_backend(cand, lc3_backend_by_name(check_backend)))
+          {
+            printf("unknown backend: %s\n", check_backend);
+            exit(2);
+          }
+        if(ext_traps) lc3_enable_ext_traps(cand);
+        lc3_set_quota(cand, quota);
+        lc3_snapshot(vm, state);
+        lc3_restore(cand, state);
+        free(state);
+        check = lc3_check_create(vm, cand, check_every);
+        if(!check)
+          {
+            printf("out of memory\n");
+            exit(1);
+          }
+      }
+
+    char* profile_path = NULL;
+    if(profile)
+      {
+        const char* image = argv[argc - 1];
+        profile_path = malloc(strlen(image) + 6);
+        if(profile_path)
+          {
+            strcpy(profile_path, image);
+            strcat(profile_path, ".prof");
+            lc3_profile_start(vm, profile_path);
+          }
+      }
+
     //setup
     signal(SIGINT, handle_interrupt);
     disable_input_buffering();
 
-    reg[R_COND] = FL_ZRO;  // set the Z flag
-    reg[R_PC] = PC_START;  // 0x3000 is the default starting position
-
-    int running = 1;
-    while(running)
+    int stop = LC3_STOP_BUDGET;
+    lc3_divergence divergence;
+    while(!interrupted)
       {
-        uint16 instr = mem_read(reg[R_PC]++); // fetch instruction
-        uint16 op = instr>>12;
-        switch(op)
-              {
-              case OP_ADD:
-                ADD(instr);
-                break;
-              case OP_AND:
-                AND(instr);
-                break;
-              case OP_NOT:
-                NOT(instr);
-                break;
-              case OP_BR:
-                BR(instr);
-                break;
-              case OP_JMP:
-                JMP(instr);
-                break;
-              case OP_JSR:
-                JSR(instr);
-                break;
-              case OP_LD:
-                LD(instr);
-                break;
-              case OP_LDI:
-                LDI(instr);
-                break;
-              case OP_LDR:
-                LDR(instr);
-                break;
-              case OP_LEA:
-                LEA(instr);
-                break;
-              case OP_ST:
-                ST(instr);
-                break;
-              case OP_STI:
-                STI(instr);
-                break;
-              case OP_STR:
-                STR(instr);
-                break;
-              case OP_TRAP:
-                TRAP(instr, &running);
-                break;
-              case OP_RES:
-              case OP_RTI:
-              default:
-                BAD();
-                break;
-              }
+        stop = check ? lc3_check_run(check, SLICE, &divergence) : lc3_run(vm, SLICE);
+        if(checkpoint && (stop == LC3_STOP_BUDGET || stop == LC3_STOP_INPUT) && lc3_retired(vm) >= next_checkpoint)
+          {
+            // 0 while the last one is still being written, then try after the next slice
+            int taken = lc3_checkpoint_take(checkpoint, vm);
+            if(taken > 0) next_checkpoint = lc3_retired(vm) + checkpoint_every;
+            else if(taken < 0) next_checkpoint = UINT64_MAX; // the log is broken, keep running without
+          }
+        if(stop == LC3_STOP_INPUT)
+          {
+            wait_key(); // the guest is parked on GETC/IN
+          }
+        else if(stop != LC3_STOP_BUDGET)
+          {
+            break;
+          }
+      }
+    if(!interrupted && stop == LC3_STOP_FAULT)
+      {
+        printf("bad opcode at x%04X\n", lc3_get_reg(vm, R_PC));
+      }
+    else if(!interrupted && stop == LC3_STOP_QUOTA)
+      {
+        printf("\ninstruction quota reached at x%04X\n", lc3_get_reg(vm, R_PC));
+      }
+    else if(!interrupted && stop == LC3_CHECK_DIVERGED)
+      {
+        printf("\n");
+        lc3_divergence_print(stdout, &divergence);
       }
       // shutdown
+      if(checkpoint && interrupted)
+        {
+          // ctrl-c keeps the progress since the last checkpoint
+          lc3_checkpoint_wait(checkpoint);
+          lc3_checkpoint_take(checkpoint, vm);
+        }
+      lc3_checkpoint_close(checkpoint);
+      if(screen) lc3_screen_flush(screen);
       restore_input_buffering();
-}
\ No newline at end of file
+      if(profile_path) lc3_profile_save(vm, profile_path);
+      free(profile_path);
+      if(stats_path)
+        {
+          lc3_stats stats;
+          lc3_get_stats(vm, &stats);
+          FILE* out = fopen(stats_path, "w");
+          if(out)
+            {
+              lc3_stats_write(out, &stats, NULL, 1);
+              fclose(out);
+            }
+        }
+      if(interrupted)
+        {
+          printf("\n");
+          exit(-2);
+        }
+      lc3_check_free(check);
+      lc3_destroy(cand);
+      lc3_destroy(vm);
+      lc3_screen_free(screen);
+      if(stop == LC3_CHECK_DIVERGED)
+        {
+          exit(3);
+        }
+}
@@ -0,0 +1,98 @@
+// gcc lc3as.c asm.c asmopt.c -o lc3as
+/*
+  lc3as: assembles and links lc-3 assembly modules into one .obj image
+  for the loader, see asm.h for the source format.
+
+  the program is optimized unless -O0 is given (asmopt.c): flag tests
+  nobody reads are dropped, constants are built the shortest way,
+  branches to branches go straight to the end of the chain, hot
+  subroutines are moved within JSR reach of their callers and strings
+  only printed with PUTS are packed for PUTSP.
+
+  next to the image goes a sidecar with every label and the source line
+  of every word (rogue.sym for rogue.obj), unless --no-sym.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "asm.h"
+
+static void usage()
+{
+  printf("lc3as [-O0] [-o out.obj] [--no-sym] [--stats] file1.asm ...\n");
+  exit(2);
+}
+
+static char* with_extension(const char* path, const char* ext) // malloc()ed
+{
+  const char* slash = strrchr(path, '/');
+  const char* dot = strrchr(path, '.');
+  size_t len = dot && (!slash || dot > slash) ? (size_t)(dot - path) : strlen(path);
+  char* out = malloc(len + strlen(ext) + 1);
+  if(!out)
+  {
+    printf("out of memory\n");
+    exit(1);
+  }
+  memcpy(out, path, len);
+  strcpy(out + len, ext);
+  return out;
+}
+
+static void print_stats(const lc3_asm_stats* s)
+{
+  printf("%u words\n", s->words);
+  printf("%u flag tests dropped\n", s->flags);
+  printf("%u constants shortened\n", s->constants);
+  printf("%u branches threaded\n", s->branches);
+  printf("%u subroutines moved\n", s->moved);
+  printf("%u far calls\n", s->far_calls);
+  printf("%u strings packed\n", s->strings);
+}
+
+int main(int argc, const char* argv[])
+{
+  int optimize = 1;
+  int symbols = 1;
+  int stats = 0;
+  const char* out = NULL;
+  int j = 1;
+  for(; j < argc && argv[j][0] == '-'; ++j)
+  {
+    if(strcmp(argv[j], "-O0") == 0) optimize = 0;
+    else if(strcmp(argv[j], "-O") == 0) optimize = 1;
+    else if(strcmp(argv[j], "-o") == 0 && j + 1 < argc) out = argv[++j];
+    else if(strcmp(argv[j], "--no-sym") == 0) symbols = 0;
+    else if(strcmp(argv[j], "--stats") == 0) stats = 1;
+    else usage();
+  }
+  if(j >= argc) usage();
+
+  lc3_asm* as = lc3_asm_create();
+  if(!as)
+  {
+    printf("out of memory\n");
+    exit(1);
+  }
+  for(int k = j; k < argc; ++k)
+  {
+    lc3_asm_file(as, argv[k]); // goes on to report the errors of every module
+  }
+  if(!lc3_asm_link(as, optimize)) exit(1);
+
+  char* obj = with_extension(out ? out : argv[j], ".obj");
+  char* sym = symbols ? with_extension(obj, ".sym") : NULL;
+  if(out)
+  {
+    free(obj);
+    obj = malloc(strlen(out) + 1);
+    if(!obj) exit(1);
+    strcpy(obj, out);
+  }
+  int ok = lc3_asm_write(as, obj, sym);
+  if(ok && stats) print_stats(&as->stats);
+  free(obj);
+  free(sym);
+  lc3_asm_free(as);
+  return ok ? 0 : 1;
+}
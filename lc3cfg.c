@@ -0,0 +1,168 @@
+// gcc lc3cfg.c cfg.c disasm.c lc3vm.c opcodes.c blocks.c profile.c tail.c arena.c devices.c -o lc3cfg
+/*
+  lc3cfg: annotated listing of an image from the static analysis in cfg.h.
+
+  code is printed by basic block with its successors and loop, data as
+  .FILL and the strings passed to PUTS as .STRINGZ. the loops, keyboard
+  polling loops and self-modifying stores are summed up at the end.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "enums.h"
+#include "lc3vm.h"
+#include "cfg.h"
+#include "disasm.h"
+
+#define MAX_ENTRIES 64
+
+static void usage()
+{
+  printf("lc3cfg [--entry=x3000] ... image-file1 ...\n");
+  exit(2);
+}
+
+static void print_block(const lc3_cfg* cfg, int b)
+{
+  const lc3_cfg_block* blk = &cfg->blocks[b];
+  printf("\n; block %d", b);
+  for(int i = 0; i < 2; ++i)
+  {
+    if(blk->succ[i] >= 0) printf(" %s x%04X", i ? "next" : "goto", cfg->blocks[blk->succ[i]].start);
+  }
+  if(blk->flags & LC3_CFG_B_CALL)
+  {
+    if(blk->flags & LC3_CFG_B_INDIRECT) printf(" call ?");
+    else printf(" call x%04X", blk->call);
+  }
+  else if(blk->flags & LC3_CFG_B_INDIRECT) printf(" goto ?");
+  if(blk->loop >= 0) printf(" loop %d", blk->loop);
+  if(blk->flags & LC3_CFG_B_ENTRY) printf(" entry");
+  if(blk->flags & LC3_CFG_B_RETURN) printf(" return");
+  if(blk->flags & LC3_CFG_B_HALT) printf(" halt");
+  if(blk->flags & LC3_CFG_B_FAULT) printf(" fault");
+  printf("\n");
+}
+
+static uint32_t print_string(const lc3_cfg* cfg, const uint16_t* memory, uint32_t a)
+{
+  printf("x%04X        .STRINGZ \"", a);
+  for(; a < LC3_MEMORY_WORDS && cfg->kind[a] == LC3_CFG_STRING && memory[a] && memory[a] <= 0xFF; ++a)
+  {
+    int c = memory[a];
+    if(c == '\n') printf("\\n");
+    else if(c == '"' || c == '\\') printf("\\%c", c);
+    else if(c < 0x20 || c > 0x7E) printf("\\x%02X", c);
+    else putchar(c);
+  }
+  printf("\"\n");
+  return a < LC3_MEMORY_WORDS && cfg->kind[a] == LC3_CFG_STRING && !memory[a] ? a + 1 : a;
+}
+
+static void print_listing(const lc3_cfg* cfg, const uint16_t* memory)
+{
+  int gap = 0;
+  for(uint32_t a = 0; a < LC3_MEMORY_WORDS; )
+  {
+    uint8_t kind = cfg->kind[a];
+    uint16_t flags = cfg->flags[a];
+    if(kind == LC3_CFG_UNKNOWN)
+    {
+      gap = 1;
+      ++a;
+      continue;
+    }
+    if(gap) printf("\n");
+    gap = 0;
+
+    if(kind == LC3_CFG_STRING && memory[a] <= 0xFF)
+    {
+      a = print_string(cfg, memory, a);
+      continue;
+    }
+    if(kind == LC3_CFG_CODE && cfg->blocks[cfg->block_of[a]].start == a)
+    {
+      print_block(cfg, cfg->block_of[a]);
+    }
+    char text[64];
+    if(kind == LC3_CFG_CODE) disassemble(a, memory[a], text, sizeof(text));
+    else snprintf(text, sizeof(text), ".FILL x%04X", memory[a]);
+    char note[96] = "";
+    if(flags & LC3_CFG_W_KBSR) strcat(note, " ; polls KBSR");
+    if(flags & LC3_CFG_W_KBDR) strcat(note, " ; reads KBDR");
+    if(flags & LC3_CFG_W_SMC) strcat(note, " ; writes code");
+    if(flags & LC3_CFG_W_PATCHED) strcat(note, " ; patched");
+    if(flags & LC3_CFG_W_POINTER) strcat(note, " ; pointer");
+    printf(*note ? "x%04X  %04X  %-24s%s\n" : "x%04X  %04X  %s%s\n", a, memory[a], text, note);
+    ++a;
+  }
+}
+
+static void print_summary(const lc3_cfg* cfg)
+{
+  int polls = 0;
+  for(int l = 0; l < cfg->nloops; ++l)
+  {
+    if(cfg->loops[l].flags & LC3_CFG_L_POLL) ++polls;
+  }
+  printf("\n; %d blocks, %d loops, %d keyboard polling loops, %d self-modifying stores, %d stores to unknown addresses\n",
+         cfg->nblocks, cfg->nloops, polls, cfg->nsmc, cfg->wild_stores);
+  for(int l = 0; l < cfg->nloops; ++l)
+  {
+    const lc3_cfg_loop* loop = &cfg->loops[l];
+    printf("; loop %d at x%04X, depth %d, %d blocks", l, cfg->blocks[loop->header].start, loop->depth, loop->size);
+    if(loop->parent >= 0) printf(", inside loop %d", loop->parent);
+    if(loop->flags & LC3_CFG_L_IDLE) printf(", idle keyboard poll");
+    else if(loop->flags & LC3_CFG_L_POLL) printf(", keyboard poll");
+    printf("\n");
+  }
+  for(int i = 0; i < cfg->nsmc; ++i)
+  {
+    printf("; store at x%04X writes code at x%04X\n", cfg->smc[i].store, cfg->smc[i].target);
+  }
+}
+
+int main(int argc, const char* argv[])
+{
+  uint16_t entries[MAX_ENTRIES];
+  int count = 0;
+  int j = 1;
+  for(; j < argc && strncmp(argv[j], "--", 2) == 0; ++j)
+  {
+    if(strncmp(argv[j], "--entry=", 8) == 0 && count < MAX_ENTRIES)
+    {
+      const char* s = argv[j] + 8;
+      entries[count++] = (uint16_t)strtoul(s + (*s == 'x' || *s == 'X'), NULL, 16);
+    }
+    else usage();
+  }
+  if(j >= argc) usage();
+
+  lc3_vm* vm = lc3_create();
+  if(!vm)
+  {
+    printf("out of memory\n");
+    exit(1);
+  }
+  for(; j < argc; ++j)
+  {
+    if(!lc3_load_image(vm, argv[j]))
+    {
+      printf("failed to load image: %s\n", argv[j]);
+      exit(1);
+    }
+  }
+
+  const uint16_t* memory = lc3_memory(vm);
+  lc3_cfg* cfg = lc3_cfg_build(memory, entries, count);
+  if(!cfg)
+  {
+    printf("out of memory\n");
+    exit(1);
+  }
+  print_listing(cfg, memory);
+  print_summary(cfg);
+  lc3_cfg_free(cfg);
+  lc3_destroy(vm);
+  return 0;
+}
@@ -0,0 +1,695 @@
+// gcc lc3d.c lc3vm.c opcodes.c blocks.c profile.c tail.c arena.c devices.c sched.c image.c screen.c stats.c migrate.c -o lc3d -lpthread
+/*
+  lc3d: hosts one guest per connection on a unix domain socket.
+
+  every guest boots copy-on-write from the same loaded image and runs on
+  the shared scheduler. the connection is the guest's console: bytes read
+  from it feed GETC/IN and KBSR/KBDR, and everything the guest prints is
+  collected and sent once per scheduler turn instead of once per OUT.
+
+  --huge-pages copies the image into huge page backed memory for every
+  session instead of mapping it copy-on-write, see arena.h.
+  --quota=N ends a session after N guest instructions. --metrics=PATH
+  serves the per-worker counters in prometheus text format on a second
+  socket, one dump per connection.
+
+  --handoff=PATH moves sessions between lc3d processes for a deploy:
+  start the new lc3d with the same arguments (it takes over the socket
+  paths), then send SIGUSR1 to the old one. that stops accepting and
+  migrates every guest to the new process in pre-copy rounds, see
+  migrate.h, together with its console buffers and the client connection
+  itself, then exits once all are gone. clients don't notice.
+
+  play with: socat -,raw,echo=0 UNIX-CONNECT:/tmp/lc3d.sock
+*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include "lc3vm.h"
+#include "image.h"
+#include "migrate.h"
+#include "lc3sched.h"
+#include "screen.h"
+#include "stats.h"
+
+#define IN_MAX 256         // bytes read from the socket at a time
+#define OUT_FLUSH (16<<10) // send early once this much output is queued
+#define OUT_MAX (1<<20)    // drop clients that stop reading
+#define HANDOFF_PAGES 8    // a pre-copy round this small is followed by the stop-and-copy
+#define HANDOFF_ROUNDS 16  // for guests that write pages faster than they can be sent
+#define HANDOFF_TIMEOUT 2  // seconds a worker waits for the other process to take the stream
+
+typedef struct session
+{
+  int fd;
+  int closed; // peer hung up, or stopped reading
+  unsigned char in[IN_MAX];
+  size_t in_head;
+  size_t in_len;
+  char* out;
+  size_t out_len;
+  size_t out_cap;
+  lc3_screen* screen; // --screen, sits between the guest and the socket
+  lc3_migration* migration; // being handed over, see hand_over()
+  int handoff_fd;
+  int rounds;
+  int stuck; // the handoff failed, the guest stays here
+  int migrated; // runs in the other process now, the connection is its
+} session;
+
+static const char* socket_path;
+static const char* metrics_path;
+static const char* handoff_path;
+static int live_sessions;
+static int ext_traps;
+static int use_screen;
+static uint64_t quota;
+static volatile sig_atomic_t drain_requested; // SIGUSR1
+static int draining; // the handoff listener is closed, sessions may leave
+
+
+/*========== SOCKET CONSOLE ============*/
+
+static void fill_input(session* s) // non-blocking read into the input buffer
+{
+  if(s->closed) return;
+  ssize_t n = recv(s->fd, s->in, IN_MAX, MSG_DONTWAIT);
+  if(n > 0)
+  {
+    s->in_head = 0;
+    s->in_len = n;
+  }
+  else if(n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+  {
+    s->closed = 1;
+  }
+}
+
+static void send_output(session* s) // whatever the socket takes now, the rest waits for the next turn
+{
+  size_t sent = 0;
+  while(sent < s->out_len && !s->closed)
+  {
+    ssize_t n = send(s->fd, s->out + sent, s->out_len - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if(n > 0)
+    {
+      sent += n;
+    }
+    else if(n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    else
+    {
+      if(errno != EAGAIN && errno != EWOULDBLOCK) s->closed = 1;
+      break;
+    }
+  }
+  memmove(s->out, s->out + sent, s->out_len - sent);
+  s->out_len -= sent;
+  if(s->out_len > OUT_MAX)
+  {
+    s->closed = 1;
+  }
+}
+
+static int sock_key_ready(void* ctx)
+{
+  session* s = ctx;
+  if(!s->in_len)
+  {
+    fill_input(s);
+  }
+  return s->in_len || s->closed; // a closed peer reads as end of input
+}
+
+static int sock_getc(void* ctx)
+{
+  session* s = ctx;
+  if(!sock_key_ready(s) || !s->in_len)
+  {
+    return -1;
+  }
+  --s->in_len;
+  return s->in[s->in_head++];
+}
+
+static void sock_write(void* ctx, const char* buf, size_t n)
+{
+  session* s = ctx;
+  if(s->out_len + n > s->out_cap)
+  {
+    size_t cap = s->out_cap ? s->out_cap : 4096;
+    while(cap < s->out_len + n) cap *= 2;
+    char* out = realloc(s->out, cap);
+    if(!out)
+    {
+      s->closed = 1;
+      return;
+    }
+    s->out = out;
+    s->out_cap = cap;
+  }
+  memcpy(s->out + s->out_len, buf, n);
+  s->out_len += n;
+}
+
+static void sock_flush(void* ctx)
+{
+  session* s = ctx;
+  if(s->out_len >= OUT_FLUSH)
+  {
+    send_output(s);
+  }
+}
+
+
+/*============== SESSIONS ==============*/
+
+static int hand_over(lc3_vm* vm, int reason, session* s);
+
+static void session_yield(lc3_vm* vm, int reason, void* ctx)
+{
+  session* s = ctx;
+  if(__atomic_load_n(&draining, __ATOMIC_RELAXED) && !s->stuck && !s->closed && hand_over(vm, reason, s))
+  {
+    lc3_halt(vm); // it runs in the other process now
+    return;
+  }
+  if(s->screen) lc3_screen_flush(s->screen);
+  send_output(s); // one batched write per turn
+  if(s->closed)
+  {
+    lc3_halt(vm);
+  }
+}
+
+static void session_exit(lc3_vm* vm, int reason, void* ctx)
+{
+  session* s = ctx;
+  if(!s->migrated)
+  {
+    if(s->screen) lc3_screen_flush(s->screen);
+    send_output(s);
+  }
+  lc3_migrate_abort(s->migration);
+  if(s->migration) close(s->handoff_fd);
+  close(s->fd);
+  lc3_screen_free(s->screen);
+  free(s->out);
+  free(s);
+  lc3_destroy(vm);
+  __atomic_sub_fetch(&live_sessions, 1, __ATOMIC_RELAXED);
+}
+
+// wires the guest to its connection, through its screen if it has one, and
+// queues it. on failure the session is torn down like on exit.
+static void session_start(lc3_sched* sched, lc3_vm* vm, session* s)
+{
+  lc3_io io = { sock_getc, sock_key_ready, sock_write, sock_flush, s };
+  if(s->screen) io = lc3_screen_io(s->screen);
+  lc3_set_io(vm, &io);
+  if(ext_traps) lc3_enable_ext_traps(vm);
+  lc3_set_quota(vm, quota);
+  __atomic_add_fetch(&live_sessions, 1, __ATOMIC_RELAXED);
+  if(!lc3_sched_add(sched, vm, s->fd, session_exit, s))
+  {
+    session_exit(vm, LC3_STOP_HALT, s);
+  }
+}
+
+
+/*============== HANDOFF ===============*/
+
+typedef struct // the console state that goes along with a guest
+{
+  uint32_t in_len; // read from the client, not yet by the guest
+  uint32_t out_len; // not sent to the client yet
+  uint32_t screen_len; // lc3_screen_save(), 0 without --screen
+} console_header;
+
+static int connect_unix(const char* path) // -1 on failure
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(strlen(path) >= sizeof(addr.sun_path)) return -1;
+  strcpy(addr.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int send_fd(int sock, int fd) // with one byte of data, SCM_RIGHTS needs some
+{
+  char byte = 0;
+  struct iovec iov = { &byte, 1 };
+  union { struct cmsghdr align; char buf[CMSG_SPACE(sizeof(int))]; } control;
+  memset(&control, 0, sizeof(control));
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(c), &fd, sizeof(int));
+  return sendmsg(sock, &msg, MSG_NOSIGNAL) == 1;
+}
+
+static int recv_fd(int sock) // -1 on failure
+{
+  char byte;
+  struct iovec iov = { &byte, 1 };
+  union { struct cmsghdr align; char buf[CMSG_SPACE(sizeof(int))]; } control;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  if(recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1) return -1;
+  struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+  if(!c || c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS || c->cmsg_len != CMSG_LEN(sizeof(int))) return -1;
+  int fd;
+  memcpy(&fd, CMSG_DATA(c), sizeof(int));
+  return fd;
+}
+
+static char* pack_console(session* s, size_t* n)
+{
+  console_header h = { (uint32_t)s->in_len, 0, 0 };
+  char* screen = NULL;
+  if(s->screen)
+  {
+    // saving flushes the screen into the output, so it goes first
+    h.screen_len = (uint32_t)lc3_screen_save(s->screen, NULL, 0);
+    screen = malloc(h.screen_len);
+    if(!screen) return NULL;
+    lc3_screen_save(s->screen, screen, h.screen_len);
+  }
+  h.out_len = (uint32_t)s->out_len;
+  *n = sizeof(h) + h.in_len + h.out_len + h.screen_len;
+  char* buf = malloc(*n);
+  if(buf)
+  {
+    char* p = buf;
+    memcpy(p, &h, sizeof(h));
+    memcpy(p += sizeof(h), s->in + s->in_head, h.in_len);
+    p += h.in_len;
+    // out and screen are NULL while empty, memcpy() must not see that
+    if(h.out_len) memcpy(p, s->out, h.out_len);
+    if(h.screen_len) memcpy(p + h.out_len, screen, h.screen_len);
+  }
+  free(screen);
+  return buf;
+}
+
+// one pre-copy round per turn while the guest keeps running. once a round
+// is small, or the guest waits for input anyway, the stop-and-copy sends
+// the rest with the console and the client connection. 1 once the other
+// process has taken the guest over.
+static int hand_over(lc3_vm* vm, int reason, session* s)
+{
+  if(reason != LC3_STOP_BUDGET && reason != LC3_STOP_INPUT) return 0;
+  if(!s->migration)
+  {
+    struct timeval timeout = { HANDOFF_TIMEOUT, 0 };
+    int fd = connect_unix(handoff_path);
+    // no receive timeout: the ack is the only thing read, and once the
+    // client fd is sent only the ack or the receiver closing may decide
+    // who runs the guest, a timeout could leave it running in both
+    if(fd < 0
+       || setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) != 0
+       || !(s->migration = lc3_migrate_start(vm, fd)))
+    {
+      if(fd >= 0) close(fd);
+      s->stuck = 1;
+      return 0;
+    }
+    s->handoff_fd = fd;
+  }
+
+  int sent = lc3_migrate_round(s->migration, vm);
+  if(sent >= 0 && reason == LC3_STOP_BUDGET && sent > HANDOFF_PAGES && ++s->rounds < HANDOFF_ROUNDS)
+  {
+    return 0; // let it run another turn
+  }
+  size_t n = 0;
+  char* console = sent >= 0 ? pack_console(s, &n) : NULL;
+  lc3_migration* m = s->migration;
+  s->migration = NULL; // finish frees it
+  char ack;
+  int ok = console && lc3_migrate_finish(m, vm, console, n) && send_fd(s->handoff_fd, s->fd);
+  if(ok)
+  {
+    ssize_t got;
+    while((got = recv(s->handoff_fd, &ack, 1, 0)) < 0 && errno == EINTR)
+    {
+    }
+    ok = got == 1;
+  }
+  if(!console) lc3_migrate_abort(m);
+  free(console);
+  close(s->handoff_fd);
+  if(!ok)
+  {
+    s->stuck = 1; // keep running it here
+    return 0;
+  }
+  s->migrated = 1;
+  return 1;
+}
+
+typedef struct
+{
+  int listener;
+  lc3_sched* sched;
+} handoff_server;
+
+typedef struct
+{
+  handoff_server* server;
+  int fd;
+} handoff_conn;
+
+// builds the session from what the old process sent along with the guest
+static session* unpack_console(const char* buf, size_t n, int fd)
+{
+  console_header h;
+  if(n < sizeof(h)) return NULL;
+  memcpy(&h, buf, sizeof(h));
+  if(h.in_len > IN_MAX || n != sizeof(h) + (size_t)h.in_len + h.out_len + h.screen_len) return NULL;
+  session* s = calloc(1, sizeof(session));
+  if(!s) return NULL;
+  s->fd = fd;
+  const char* p = buf + sizeof(h);
+  memcpy(s->in, p, h.in_len);
+  s->in_len = h.in_len;
+  p += h.in_len;
+  if(h.out_len) sock_write(s, p, h.out_len);
+  p += h.out_len;
+  lc3_io io = { sock_getc, sock_key_ready, sock_write, sock_flush, s };
+  if(h.screen_len && !(s->screen = lc3_screen_load(p, h.screen_len, &io)))
+  {
+    free(s->out);
+    free(s);
+    return NULL;
+  }
+  return s;
+}
+
+static void* receive_guest(void* arg) // its rounds come in over several turns of the sender
+{
+  handoff_conn* c = arg;
+  void* console = NULL;
+  size_t n = 0;
+  lc3_vm* vm = lc3_migrate_receive(c->fd, &console, &n);
+  int client = vm ? recv_fd(c->fd) : -1;
+  session* s = client >= 0 ? unpack_console(console, n, client) : NULL;
+  char ack = 1;
+  if(s && send(c->fd, &ack, 1, MSG_NOSIGNAL) == 1)
+  {
+    session_start(c->server->sched, vm, s);
+  }
+  else
+  {
+    // the sender keeps running the guest
+    if(s)
+    {
+      lc3_screen_free(s->screen);
+      free(s->out);
+      free(s);
+    }
+    if(client >= 0) close(client);
+    lc3_destroy(vm);
+  }
+  free(console);
+  close(c->fd);
+  free(c);
+  return NULL;
+}
+
+static void* serve_handoff(void* arg)
+{
+  handoff_server* h = arg;
+  for(;;)
+  {
+    int fd = accept4(h->listener, NULL, NULL, SOCK_CLOEXEC);
+    if(fd < 0)
+    {
+      if(errno == EINTR || errno == ECONNABORTED) continue;
+      return NULL; // shut down by the drain
+    }
+    handoff_conn* c = malloc(sizeof(handoff_conn));
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if(!c || (c->server = h, c->fd = fd, pthread_create(&thread, &attr, receive_guest, c) != 0))
+    {
+      free(c);
+      close(fd);
+    }
+    pthread_attr_destroy(&attr);
+  }
+}
+
+
+/*============== METRICS ===============*/
+
+static void write_metrics(FILE* out, lc3_sched* sched)
+{
+  int n = lc3_sched_workers(sched);
+  lc3_stats* sets = calloc(n, sizeof(lc3_stats));
+  char (*labels)[24] = calloc(n, sizeof(*labels));
+  const char** label_ptrs = calloc(n, sizeof(char*));
+  if(sets && labels && label_ptrs)
+  {
+    for(int i = 0; i < n; ++i)
+    {
+      lc3_sched_stats(sched, i, &sets[i]);
+      snprintf(labels[i], sizeof(labels[i]), "worker=\"%d\"", i);
+      label_ptrs[i] = labels[i];
+    }
+    lc3_stats_write(out, sets, label_ptrs, n);
+  }
+  fprintf(out, "# HELP lc3d_sessions Guests currently connected.\n# TYPE lc3d_sessions gauge\n");
+  fprintf(out, "lc3d_sessions %d\n", __atomic_load_n(&live_sessions, __ATOMIC_RELAXED));
+  free(sets);
+  free(labels);
+  free(label_ptrs);
+}
+
+typedef struct
+{
+  int listener;
+  lc3_sched* sched;
+} metrics_server;
+
+static void* serve_metrics(void* arg) // one dump per connection, then close
+{
+  metrics_server* m = arg;
+  for(;;)
+  {
+    int fd = accept4(m->listener, NULL, NULL, SOCK_CLOEXEC);
+    if(fd < 0)
+    {
+      if(errno == EINTR || errno == ECONNABORTED) continue;
+      return NULL;
+    }
+    FILE* out = fdopen(fd, "w");
+    if(!out)
+    {
+      close(fd);
+      continue;
+    }
+    write_metrics(out, m->sched);
+    fclose(out);
+  }
+}
+
+
+/*================ MAIN ================*/
+
+static int listen_unix(const char* path) // -1 on failure
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(strlen(path) >= sizeof(addr.sun_path))
+  {
+    printf("socket path too long: %s\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  unlink(path);
+  if(fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 128) != 0)
+  {
+    perror("lc3d");
+    if(fd >= 0) close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void handle_interrupt(int signal)
+{
+  unlink(socket_path);
+  if(metrics_path) unlink(metrics_path);
+  _exit(0);
+}
+
+static void handle_drain(int signal)
+{
+  drain_requested = 1; // ppoll() returns EINTR, the main loop does the rest
+}
+
+static void usage()
+{
+  printf("lc3d [--workers=N] [--ext-traps] [--screen] [--huge-pages] [--quota=N] [--metrics=path] [--handoff=path] socket-path image-file1 ...\n");
+  exit(2);
+}
+
+int main(int argc, const char* argv[])
+{
+  int workers = 4;
+  int huge_pages = 0;
+  int j = 1;
+  for(; j < argc && strncmp(argv[j], "--", 2) == 0; ++j)
+  {
+    if(strncmp(argv[j], "--workers=", 10) == 0) workers = atoi(argv[j] + 10);
+    else if(strcmp(argv[j], "--ext-traps") == 0) ext_traps = 1;
+    else if(strcmp(argv[j], "--screen") == 0) use_screen = 1;
+    else if(strcmp(argv[j], "--huge-pages") == 0) huge_pages = 1;
+    else if(strncmp(argv[j], "--quota=", 8) == 0) quota = strtoull(argv[j] + 8, NULL, 10);
+    else if(strncmp(argv[j], "--metrics=", 10) == 0) metrics_path = argv[j] + 10;
+    else if(strncmp(argv[j], "--handoff=", 10) == 0) handoff_path = argv[j] + 10;
+    else usage();
+  }
+  if(argc - j < 2) usage();
+  socket_path = argv[j++];
+
+  lc3_image* img = lc3_image_load(argv + j, argc - j);
+  if(!img)
+  {
+    printf("failed to load images\n");
+    exit(1);
+  }
+
+  int listener = listen_unix(socket_path);
+  if(listener < 0)
+  {
+    exit(1);
+  }
+
+  // with --handoff SIGUSR1 is blocked in every thread, the ones started
+  // below inherit that, and only let in while the accept loop waits in
+  // ppoll(). taken anywhere else it would not wake that loop
+  sigset_t usr1, accept_mask;
+  sigemptyset(&usr1);
+  sigaddset(&usr1, SIGUSR1);
+  pthread_sigmask(handoff_path ? SIG_BLOCK : SIG_UNBLOCK, &usr1, &accept_mask);
+  fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK); // a client gone between ppoll() and accept4()
+
+  lc3_sched* sched = lc3_sched_create(workers, 1 << 16);
+  if(!sched)
+  {
+    printf("failed to start scheduler\n");
+    exit(1);
+  }
+  lc3_sched_on_yield(sched, session_yield);
+
+  metrics_server metrics = { -1, sched };
+  pthread_t metrics_thread;
+  if(metrics_path)
+  {
+    if((metrics.listener = listen_unix(metrics_path)) < 0) exit(1);
+    pthread_create(&metrics_thread, NULL, serve_metrics, &metrics);
+  }
+  handoff_server handoff = { -1, sched };
+  pthread_t handoff_thread;
+  if(handoff_path)
+  {
+    if((handoff.listener = listen_unix(handoff_path)) < 0) exit(1);
+    pthread_create(&handoff_thread, NULL, serve_handoff, &handoff);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_drain; // no SA_RESTART, ppoll() has to return
+    sigaction(SIGUSR1, &sa, NULL);
+  }
+  signal(SIGINT, handle_interrupt);
+  signal(SIGTERM, handle_interrupt);
+  signal(SIGPIPE, SIG_IGN); // a handoff peer may go away mid-write
+
+  for(;;)
+  {
+    struct pollfd pfd = { listener, POLLIN, 0 };
+    if(ppoll(&pfd, 1, NULL, &accept_mask) < 0)
+    {
+      if(drain_requested) break;
+      if(errno == EINTR) continue;
+      perror("poll");
+      break;
+    }
+    int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+    if(fd < 0)
+    {
+      if(errno == EINTR || errno == ECONNABORTED || errno == EAGAIN) continue;
+      perror("accept");
+      break;
+    }
+
+    session* s = calloc(1, sizeof(session));
+    lc3_vm* vm = !s ? NULL : huge_pages ? lc3_create_from_image_huge(img) : lc3_create_from_image(img);
+    if(!vm)
+    {
+      free(s);
+      close(fd);
+      continue;
+    }
+    s->fd = fd;
+    lc3_io io = { sock_getc, sock_key_ready, sock_write, sock_flush, s };
+    if(use_screen) s->screen = lc3_screen_create(80, 24, &io);
+    session_start(sched, vm, s);
+  }
+
+  if(drain_requested)
+  {
+    // the socket paths belong to the new process by now, leave them be.
+    // our own handoff listener goes first so no guest comes back here.
+    close(listener);
+    shutdown(handoff.listener, SHUT_RDWR);
+    pthread_join(handoff_thread, NULL);
+    __atomic_store_n(&draining, 1, __ATOMIC_RELAXED);
+    lc3_sched_wake_all(sched); // guests waiting for input leave on their next turn
+    lc3_sched_wait(sched); // the ones that could not be handed over end here
+    return 0;
+  }
+
+  lc3_sched_destroy(sched);
+  lc3_image_free(img);
+  close(listener);
+  unlink(socket_path);
+  if(metrics_path) unlink(metrics_path);
+  return 1;
+}
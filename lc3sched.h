@@ -0,0 +1,46 @@
+#ifndef LC3SCHED_H
+#define LC3SCHED_H
+
+/*
+  runs many guests on a few worker threads (linux, epoll + pthreads).
+
+  a guest is only ever a suspended lc3_vm: when lc3_run() stops on
+  LC3_STOP_INPUT the worker parks it on its input fd and picks up the next
+  runnable guest. when the fd becomes readable the guest is queued again
+  and resumed by whichever worker is free, so a guest blocked in GETC/IN
+  never holds a thread.
+
+  a guest that runs out of its lc3_set_quota() exits with LC3_STOP_QUOTA.
+*/
+
+#include <stdint.h>
+#include "lc3vm.h"
+
+typedef struct lc3_sched lc3_sched;
+
+// called on a worker thread once the guest halts or faults. the vm is no
+// longer referenced by the scheduler afterwards and may be destroyed.
+typedef void (*lc3_exit_fn)(lc3_vm* vm, int reason, void* ctx);
+
+// called on the worker after every turn, with the guest's ctx. the guest
+// is exclusively owned by the caller here, lc3_halt() retires it.
+typedef void (*lc3_yield_fn)(lc3_vm* vm, int reason, void* ctx);
+
+lc3_sched* lc3_sched_create(int workers, uint64_t slice); // slice: instructions per turn
+void lc3_sched_destroy(lc3_sched* s); // stops the workers, guests still queued are dropped
+
+// input_fd is what the guest's console reads from, it is polled for EPOLLIN
+// while the guest waits on GETC/IN. returns 0 on failure.
+int lc3_sched_add(lc3_sched* s, lc3_vm* vm, int input_fd, lc3_exit_fn on_exit, void* ctx);
+void lc3_sched_wait(lc3_sched* s); // blocks until every added guest has exited
+// gives every guest parked on input a turn right away. lc3_run() stops on
+// GETC/IN again at once, but the yield hook sees it, e.g. to migrate it.
+void lc3_sched_wake_all(lc3_sched* s);
+void lc3_sched_on_yield(lc3_sched* s, lc3_yield_fn fn); // set before adding guests
+
+// guest work done on one worker thread so far, exited guests included.
+// each worker only ever writes its own counters, any thread may read them.
+int lc3_sched_workers(const lc3_sched* s);
+void lc3_sched_stats(lc3_sched* s, int worker, lc3_stats* out);
+
+#endif
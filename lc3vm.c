@@ -0,0 +1,402 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lc3vm.h"
+#include "opcodes.h"
+#include "isa.h"
+#include "exec.h"
+#include "blocks.h"
+#include "arena.h"
+
+#ifdef WIN32
+#include <Windows.h>
+#include <conio.h>
+#else
+#include <sys/select.h>
+#include <unistd.h>
+#endif
+
+
+/*========== DEFAULT CONSOLE ===========*/
+// stdin/stdout, the terminal mode itself is left to the front-end
+
+int lc3_stdin_ready()
+{
+#ifdef WIN32
+  return WaitForSingleObject(GetStdHandle(STD_INPUT_HANDLE), 1000) == WAIT_OBJECT_0 && _kbhit();
+#else
+  fd_set readfds;
+  FD_ZERO(&readfds);
+  FD_SET(STDIN_FILENO, &readfds);
+  struct timeval timeout = { 0, 0 };
+  return select(1, &readfds, NULL, NULL, &timeout) > 0;
+#endif
+}
+
+static int stdio_getc(void* ctx)
+{
+  (void)ctx;
+  return getchar();
+}
+
+static int stdio_key_ready(void* ctx)
+{
+  (void)ctx;
+  return lc3_stdin_ready();
+}
+
+static void stdio_write(void* ctx, const char* buf, size_t n)
+{
+  (void)ctx;
+  fwrite(buf, 1, n, stdout);
+}
+
+static void stdio_flush(void* ctx)
+{
+  (void)ctx;
+  fflush(stdout);
+}
+
+static const lc3_io stdio_console = { stdio_getc, stdio_key_ready, stdio_write, stdio_flush, NULL };
+
+
+/*============= BACKENDS ===============*/
+
+typedef uint64_t (*backend_fn)(lc3_vm* vm, uint64_t max_instructions);
+
+// every handler inlined into one switch over the variant id
+uint64_t run_switch(lc3_vm* vm, uint64_t max_instructions)
+{
+#define SWITCH_CASE(name, op, b11, b5, fmt, mn) \
+  case V_##name: exec_##name(vm, instr); break;
+
+  uint64_t n = 0;
+  while(!vm->stop && n < max_instructions)
+  {
+    uint16 instr = mem_fetch(vm, vm->reg[R_PC]++); // fetch instruction
+    switch(insn_variant[DECODE_KEY(instr)])
+    {
+      LC3_INSNS(SWITCH_CASE)
+    }
+    ++n;
+  }
+  return n;
+#undef SWITCH_CASE
+}
+
+// indirect call through the handler table in opcodes.c
+static uint64_t run_table(lc3_vm* vm, uint64_t max_instructions)
+{
+  uint64_t n = 0;
+  while(!vm->stop && n < max_instructions)
+  {
+    uint16 instr = mem_fetch(vm, vm->reg[R_PC]++); // fetch instruction
+    insn_table[DECODE_KEY(instr)](vm, instr); // decode and execute
+    ++n;
+  }
+  return n;
+}
+
+static const struct
+{
+  const char* name;
+  backend_fn run;
+} backends[LC3_BACKEND_COUNT] =
+{
+  [LC3_BACKEND_SWITCH] = { "switch", run_switch },
+  [LC3_BACKEND_TABLE] = { "table", run_table },
+  [LC3_BACKEND_BLOCK] = { "block", run_blocks },
+  [LC3_BACKEND_TAIL] = { "tail", run_tail }
+};
+
+
+/*============== LIFETIME ==============*/
+
+#ifdef WIN32
+#define vm_alloc() _aligned_malloc(sizeof(lc3_vm), _Alignof(lc3_vm))
+#define vm_free _aligned_free
+#else
+#define vm_alloc() aligned_alloc(_Alignof(lc3_vm), sizeof(lc3_vm))
+#define vm_free free
+#endif
+
+lc3_vm* lc3_create()
+{
+  uint16* memory = arena_alloc(); // 65536 LOCATIONS IN RAM
+  if(!memory) return NULL;
+  lc3_vm* vm = vm_new(memory, arena_free);
+  if(!vm) arena_free(memory);
+  return vm;
+}
+
+lc3_vm* vm_new(uint16* memory, void (*free_memory)(uint16* memory))
+{
+  lc3_vm* vm = vm_alloc(); // on its own cache lines
+  if(!vm) return NULL;
+  memset(vm, 0, sizeof(lc3_vm));
+  memset(vm->dirty, 0xFF, sizeof(vm->dirty)); // nobody has seen any page yet
+  vm->memory = memory;
+  vm->free_memory = free_memory;
+  vm->backend = LC3_BACKEND_SWITCH;
+  vm->io = stdio_console;
+  memcpy(vm->traps, default_traps, sizeof(vm->traps));
+  lc3_reset(vm);
+  return vm;
+}
+
+void lc3_destroy(lc3_vm* vm)
+{
+  if(!vm) return;
+  blocks_free(vm);
+  vm->free_memory(vm->memory);
+  vm_free(vm);
+}
+
+void lc3_reset(lc3_vm* vm)
+{
+  memset(vm->reg, 0, sizeof(vm->reg));
+  vm->reg[R_COND] = FL_ZRO;  // set the Z flag
+  vm->reg[R_PC] = PC_START;  // 0x3000 is the default starting position
+  vm->running = 1;
+  vm->stop = 0;
+  vm->retired = 0;
+  vm->mem_reads = 0;
+  vm->mem_writes = 0;
+  memset(&vm->stats, 0, sizeof(vm->stats));
+  devices_reset(vm); // user mode, priority 0, no timers running
+}
+
+
+/*=============== IMAGES ===============*/
+
+static void memory_replaced(lc3_vm* vm) // by the host, behind the guest's back
+{
+  code_changed(vm);
+  memset(vm->dirty, 0xFF, sizeof(vm->dirty));
+}
+
+void load_image_words(uint16* memory, FILE* file)  // reads the image file bytes into memory
+{
+  uint16 origin;
+  if(fread(&origin, sizeof(origin), 1, file) != 1) return;
+  origin = swap16(origin);
+
+  size_t max_read = MEMORY_MAX - origin;
+  uint16* p = memory + origin;
+  size_t read = fread(p, sizeof(uint16), max_read, file);
+
+  while(read-- > 0) // swap to little endian
+  {
+    *p = swap16(*p);
+    ++p;
+  }
+}
+
+void lc3_load_image_file(lc3_vm* vm, FILE* file)
+{
+  load_image_words(vm->memory, file);
+  memory_replaced(vm);
+}
+
+int lc3_load_image(lc3_vm* vm, const char* image_path) // reads the image
+{
+  FILE* file = fopen(image_path,"rb"); //read binary
+  if(!file)return 0;
+  lc3_load_image_file(vm, file);
+  fclose(file);
+  return 1;
+}
+
+
+/*============= EXECUTION ==============*/
+
+int lc3_run(lc3_vm* vm, uint64_t max_instructions)
+{
+  if(!vm->running)
+  {
+    return vm->stop; // HALT or FAULT stick until lc3_reset()
+  }
+  uint64_t end = vm->retired + max_instructions;
+  if(end < vm->retired) end = UINT64_MAX;
+  if(vm->quota)
+  {
+    // checked once per slice, never per instruction
+    if(vm->retired >= vm->quota) return LC3_STOP_QUOTA;
+    if(vm->quota < end) end = vm->quota;
+  }
+  while(vm->retired < end)
+  {
+    uint64_t limit = end;
+    if(vm->nevents || vm->pending)
+    {
+      limit = devices_tick(vm, end); // the backend runs up to the next deadline
+      if(vm->stop)
+      {
+        vm->stop = 0;
+        return LC3_STOP_INPUT; // idle, only a key can wake it
+      }
+      if(vm->retired >= limit) continue;
+    }
+    uint64_t n = backends[vm->backend].run(vm, limit - vm->retired);
+    int reason = vm->stop;
+    if(reason == LC3_STOP_INPUT || reason == LC3_STOP_FAULT)
+    {
+      --n; // the stopping instruction did not retire
+    }
+    if(vm->running)
+    {
+      vm->stop = 0;
+    }
+    vm->retired += n;
+    if(reason == STOP_DEVICE)
+    {
+      devices_written(vm);
+    }
+    else if(reason != LC3_STOP_BUDGET)
+    {
+      return reason;
+    }
+  }
+  return vm->quota && vm->retired >= vm->quota ? LC3_STOP_QUOTA : LC3_STOP_BUDGET;
+}
+
+int lc3_step(lc3_vm* vm)
+{
+  lc3_run(vm, 1);
+  return vm->running;
+}
+
+int lc3_running(const lc3_vm* vm)
+{
+  return vm->running;
+}
+
+uint64_t lc3_retired(const lc3_vm* vm)
+{
+  return vm->retired;
+}
+
+void lc3_get_stats(const lc3_vm* vm, lc3_stats* out)
+{
+  *out = vm->stats;
+  out->instructions = vm->retired;
+  out->mem_reads = vm->mem_reads;
+  out->mem_writes = vm->mem_writes;
+}
+
+void lc3_set_quota(lc3_vm* vm, uint64_t max_retired)
+{
+  vm->quota = max_retired;
+}
+
+int lc3_set_backend(lc3_vm* vm, int backend)
+{
+  if(backend < 0 || backend >= LC3_BACKEND_COUNT) return 0;
+  vm->backend = backend;
+  return 1;
+}
+
+int lc3_backend_by_name(const char* name)
+{
+  for(int b = 0; b < LC3_BACKEND_COUNT; ++b)
+  {
+    if(strcmp(backends[b].name, name) == 0) return b;
+  }
+  return -1;
+}
+
+const char* lc3_backend_name(int backend)
+{
+  if(backend < 0 || backend >= LC3_BACKEND_COUNT) return NULL;
+  return backends[backend].name;
+}
+
+
+/*======== DEVICES AND SERVICES ========*/
+
+void lc3_set_io(lc3_vm* vm, const lc3_io* io)
+{
+  vm->io = *io;
+}
+
+void lc3_get_io(const lc3_vm* vm, lc3_io* out)
+{
+  *out = vm->io;
+}
+
+void lc3_halt(lc3_vm* vm)
+{
+  vm->running = 0;
+  vm->stop = LC3_STOP_HALT;
+}
+
+void lc3_register_trap(lc3_vm* vm, uint8_t vector, lc3_trap_fn fn)
+{
+  vm->traps[vector] = fn;
+}
+
+void lc3_enable_ext_traps(lc3_vm* vm)
+{
+  lc3_register_trap(vm, TRAP_MUL, MUL);
+  lc3_register_trap(vm, TRAP_DIV, DIV);
+  lc3_register_trap(vm, TRAP_MEMCPY, MEMCPY);
+  lc3_register_trap(vm, TRAP_MEMSET, MEMSET);
+  lc3_register_trap(vm, TRAP_MEMCMP, MEMCMP);
+}
+
+
+/*============ STATE ACCESS ============*/
+
+uint16_t lc3_get_reg(const lc3_vm* vm, int r)
+{
+  return vm->reg[r];
+}
+
+void lc3_set_reg(lc3_vm* vm, int r, uint16_t val)
+{
+  vm->reg[r] = val;
+}
+
+uint16_t* lc3_memory(lc3_vm* vm)
+{
+  memory_replaced(vm); // the host may be about to write anything
+  return vm->memory;
+}
+
+void lc3_snapshot(const lc3_vm* vm, lc3_state* out)
+{
+  memcpy(out->reg, vm->reg, sizeof(out->reg));
+  out->psr = vm->psr;
+  out->saved_usp = vm->saved_usp;
+  out->saved_ssp = vm->saved_ssp;
+  out->running = vm->running;
+  memcpy(out->memory, vm->memory, sizeof(out->memory));
+}
+
+int lc3_dirty_pages(lc3_vm* vm, int observer, uint8_t dirty[LC3_PAGE_COUNT])
+{
+  uint8_t bit = 1 << observer;
+  int count = 0;
+  for(int p = 0; p < LC3_PAGE_COUNT; ++p)
+  {
+    dirty[p] = (vm->dirty[p] & bit) != 0;
+    count += dirty[p];
+    vm->dirty[p] &= ~bit;
+  }
+  return count;
+}
+
+void lc3_restore(lc3_vm* vm, const lc3_state* in)
+{
+  memcpy(vm->reg, in->reg, sizeof(vm->reg));
+  vm->running = in->running;
+  vm->stop = in->running ? 0 : LC3_STOP_HALT;
+  memcpy(vm->memory, in->memory, sizeof(in->memory));
+  memory_replaced(vm);
+  devices_reset(vm);
+  vm->psr = in->psr;
+  vm->saved_usp = in->saved_usp;
+  vm->saved_ssp = in->saved_ssp;
+  // timers restart from their period registers, pending interrupts are lost
+  vm->dev_written = ~0u;
+  devices_written(vm);
+}
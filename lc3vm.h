@@ -0,0 +1,145 @@
+#ifndef LC3VM_H
+#define LC3VM_H
+
+/*
+  liblc3 embedding api.
+
+  a vm owns its registers, memory, trap table and i/o callbacks, so any
+  number of them can live in one process. front-ends (main.c, lc3.c) only
+  parse arguments and set up the terminal.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define LC3_MEMORY_WORDS (1<<16)
+#define LC3_REG_COUNT 10 // R0-R7, PC, COND
+#define LC3_PAGE_WORDS 256 // granularity of dirty page tracking
+#define LC3_PAGE_COUNT (LC3_MEMORY_WORDS / LC3_PAGE_WORDS)
+
+typedef struct lc3_vm lc3_vm;
+typedef void (*lc3_trap_fn)(lc3_vm* vm); // native trap service routine
+
+typedef struct // console callbacks, ctx is passed back to each of them
+{
+  int (*getc)(void* ctx);      // read one character, blocking. -1 at end of input
+  int (*key_ready)(void* ctx); // nonzero when getc would not block
+  void (*write)(void* ctx, const char* buf, size_t n);
+  void (*flush)(void* ctx);
+  void* ctx;
+} lc3_io;
+
+typedef struct // full architectural state, see lc3_snapshot()
+{
+  uint16_t reg[LC3_REG_COUNT];
+  uint16_t psr; // privilege and priority, N/Z/P are reg[R_COND]
+  uint16_t saved_usp;
+  uint16_t saved_ssp;
+  int running;
+  uint16_t memory[LC3_MEMORY_WORDS];
+} lc3_state;
+
+enum // why lc3_run() returned control to the host
+{
+  LC3_STOP_BUDGET = 0, // max_instructions retired, the guest can continue
+  LC3_STOP_HALT,       // the guest executed HALT
+  LC3_STOP_INPUT,      // GETC/IN found no input, the TRAP runs again on the next lc3_run(),
+                       // or the guest idles in a BR to itself waiting for a keyboard interrupt
+  LC3_STOP_FAULT,      // reserved or unsupported opcode, PC is left on it
+  LC3_STOP_QUOTA       // the instruction quota is used up, see lc3_set_quota()
+};
+
+enum // lc3_stats.traps index
+{
+  LC3_TRAP_STAT_GETC = 0,
+  LC3_TRAP_STAT_OUT,
+  LC3_TRAP_STAT_PUTS,
+  LC3_TRAP_STAT_IN,
+  LC3_TRAP_STAT_PUTSP,
+  LC3_TRAP_STAT_HALT,
+  LC3_TRAP_STAT_OTHER, // extended and guest installed vectors
+  LC3_TRAP_STAT_COUNT
+};
+
+typedef struct // guest work since lc3_reset(), only uint64_t fields
+{
+  uint64_t instructions; // retired
+  uint64_t traps[LC3_TRAP_STAT_COUNT]; // completed TRAPs by vector
+  uint64_t mem_reads; // data loads, instruction fetches are not counted
+  uint64_t mem_writes;
+  uint64_t device_polls; // KBSR reads
+  uint64_t input_waits; // GETC/IN stops for lack of input
+  uint64_t interrupts; // taken
+} lc3_stats;
+
+enum // dirty page observers, each one sees every write once
+{
+  LC3_DIRTY_CHECK = 0, // the differential checker, check.h
+  LC3_DIRTY_CHECKPOINT, // checkpoint logs, checkpoint.h
+  LC3_DIRTY_MIGRATE, // pre-copy rounds, migrate.h
+  LC3_DIRTY_OBSERVERS = 8
+};
+
+enum // execution backends
+{
+  LC3_BACKEND_SWITCH = 0, // one switch with every handler inlined
+  LC3_BACKEND_TABLE,      // indirect call through the handler table
+  LC3_BACKEND_BLOCK,      // pre-decoded traces, laid out from the profile when there is one
+  LC3_BACKEND_TAIL,       // handlers tail call each other, PC and flags stay in host registers
+  LC3_BACKEND_COUNT
+};
+
+// lifetime
+lc3_vm* lc3_create(); // stdio console, switch backend, PC at PC_START
+void lc3_destroy(lc3_vm* vm);
+void lc3_reset(lc3_vm* vm); // registers and run state only, memory is kept
+
+// images
+int lc3_load_image(lc3_vm* vm, const char* image_path); // 0 when the file can't be opened
+void lc3_load_image_file(lc3_vm* vm, FILE* file);
+
+// execution. lc3_run() retires at most max_instructions and returns an
+// LC3_STOP_* reason. resuming after LC3_STOP_BUDGET or LC3_STOP_INPUT is
+// just another call, there is no per call setup.
+int lc3_run(lc3_vm* vm, uint64_t max_instructions);
+int lc3_step(lc3_vm* vm); // one instruction, returns lc3_running()
+int lc3_running(const lc3_vm* vm); // 0 after HALT or a fault
+uint64_t lc3_retired(const lc3_vm* vm); // instructions retired since lc3_reset()
+void lc3_get_stats(const lc3_vm* vm, lc3_stats* out);
+// lc3_run() returns LC3_STOP_QUOTA once lc3_retired() reaches max_retired,
+// and keeps returning it until the quota is raised. 0 means no quota.
+void lc3_set_quota(lc3_vm* vm, uint64_t max_retired);
+int lc3_set_backend(lc3_vm* vm, int backend); // 0 for an unknown backend
+int lc3_backend_by_name(const char* name); // -1 for an unknown name
+const char* lc3_backend_name(int backend);
+
+// profiles. lc3_profile_start() switches to the block backend and starts
+// counting trace entries, BR outcomes and JSR targets. if path holds a
+// profile of the same image (checksum of memory as loaded) its hot code is
+// translated right away, so the first run already gets the warmed up
+// layout. call it after the images are loaded. returns 1 for a warm
+// start, 0 for a cold one, -1 when out of memory.
+int lc3_profile_start(lc3_vm* vm, const char* path);
+int lc3_profile_save(const lc3_vm* vm, const char* path); // merged counts, 0 on failure
+
+// devices and services
+void lc3_set_io(lc3_vm* vm, const lc3_io* io);
+void lc3_get_io(const lc3_vm* vm, lc3_io* out); // e.g. to wrap the current console
+int lc3_stdin_ready(); // nonzero when a read from stdin would not block, the default console's key_ready
+void lc3_halt(lc3_vm* vm); // stop the guest from the host, as if it ran HALT
+void lc3_register_trap(lc3_vm* vm, uint8_t vector, lc3_trap_fn fn);
+void lc3_enable_ext_traps(lc3_vm* vm); // TRAP x26-x2A, see enums.h
+
+// state access
+uint16_t lc3_get_reg(const lc3_vm* vm, int r);
+void lc3_set_reg(lc3_vm* vm, int r, uint16_t val);
+uint16_t* lc3_memory(lc3_vm* vm); // get it again after lc3_run() before patching code
+void lc3_snapshot(const lc3_vm* vm, lc3_state* out);
+// sets dirty[p] for every page written since this observer's previous
+// call, by the guest or the host, and returns how many. a new vm starts
+// with every page dirty.
+int lc3_dirty_pages(lc3_vm* vm, int observer, uint8_t dirty[LC3_PAGE_COUNT]);
+void lc3_restore(lc3_vm* vm, const lc3_state* in);
+
+#endif
@@ -23,16 +23,12 @@ static void restore_input_buffering()
     tcsetattr(STDIN_FILENO, TCSANOW, &original_tio);
 }
 
-static uint16_t check_key()
+static void wait_key() // blocks until lc3_stdin_ready() would succeed
 {
     fd_set readfds;
     FD_ZERO(&readfds);
     FD_SET(STDIN_FILENO, &readfds);
-
-    struct timeval timeout;
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 0;
-    return select(1, &readfds, NULL, NULL, &timeout) != 0;
+    select(1, &readfds, NULL, NULL, NULL);
 }
 
 #endif
\ No newline at end of file
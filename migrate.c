@@ -0,0 +1,225 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "migrate.h"
+#include "opcodes.h"
+
+/*
+  the stream is STREAM_MAGIC and then rounds: a round_header, the page
+  numbers (a byte each) and the pages. the final round is followed by a
+  final_state and final_state.host_bytes of host state.
+*/
+
+#define STREAM_MAGIC "lc3mig1\n"
+#define MAGIC_SIZE 8
+#define PAGE_BYTES (LC3_PAGE_WORDS * sizeof(uint16))
+#define HOST_MAX (64 << 20) // sanity bound on the host state a sender announces
+
+enum { ROUND_PAGES = 1, ROUND_FINAL };
+
+typedef struct
+{
+  uint32_t kind; // ROUND_*
+  uint32_t npages;
+} round_header;
+
+typedef struct // after the final round
+{
+  uint64_t retired;
+  lc3_stats stats;
+  uint64_t deadline[DEV_COUNT]; // UINT64_MAX when not scheduled
+  uint16_t reg[LC3_REG_COUNT];
+  uint16_t psr;
+  uint16_t saved_usp;
+  uint16_t saved_ssp;
+  uint16_t pending;
+  uint16_t timer_period[TIMER_COUNT];
+  uint8_t running;
+  uint8_t kbd_latched;
+  uint64_t host_bytes;
+} final_state;
+
+struct lc3_migration
+{
+  int fd;
+  int started; // the magic and the first round are out
+  uint8_t* buf; // one round: header, page numbers and pages
+};
+
+#define ROUND_MAX (sizeof(round_header) + LC3_PAGE_COUNT + LC3_PAGE_COUNT * PAGE_BYTES)
+
+static int write_all(int fd, const void* buf, size_t n)
+{
+  const char* p = buf;
+  while(n)
+  {
+    ssize_t done = write(fd, p, n);
+    if(done < 0 && errno == EINTR) continue;
+    if(done <= 0) return 0;
+    p += done;
+    n -= done;
+  }
+  return 1;
+}
+
+static int read_all(int fd, void* buf, size_t n)
+{
+  char* p = buf;
+  while(n)
+  {
+    ssize_t done = read(fd, p, n);
+    if(done < 0 && errno == EINTR) continue;
+    if(done <= 0) return 0;
+    p += done;
+    n -= done;
+  }
+  return 1;
+}
+
+
+/*=============== SENDING ==============*/
+
+// copies the dirty pages behind a header of this kind, returns the round's size
+static size_t pack_round(lc3_migration* m, lc3_vm* vm, uint32_t kind, int* npages)
+{
+  uint8_t dirty[LC3_PAGE_COUNT];
+  lc3_dirty_pages(vm, LC3_DIRTY_MIGRATE, dirty);
+  if(!m->started)
+  {
+    memset(dirty, 1, sizeof(dirty)); // the receiver has nothing yet
+  }
+  uint8_t* pages = m->buf + sizeof(round_header);
+  round_header h = { kind, 0 };
+  for(int p = 0; p < LC3_PAGE_COUNT; ++p)
+  {
+    if(dirty[p]) pages[h.npages++] = (uint8_t)p;
+  }
+  uint8_t* data = pages + h.npages;
+  for(uint32_t i = 0; i < h.npages; ++i, data += PAGE_BYTES)
+  {
+    memcpy(data, &vm->memory[pages[i] * LC3_PAGE_WORDS], PAGE_BYTES);
+  }
+  memcpy(m->buf, &h, sizeof(h));
+  *npages = h.npages;
+  return data - m->buf;
+}
+
+static int send_round(lc3_migration* m, lc3_vm* vm, uint32_t kind)
+{
+  if(!m->started && !write_all(m->fd, STREAM_MAGIC, MAGIC_SIZE)) return -1;
+  int npages;
+  size_t n = pack_round(m, vm, kind, &npages);
+  m->started = 1;
+  return write_all(m->fd, m->buf, n) ? npages : -1;
+}
+
+lc3_migration* lc3_migrate_start(lc3_vm* vm, int fd)
+{
+  lc3_migration* m = calloc(1, sizeof(lc3_migration));
+  uint8_t* buf = malloc(ROUND_MAX);
+  if(!m || !buf)
+  {
+    free(m);
+    free(buf);
+    return NULL;
+  }
+  m->fd = fd;
+  m->buf = buf;
+  return m;
+}
+
+int lc3_migrate_round(lc3_migration* m, lc3_vm* vm)
+{
+  return send_round(m, vm, ROUND_PAGES);
+}
+
+int lc3_migrate_finish(lc3_migration* m, lc3_vm* vm, const void* host, size_t n)
+{
+  final_state f;
+  memset(&f, 0, sizeof(f)); // no stray padding bytes on the wire
+  f.retired = vm->retired;
+  lc3_get_stats(vm, &f.stats);
+  devices_deadlines(vm, f.deadline);
+  memcpy(f.reg, vm->reg, sizeof(f.reg));
+  f.psr = vm->psr;
+  f.saved_usp = vm->saved_usp;
+  f.saved_ssp = vm->saved_ssp;
+  f.pending = vm->pending;
+  memcpy(f.timer_period, vm->timer_period, sizeof(f.timer_period));
+  f.running = (uint8_t)vm->running;
+  f.kbd_latched = (uint8_t)vm->kbd_latched;
+  f.host_bytes = n;
+  int ok = send_round(m, vm, ROUND_FINAL) >= 0
+           && write_all(m->fd, &f, sizeof(f))
+           && write_all(m->fd, host, n);
+  lc3_migrate_abort(m);
+  return ok;
+}
+
+void lc3_migrate_abort(lc3_migration* m)
+{
+  if(!m) return;
+  free(m->buf);
+  free(m);
+}
+
+
+/*============= RECEIVING ==============*/
+
+static void build(lc3_vm* vm, lc3_state* state, const final_state* f)
+{
+  memcpy(state->reg, f->reg, sizeof(state->reg));
+  state->psr = f->psr;
+  state->saved_usp = f->saved_usp;
+  state->saved_ssp = f->saved_ssp;
+  state->running = f->running;
+  vm->retired = f->retired;
+  lc3_restore(vm, state);
+  // lc3_restore() restarted the timers, put back where they really were
+  memcpy(vm->timer_period, f->timer_period, sizeof(vm->timer_period));
+  devices_set_deadlines(vm, f->deadline);
+  vm->pending = f->pending;
+  vm->kbd_latched = f->kbd_latched;
+  vm->stats = f->stats;
+  vm->mem_reads = f->stats.mem_reads;
+  vm->mem_writes = f->stats.mem_writes;
+}
+
+lc3_vm* lc3_migrate_receive(int fd, void** host, size_t* n)
+{
+  *host = NULL;
+  *n = 0;
+  char magic[MAGIC_SIZE];
+  lc3_state* state = calloc(1, sizeof(lc3_state));
+  lc3_vm* vm = lc3_create(); // now, not in the sender's pause
+  uint8_t pages[LC3_PAGE_COUNT];
+  round_header h = { 0, 0 };
+  int ok = state && vm && read_all(fd, magic, MAGIC_SIZE) && memcmp(magic, STREAM_MAGIC, MAGIC_SIZE) == 0;
+  while(ok && h.kind != ROUND_FINAL)
+  {
+    ok = read_all(fd, &h, sizeof(h)) && (h.kind == ROUND_PAGES || h.kind == ROUND_FINAL)
+         && h.npages <= LC3_PAGE_COUNT && read_all(fd, pages, h.npages);
+    for(uint32_t i = 0; ok && i < h.npages; ++i)
+    {
+      ok = read_all(fd, &state->memory[pages[i] * LC3_PAGE_WORDS], PAGE_BYTES);
+    }
+  }
+  final_state f;
+  ok = ok && read_all(fd, &f, sizeof(f)) && f.host_bytes <= HOST_MAX;
+  void* buf = ok ? malloc(f.host_bytes ? f.host_bytes : 1) : NULL;
+  if(buf && read_all(fd, buf, f.host_bytes))
+  {
+    build(vm, state, &f);
+    *host = buf;
+    *n = f.host_bytes;
+  }
+  else
+  {
+    free(buf);
+    lc3_destroy(vm);
+    vm = NULL;
+  }
+  free(state);
+  return vm;
+}
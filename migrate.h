@@ -0,0 +1,43 @@
+#ifndef MIGRATE_H
+#define MIGRATE_H
+
+/*
+  live migration of a running guest to another process on the same host
+  (posix, over any stream fd: a unix socket or a pipe).
+
+  the sender first copies every page while the guest keeps running, then
+  in each further round only the pages it wrote since the round before
+  (the LC3_DIRTY_MIGRATE observer). once a round is small, the guest is
+  stopped and lc3_migrate_finish() sends the last dirty pages, the
+  registers, PSR, device state (timer deadlines, pending interrupts, a
+  latched KBDR key), the counters and whatever host state the caller
+  passes along, e.g. its console buffers. the pause the guest sees is
+  that last round only.
+
+  both ends must be on one host, numbers go in native byte order. the
+  backend, trap table, quota and console are not sent, the receiver sets
+  them up like for any new vm.
+*/
+
+#include <stddef.h>
+#include "lc3vm.h"
+
+typedef struct lc3_migration lc3_migration;
+
+// starts a migration over fd, which stays the caller's. NULL when out of memory
+lc3_migration* lc3_migrate_start(lc3_vm* vm, int fd);
+// call between two lc3_run(): sends the pages written since the last
+// round, every page on the first one. returns how many, -1 on a write error.
+int lc3_migrate_round(lc3_migration* m, lc3_vm* vm);
+// stop-and-copy, host holds n bytes for the receiver. the vm is left as it
+// was, the caller stops running it once this succeeds. returns 0 on a
+// write error. frees m either way.
+int lc3_migrate_finish(lc3_migration* m, lc3_vm* vm, const void* host, size_t n);
+void lc3_migrate_abort(lc3_migration* m); // frees m, the receiver sees a broken stream
+
+// the receiving end: reads rounds until the final one and builds a new
+// vm from them, *host gets a malloc()ed copy of the sender's host state.
+// NULL when the stream breaks off or is not a migration.
+lc3_vm* lc3_migrate_receive(int fd, void** host, size_t* n);
+
+#endif
@@ -1,20 +1,13 @@
 #include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "opcodes.h"
 #include "enums.h"
+#include "isa.h"
+#include "exec.h"
 
-#define MEMORY_MAX (1<<16)
-static uint16 memory[MEMORY_MAX];  // 65536 LOCATIONS IN RAM
-
-// registers array
-extern uint16 reg[R_COUNT];
-
-
-void handle_interrupt(int signal)
-{
-    restore_input_buffering();
-    printf("\n");
-    exit(-2);
-}
 
 uint16 sign_extend(uint16 x, int bit_count) // sign extends bits to 16 bit data
 {
@@ -24,344 +17,320 @@ uint16 sign_extend(uint16 x, int bit_count) // sign extends bits to 16 bit data
   return x;
 }
 
-void update_flags(const uint16 r) // this updates condition flags
+uint16 swap16(uint16 x)  // swaps from big endian to little endian
+{
+  return (x<<8) | (x>>8);
+}
+
+void poll_keyboard(lc3_vm* vm) // KBSR read, latch a key into KBDR if one is waiting
 {
-  if(reg[r] == 0){
-    reg[R_COND] = FL_ZRO;
+  ++vm->stats.device_polls;
+  uint16 enabled = vm->memory[MR_KBSR] & KBSR_IE;
+  if(vm->kbd_latched)
+  {
+    vm->kbd_latched = 0; // taken for a keyboard interrupt, the handler sees it first
   }
-  else if(reg[r]>>15){
-    reg[R_COND] = FL_NEG;
+  else if(vm->io.key_ready(vm->io.ctx))
+  {
+    vm->memory[MR_KBSR] = KBSR_READY | enabled;
+    vm->memory[MR_KBDR] = vm->io.getc(vm->io.ctx);
   }
-  else{
-    reg[R_COND] = FL_POS;
+  else
+  {
+    vm->memory[MR_KBSR] = enabled;
   }
+  vm->dirty[MR_KBSR >> PAGE_SHIFT] = 0xFF;
 }
 
-uint16 mem_read(const uint16 mem_address) // reads from the memory location
+int wait_input(lc3_vm* vm)
 {
-  if(mem_address == MR_KBSR)
+  if(vm->io.key_ready(vm->io.ctx))
   {
-    if(check_key())
-    {
-      memory[MR_KBSR] = (1 << 15);
-      memory[MR_KBDR] = getchar();
-    }
-    else
-    {
-      memory[MR_KBSR] = 0;
-    }
+    return 1;
   }
-  return memory[mem_address];
+  // rewind so the TRAP executes again when the host resumes us.
+  // R7 was already written, but the retry writes the same value.
+  vm->reg[R_PC]--;
+  vm->stop = LC3_STOP_INPUT;
+  ++vm->stats.input_waits;
+  return 0;
 }
 
-void mem_write(const uint16 address, uint16 val) // writes to a memory location
-{
-  memory[address] = val;
-}
 
-void load_args(int argc, const char* argv[]) // load arguments
-{
-  if(argc<2)
-      {
-        // show usage string
-        printf("lc3 [image-file1] ...\n");
-        exit(2);
-
-      }
-
-    for(int j = 1; j<argc;++j)
-      {
-        if(!read_image(argv[j]))
-          {
-            printf("failed to load image: %s\n", argv[j]);
-            exit(1);
-          }
-      }
-}
+/*======== INSTRUCTIONS ===========*/
+// out of line copies of the exec.h bodies for the table backend
 
-uint16 swap16(uint16 x)  // swaps from big endian to little endian
+void BAD(lc3_vm* vm, uint16 instr) // bad opcode
 {
-  return (x<<8) | (x>>8);
+    vm->reg[R_PC]--; // leave PC on the offending instruction
+    vm->running = 0;
+    vm->stop = LC3_STOP_FAULT;
 }
 
-void read_image_file(FILE* file)  // reads the image file bytes into memory
-{
-  uint16 origin;
-  fread(&origin, sizeof(origin), 1, file);
-  origin = swap16(origin);
-
-  uint16 max_read = MEMORY_MAX - origin;
-  uint16* p = memory + origin;
-  size_t read = fread(p, sizeof(uint16), max_read, file);
+#define DEFINE_HANDLER(name, op, b11, b5, fmt, mn) \
+  void name(lc3_vm* vm, uint16 instr) { exec_##name(vm, instr); }
 
-  while(read-- > 0) // swap to little endian
-  {
-    *p = swap16(*p);
-    ++p;
-  }
-}
+LC3_INSNS(DEFINE_HANDLER)
 
-int read_image(const char* image_path) // reads the image
-{
-  FILE* file = fopen(image_path,"rb"); //read binary
-  if(!file)return 0;
-  read_image_file(file);
-  fclose(file);
-  return 1;
-}
 
+/*========== DISPATCH TABLE ============*/
 
-/*======== INSTRUCTIONS ===========*/
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+#endif
 
-// ADD
-void ADD(uint16 instr)
+#define HANDLER_KEY(name, op, b11, b5, fmt, mn) LC3_KEY_INIT(op, b11, b5, name)
+const insn_fn insn_table[KEY_COUNT] = // dispatch key -> handler
 {
-  uint16 r0 = (instr >> 9) & 0x7;
-  uint16 r1 = (instr >> 6) & 0x7;
-  uint16 imm_flag = (instr >> 5) & 0x1;
-
-  if(imm_flag)
-    {
-      uint16 imm5 = sign_extend(instr & 0x1F, 5);
-      reg[r0] = reg[r1] + imm5;
-    }
-  else
-    {
-      uint16 r2 = instr & 0x7;
-      reg[r0] = reg[r1] + reg[r2];
-    }
-  update_flags(r0);
-}
+  LC3_INSNS(HANDLER_KEY)
+};
 
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
 
-void BAD() // bad opcode
-{
-    abort();
-}
 
+/*=============== TRAP =================*/
 
-// bitwise AND
-void AND(uint16 instr)
+// standard trap vectors, copied into every new vm
+const trap_fn default_traps[256] =
 {
-    uint16 r0 = (instr >> 9) & 0x7;
-    uint16 r1 = (instr >> 6) & 0x7;
-    uint16 imm_flag = (instr >> 5) & 0x1;
+  [TRAP_GETC] = GETC,
+  [TRAP_OUT] = OUT,
+  [TRAP_PUTS] = PUTS,
+  [TRAP_IN] = IN,
+  [TRAP_PUTSP] = PUTSP,
+  [TRAP_HALT] = HALT
+};
 
-    if(imm_flag){
-        uint16 imm5 = sign_extend((instr & 0x1F),5);
-        reg[r0] = reg[r1] & imm5;
-    }
-    else{
-        uint16 r2 = instr & 0x7;
-        reg[r0] = reg[r1] & reg[r2];
-    }
-    update_flags(r0);
-}
 
-// bitwise not - flips the each bit
-void NOT(uint16 instr)
-{
-    uint16 r0 = (instr >> 9) & 0x7;
-    uint16 r1 = (instr >> 6) & 0x7;
+/*=========== STRING OUTPUT ============*/
 
-    reg[r0] = ~reg[r1];
-    update_flags(r0);
-}
+#define OUT_CHUNK 512 // bytes converted per write
 
-// branch
-void BR(uint16 instr)
+// length of the zero terminated word string at addr, never scanning past the end of memory
+static size_t word_strlen(const uint16* memory, uint16 addr)
 {
-    uint16 pc_offset = sign_extend(instr & 0x1FF, 9);
-    uint16 cond_flag = (instr >> 9) & 0x7;
-    if(cond_flag & reg[R_COND])
+  const uint16* s = memory + addr;
+  size_t max = MEMORY_MAX - addr;
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  for(; i + 8 <= max; i += 8)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(v, zero));
+    if(mask)
     {
-        reg[R_PC] += pc_offset;
+      return i + (__builtin_ctz(mask) >> 1);
     }
+  }
+#endif
+  while(i < max && s[i])
+  {
+    ++i;
+  }
+  return i;
 }
 
-// jump
-void JMP(uint16 instr)
-{
-    // this also handles RET => return from a register
-    uint16 r1 = (instr >> 6) & 0x7;
-    reg[R_PC] = reg[r1];
-}
-
-// jump to subroutine(register)
-void JSR(uint16 instr)
+// narrow n words to their low bytes
+static void narrow_words(char* dst, const uint16* src, size_t n)
 {
-    uint16 long_flag = (instr >> 11) & 1;
-    reg[R_R7] = reg[R_PC];
-    if(long_flag)
-    {
-        uint16 long_pc_offset = sign_extend(instr & 0x7FF, 11);
-        reg[R_PC] += long_pc_offset; // JSR => Jump to the SUBROUTINE and save return address in R7
-    }
-    else
-    {
-        // JSRR =>  Jump to the address in register R1 and save return address in R7
-        uint16 r1 = (instr >> 6) & 0x7;
-        reg[R_PC] = reg[r1];
-    }
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i low = _mm_set1_epi16(0xFF);
+  for(; i + 16 <= n; i += 16)
+  {
+    __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*)(src + i)), low);
+    __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i*)(src + i + 8)), low);
+    _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(a, b));
+  }
+#endif
+  for(; i < n; ++i)
+  {
+    dst[i] = (char)src[i];
+  }
 }
 
-// load => loads the data from a given address
-void LD(uint16 instr)
+static void write_out(lc3_vm* vm, const char* buf, size_t n)
 {
-    uint16 r0 = (instr >> 9) & 0x7;
-    uint16 pc_offset = sign_extend((instr & 0x1FF),9);
-    reg[r0] = mem_read(reg[R_PC]+pc_offset);
-    update_flags(r0);
+  vm->io.write(vm->io.ctx, buf, n);
 }
 
 
-// load indirect
-void LDI(uint16 instr)
+void GETC(lc3_vm* vm)
 {
-  // dest register
-  uint16 r0 = (instr >> 9) & 0x7;
-
-  // PCoffset9
-  uint16 pc_offset = sign_extend(instr & 0x1FF, 9);
-
-  // add pc_offset to the current PC, look at that memory to get the final address
-  reg[r0] = mem_read(mem_read(reg[R_PC]+pc_offset));
-  update_flags(r0);
+  if(!wait_input(vm)) return;
+  // read a single ascii character
+  vm->reg[R_R0] = (uint16)vm->io.getc(vm->io.ctx);
+  update_flags(vm, R_R0);
 }
 
-
-// load register
-void LDR(uint16 instr)
+void OUT(lc3_vm* vm)
 {
-    uint16 r0 = (instr >> 9) & 0x7;
-    uint16 r1 = (instr >> 6) & 0x7;
-    uint16 offset = sign_extend((instr & 0x3F), 6);
-    reg[r0] = mem_read(reg[r1] + offset);
-    update_flags(r0);
+  char c = (char)vm->reg[R_R0];
+  write_out(vm, &c, 1);
+  vm->io.flush(vm->io.ctx);
 }
 
-// LEA => load effective address
-void LEA(uint16 instr)
+void PUTS(lc3_vm* vm)
 {
-    uint16 r0 = (instr >> 9) & 0x7;
-    uint16 pc_offset = sign_extend((instr & 0x1FF), 9);
-
-    reg[r0] = reg[R_PC] + pc_offset;
-    update_flags(r0);
+  // one character per word
+  char buf[OUT_CHUNK];
+  const uint16* c = vm->memory + vm->reg[R_R0];
+  size_t len = word_strlen(vm->memory, vm->reg[R_R0]);
+  while(len)
+  {
+    size_t n = len < OUT_CHUNK ? len : OUT_CHUNK;
+    narrow_words(buf, c, n);
+    write_out(vm, buf, n);
+    c += n;
+    len -= n;
+  }
+  vm->io.flush(vm->io.ctx);
 }
 
-// store
-void ST(uint16 instr)
+void IN(lc3_vm* vm)
 {
-    uint16 r0 = (instr >> 9) & 0x7;
-    uint16 pc_offset = sign_extend((instr & 0x1FF),9);
-    mem_write(reg[R_PC] + pc_offset, reg[r0]);
+    if(!wait_input(vm)) return;
+    static const char prompt[] = "Enter a character: ";
+    write_out(vm, prompt, sizeof(prompt) - 1);
+    char c = vm->io.getc(vm->io.ctx);
+    write_out(vm, &c, 1);
+    vm->io.flush(vm->io.ctx);
+    vm->reg[R_R0] = (uint16)c;
+    update_flags(vm, R_R0);
 }
-
-// Store indirect
-void STI(uint16 instr)
+void PUTSP(lc3_vm* vm)
 {
-    uint16 r0 = (instr >> 9) & 0x7;
-    uint16 pc_offset = sign_extend(instr & 0x1FF, 9);
-    mem_write(mem_read(reg[R_PC] + pc_offset), reg[r0]);
+    /* one char per byte (two bytes per word)
+       here we need to swap back to
+       big endian format */
+    char buf[OUT_CHUNK];
+    const uint16* c = vm->memory + vm->reg[R_R0];
+    size_t len = word_strlen(vm->memory, vm->reg[R_R0]);
+    while (len)
+    {
+        size_t words = len < OUT_CHUNK / 2 ? len : OUT_CHUNK / 2;
+        size_t n = 0;
+        for (size_t i = 0; i < words; ++i)
+        {
+            buf[n++] = c[i] & 0xFF;
+            char char2 = c[i] >> 8;
+            if (char2) buf[n++] = char2;
+        }
+        write_out(vm, buf, n);
+        c += words;
+        len -= words;
+    }
+    vm->io.flush(vm->io.ctx);
 }
 
-// store register
-void STR(uint16 instr)
+void HALT(lc3_vm* vm)
 {
-    uint16 r0 = (instr >> 9) & 0x7;
-    uint16 r1 = (instr >> 6) & 0x7;
-    uint16 offset = sign_extend(instr & 0x3F, 6);
-    mem_write(reg[r1] + offset, reg[r0]);
+  static const char msg[] = "HALT\n";
+  write_out(vm, msg, sizeof(msg) - 1);
+  vm->io.flush(vm->io.ctx);
+  vm->running = 0;
+  vm->stop = LC3_STOP_HALT;
 }
 
 
+/*=========== EXTENDED TRAPS ===========*/
+// host implementations of the library loops guest code otherwise
+// spends its time in. registers other than the results are preserved.
 
-/*=============== TRAP =================*/
+void MUL(lc3_vm* vm)
+{
+  int32_t product = (int32_t)(int16_t)vm->reg[R_R0] * (int16_t)vm->reg[R_R1];
+  vm->reg[R_R0] = (uint16)product;
+  vm->reg[R_R1] = (uint16)((uint32_t)product >> 16);
+  update_flags(vm, R_R0);
+}
 
-void TRAP(uint16 instr, int* running)
+void DIV(lc3_vm* vm)
 {
-  reg[R_R7] = reg[R_PC];
-  switch(instr & 0xFF)
+  int16_t divisor = (int16_t)vm->reg[R_R1];
+  if(divisor == 0)
   {
-    case TRAP_GETC:
-        GETC();
-      break;
-    case TRAP_OUT:
-        OUT();
-      break;
-    case TRAP_PUTS:
-        PUTS();
-      break;
-    case TRAP_IN:
-        IN();
-      break;
-    case TRAP_PUTSP:
-        PUTSP();
-      break;
-    case TRAP_HALT:
-        HALT(running);
-      break;
-
+    // division by zero leaves R0 and R1 untouched and sets N
+    vm->reg[R_COND] = FL_NEG;
+    return;
   }
-
+  int32_t dividend = (int16_t)vm->reg[R_R0];
+  vm->reg[R_R0] = (uint16)(dividend / divisor);
+  vm->reg[R_R1] = (uint16)(dividend % divisor);
+  update_flags(vm, R_R0);
 }
 
-
-void GETC()
+// what mem_write() does besides the store, for n words written from dst on
+static void block_written(lc3_vm* vm, uint16 dst, uint16 n)
 {
-  // read a single ascii character
-  reg[R_R0] = (uint16)getchar();
-  update_flags(R_R0);
+  vm->mem_writes += n;
+  if(n && (dst >= MR_KBSR || (uint16)(MR_KBSR - dst) < n))
+  {
+    for(uint32_t address = MR_KBSR; address < MEMORY_MAX; ++address)
+    {
+      if((uint16)(address - dst) < n) device_written(vm, address);
+    }
+  }
+  code_range_written(vm, dst, n);
+  mark_dirty(vm, dst, n);
 }
 
-void OUT()
+void MEMCPY(lc3_vm* vm)
 {
-  putc((char)reg[R_R0], stdout);
-  fflush(stdout);
+  uint16* memory = vm->memory;
+  uint16 dst = vm->reg[R_R0];
+  uint16 src = vm->reg[R_R1];
+  uint16 n = vm->reg[R_R2];
+  if((uint32_t)dst + n <= MEMORY_MAX && (uint32_t)src + n <= MEMORY_MAX)
+  {
+    memmove(memory + dst, memory + src, n * sizeof(uint16));
+  }
+  else if((uint16)(dst - src) < n)
+  {
+    // destination overlaps the tail of the source, copy backwards
+    for(uint16 k = n; k--;)
+    {
+      memory[(uint16)(dst + k)] = memory[(uint16)(src + k)];
+    }
+  }
+  else
+  {
+    for(uint16 i = 0; i < n; ++i)
+    {
+      memory[(uint16)(dst + i)] = memory[(uint16)(src + i)];
+    }
+  }
+  block_written(vm, dst, n);
 }
 
-void PUTS()
+void MEMSET(lc3_vm* vm)
 {
-  // one character per word
-  uint16* c = memory + reg[R_R0];
-  while(*c)
+  uint16 dst = vm->reg[R_R0];
+  uint16 val = vm->reg[R_R1];
+  uint16 n = vm->reg[R_R2];
+  for(uint16 i = 0; i < n; ++i)
   {
-    putc((char)*c, stdout);
-    ++c;
+    vm->memory[(uint16)(dst + i)] = val;
   }
-  fflush(stdout);
+  block_written(vm, dst, n);
 }
 
-void IN()
-{
-  printf("Enter a character: ");
-    char c = getchar();
-    putc(c, stdout);
-    fflush(stdout);
-    reg[R_R0] = (uint16)c;
-    update_flags(reg[R_R0]);
-}
-void PUTSP()
+void MEMCMP(lc3_vm* vm)
 {
-    /* one char per byte (two bytes per word)
-       here we need to swap back to
-       big endian format */
-    uint16* c = memory + reg[R_R0];
-    while (*c)
-    {
-        char char1 = (*c) & 0xFF;
-        putc(char1, stdout);
-        char char2 = (*c) >> 8;
-        if (char2) putc(char2, stdout);
-        ++c;
-    }
-    fflush(stdout);
+  uint16 a = vm->reg[R_R0];
+  uint16 b = vm->reg[R_R1];
+  uint16 n = vm->reg[R_R2];
+  int result = 0;
+  for(uint16 i = 0; i < n && !result; ++i)
+  {
+    uint16 x = vm->memory[(uint16)(a + i)];
+    uint16 y = vm->memory[(uint16)(b + i)];
+    result = (x > y) - (x < y);
+  }
+  vm->reg[R_R0] = (uint16)result;
+  update_flags(vm, R_R0);
 }
-
-void HALT(int* running)
-{
-  puts("HALT");
-  fflush(stdout);
-  *running = 0;
-}
\ No newline at end of file
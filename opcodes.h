@@ -1,54 +1,196 @@
 #ifndef OPCODES_H
 #define OPCODES_H
-#define LINUX
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include "enums.h"
+#include "lc3vm.h"
 typedef uint16_t uint16;
 
-#ifdef WIN32
-#include "windows.h"
+#define MEMORY_MAX LC3_MEMORY_WORDS
+#define PAGE_SHIFT 8 // LC3_PAGE_WORDS
 
-#elif defined(__linux__)
-#include "linux.h"
-#endif
+typedef lc3_trap_fn trap_fn;
+typedef void (*insn_fn)(lc3_vm* vm, uint16 instr);
 
-void handle_interrupt(int signal);
-uint16 mem_read(const uint16 mem_address);
-void mem_write(const uint16 address, uint16 reg);
+enum // interrupt sources, see devices.c
+{
+  DEV_KBD = 0,
+  DEV_TIMER, // timer i is DEV_TIMER + i
+  DEV_COUNT = DEV_TIMER + TIMER_COUNT
+};
 
-uint16 sign_extend(uint16 x, int bit_count);
-void update_flags(const uint16 r);
-void load_args(int argc, const char* argv[]); //load arguments
+// vm->stop value for a store to a device register. never returned by
+// lc3_run(), it ends the backend's run so devices_written() can look.
+#define STOP_DEVICE 16
+
+typedef struct
+{
+  uint64_t deadline; // lc3_retired() it is due at
+  int source; // DEV_*
+} dev_event;
+
+// the first cache line holds everything an instruction touches, the rest
+// is only read on traps, at slice boundaries or by the front-end. vms are
+// allocated on their own lines so two guests never share one.
+struct lc3_vm // engine internals, front-ends only see lc3vm.h
+{
+  _Alignas(64) uint16 reg[R_COUNT];
+  int stop; // LC3_STOP_* once a handler wants the run loop to return, 0 otherwise
+  uint16* memory; // MEMORY_MAX words
+  uint32_t* code_map; // one bit per word held in a trace, NULL without traces
+  struct block_cache* blocks; // decoded traces, block backend only
+  uint64_t mem_reads; // lc3_stats.mem_reads
+  uint64_t mem_writes; // lc3_stats.mem_writes
+
+  _Alignas(64) int running; // cleared by HALT and faults
+  int backend;
+  uint64_t retired; // updated once per lc3_run() slice
+  uint64_t quota; // 0 for none
+  struct lc3_profile* profile; // counts since lc3_profile_start()
+  lc3_io io;
+  lc3_stats stats; // the rest of the counters, instructions is retired
+  uint8_t dirty[LC3_PAGE_COUNT]; // a bit per LC3_DIRTY_* observer, set on every write
+  uint16 psr; // PSR_USER and PSR_PRIORITY bits
+  uint16 saved_usp; // R6 of the mode that is not running
+  uint16 saved_ssp;
+  uint16 pending; // raised and not yet taken interrupts, 1 << DEV_*
+  uint32_t dev_written; // device registers stored to since the last look, bit (address - MR_KBSR)
+  uint16 timer_period[TIMER_COUNT]; // as last written to MR_TMPR
+  int kbd_latched; // KBDR holds a key the guest was interrupted for but hasn't seen
+  dev_event events[DEV_COUNT]; // min-heap on deadline
+  int nevents;
+  int event_pos[DEV_COUNT]; // heap index of each source, -1 when not scheduled
+  void (*free_memory)(uint16* memory); // how memory is given back in lc3_destroy()
+  trap_fn traps[256]; // indexed by trapvect8
+};
+_Static_assert(offsetof(struct lc3_vm, running) == 64, "hot vm state must fit one cache line");
+typedef struct lc3_profile lc3_profile;
+
+lc3_vm* vm_new(uint16* memory, void (*free_memory)(uint16* memory)); // lc3_create() on caller provided memory
+void load_image_words(uint16* memory, FILE* file); // .obj file into a MEMORY_MAX word buffer
+void poll_keyboard(lc3_vm* vm); // refreshes KBSR/KBDR from the console
+int wait_input(lc3_vm* vm); // 1 when GETC/IN can read without blocking, else suspends the guest
+void code_written(lc3_vm* vm); // a store hit translated code, see blocks.h
+void code_range_written(lc3_vm* vm, uint16 address, uint16 n); // same for bulk writes
+void code_changed(lc3_vm* vm); // memory was replaced behind the guest's back
+uint64_t run_tail(lc3_vm* vm, uint64_t max_instructions); // tail.c, the tail call backend
+
+// devices.c: timers and interrupts, all handled between backend runs
+void devices_reset(lc3_vm* vm);
+void device_written(lc3_vm* vm, uint16 address); // a store at or above MR_KBSR
+void devices_written(lc3_vm* vm); // after a STOP_DEVICE, re-reads the registers
+void devices_deadlines(const lc3_vm* vm, uint64_t deadline[DEV_COUNT]); // UINT64_MAX when not scheduled
+void devices_set_deadlines(lc3_vm* vm, const uint64_t deadline[DEV_COUNT]); // moves device state between vms
+uint64_t devices_tick(lc3_vm* vm, uint64_t end); // fires due events, takes an interrupt. returns where the next run must end
+void rti(lc3_vm* vm, uint16 instr);
+
+static inline uint16 mem_fetch(lc3_vm* vm, const uint16 pc) // instruction fetch, not counted as a read
+{
+  if(pc == MR_KBSR)
+  {
+    poll_keyboard(vm);
+  }
+  return vm->memory[pc];
+}
+
+static inline uint16 mem_read(lc3_vm* vm, const uint16 mem_address) // reads from the memory location
+{
+  ++vm->mem_reads;
+  if(mem_address == MR_KBSR)
+  {
+    poll_keyboard(vm);
+  }
+  return vm->memory[mem_address];
+}
+
+static inline void mem_write(lc3_vm* vm, const uint16 address, uint16 val) // writes to a memory location
+{
+  ++vm->mem_writes;
+  vm->memory[address] = val;
+  vm->dirty[address >> PAGE_SHIFT] = 0xFF;
+  if(address >= MR_KBSR)
+  {
+    device_written(vm, address);
+  }
+  if(vm->code_map && (vm->code_map[address >> 5] >> (address & 31) & 1))
+  {
+    code_written(vm);
+  }
+}
 
-// reading image file
-int read_image(const char* image_path);
+static inline void mark_dirty(lc3_vm* vm, uint16 address, uint16 n) // for writes that skip mem_write()
+{
+  for(uint32_t p = address >> PAGE_SHIFT; n && p <= (uint32_t)(address + n - 1) >> PAGE_SHIFT; ++p)
+  {
+    vm->dirty[p & (LC3_PAGE_COUNT - 1)] = 0xFF;
+  }
+}
+
+static inline void count_trap(lc3_vm* vm, uint16 vect) // once the service routine returned
+{
+  if(vm->stop == LC3_STOP_INPUT) return; // it runs again when input arrives
+  uint16 i = vect - TRAP_GETC;
+  ++vm->stats.traps[i <= TRAP_HALT - TRAP_GETC ? i : LC3_TRAP_STAT_OTHER];
+}
+
+static inline void update_flags(lc3_vm* vm, const uint16 r) // this updates condition flags
+{
+  if(vm->reg[r] == 0){
+    vm->reg[R_COND] = FL_ZRO;
+  }
+  else if(vm->reg[r]>>15){
+    vm->reg[R_COND] = FL_NEG;
+  }
+  else{
+    vm->reg[R_COND] = FL_POS;
+  }
+}
+
+uint16 sign_extend(uint16 x, int bit_count);
 uint16 swap16(uint16 x);
-void read_image_file(FILE* file); // reads lc-3 program into memory
 
 // TRAP OPERATIONS
-void GETC();
-void OUT();
-void PUTS();
-void IN();
-void PUTSP();
-void HALT();
-
-// operations
-void BAD();  // bad opcode
-void ADD(uint16 instruction); // add
-void AND(uint16 instruction); // bitwise and
-void NOT(uint16 instruction); // bitwise not
-void BR(uint16 instruction);  // brach
-void JMP(uint16 instruction); // jump
-void JSR(uint16 instruction); // jump to register
-void LD(uint16 instruction);  // load
-void LDI(uint16 instruction); // load indirect
-void LDR(uint16 instruction); // load register
-void LEA(uint16 instruction); // load effective address
-void ST(uint16 instruction);  // store
-void STI(uint16 instruction); // store indirect
-void STR(uint16 instruction); // store register
-void TRAP(uint16 instruction, int* running); // trap operations
-
-#endif
\ No newline at end of file
+extern const trap_fn default_traps[256]; // the standard vector set
+
+void GETC(lc3_vm* vm);
+void OUT(lc3_vm* vm);
+void PUTS(lc3_vm* vm);
+void IN(lc3_vm* vm);
+void PUTSP(lc3_vm* vm);
+void HALT(lc3_vm* vm);
+
+// extended TRAP OPERATIONS
+void MUL(lc3_vm* vm);
+void DIV(lc3_vm* vm);
+void MEMCPY(lc3_vm* vm);
+void MEMSET(lc3_vm* vm);
+void MEMCMP(lc3_vm* vm);
+
+// operations, one per instruction variant in isa.h. the bodies live in
+// exec.h so the switch backend can inline them
+extern const insn_fn insn_table[64]; // indexed by DECODE_KEY(instr)
+
+void BAD(lc3_vm* vm, uint16 instr);     // bad opcode
+void ADD_REG(lc3_vm* vm, uint16 instr); // add
+void ADD_IMM(lc3_vm* vm, uint16 instr); // add immediate
+void AND_REG(lc3_vm* vm, uint16 instr); // bitwise and
+void AND_IMM(lc3_vm* vm, uint16 instr); // bitwise and immediate
+void NOT(lc3_vm* vm, uint16 instr); // bitwise not
+void BR(lc3_vm* vm, uint16 instr);  // brach
+void JMP(lc3_vm* vm, uint16 instr); // jump
+void JSR(lc3_vm* vm, uint16 instr); // jump to subroutine
+void JSRR(lc3_vm* vm, uint16 instr); // jump to subroutine in register
+void LD(lc3_vm* vm, uint16 instr);  // load
+void LDI(lc3_vm* vm, uint16 instr); // load indirect
+void LDR(lc3_vm* vm, uint16 instr); // load register
+void LEA(lc3_vm* vm, uint16 instr); // load effective address
+void ST(lc3_vm* vm, uint16 instr);  // store
+void STI(lc3_vm* vm, uint16 instr); // store indirect
+void STR(lc3_vm* vm, uint16 instr); // store register
+void TRAP(lc3_vm* vm, uint16 instr); // trap operations
+void RTI(lc3_vm* vm, uint16 instr);  // return from interrupt
+void RES(lc3_vm* vm, uint16 instr);  // reserved, same as BAD
+
+#endif
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blocks.h"
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+/*
+  profile sidecar, plain text so it can be read and diffed:
+
+    lc3prof 1 <checksum>
+    h <addr> <trace entries>
+    b <addr> <taken> <not taken>
+    c <addr> <calls>
+
+  addresses and the checksum are hex. counts from the file are halved on
+  load, so what the image does now outweighs what it did long ago.
+*/
+
+#define PROFILE_MAGIC "lc3prof"
+#define PROFILE_VERSION 1
+
+static uint32_t image_checksum(const uint16* memory) // FNV-1a over the loaded memory
+{
+  uint32_t h = 2166136261u;
+  for(uint32_t i = 0; i < MEMORY_MAX; ++i)
+  {
+    h = (h ^ (memory[i] & 0xFF)) * 16777619u;
+    h = (h ^ (memory[i] >> 8)) * 16777619u;
+  }
+  return h;
+}
+
+static int read_profile(lc3_profile* p, const char* path) // 1 when the file matches the image
+{
+  FILE* file = fopen(path, "r");
+  if(!file) return 0;
+  unsigned version, checksum;
+  if(fscanf(file, PROFILE_MAGIC " %u %x", &version, &checksum) != 2
+     || version != PROFILE_VERSION || checksum != p->checksum)
+  {
+    fclose(file);
+    return 0; // another image, or an older build of this one
+  }
+  char kind;
+  unsigned addr, a, b;
+  while(fscanf(file, " %c %x %u", &kind, &addr, &a) == 3 && addr < MEMORY_MAX)
+  {
+    if(kind == 'h') p->hits[addr] = a / 2;
+    else if(kind == 'c') p->calls[addr] = a / 2;
+    else if(kind == 'b' && fscanf(file, "%u", &b) == 1)
+    {
+      p->taken[addr] = a / 2;
+      p->not_taken[addr] = b / 2;
+    }
+    else break;
+  }
+  fclose(file);
+  return 1;
+}
+
+static int hotter(const void* x, const void* y) // keys are hits << 16 | addr
+{
+  uint64_t a = *(const uint64_t*)x;
+  uint64_t b = *(const uint64_t*)y;
+  return (a < b) - (a > b);
+}
+
+// translate the hot entries, hottest first, so they sit together at the
+// front of the arena
+static void warm_start(lc3_vm* vm)
+{
+  const lc3_profile* p = vm->profile;
+  uint64_t* hot = malloc(MEMORY_MAX * sizeof(uint64_t));
+  if(!hot || !blocks_get(vm))
+  {
+    free(hot);
+    return;
+  }
+  size_t n = 0;
+  for(uint32_t addr = 0; addr < MEMORY_MAX; ++addr)
+  {
+    if(p->hits[addr] >= HOT_MIN) hot[n++] = (uint64_t)p->hits[addr] << 16 | addr;
+  }
+  qsort(hot, n, sizeof(uint64_t), hotter);
+  for(size_t i = 0; i < n; ++i)
+  {
+    uint16 addr = hot[i] & 0xFFFF;
+    if(!vm->blocks->map[addr]) translate(vm, addr);
+  }
+  free(hot);
+}
+
+int lc3_profile_start(lc3_vm* vm, const char* path)
+{
+  if(!vm->profile && !(vm->profile = calloc(1, sizeof(lc3_profile)))) return -1;
+  lc3_profile* p = vm->profile;
+  memset(p, 0, sizeof(lc3_profile));
+  p->checksum = image_checksum(vm->memory);
+  vm->backend = LC3_BACKEND_BLOCK;
+  if(vm->blocks) blocks_flush(vm); // traces made without this profile
+  if(!path || !read_profile(p, path)) return 0;
+  warm_start(vm);
+  return 1;
+}
+
+// a new file named tmp, with its trailing XXXXXX replaced to make the name unique
+static FILE* create_temp(char* tmp)
+{
+#ifdef WIN32
+  return _mktemp_s(tmp, strlen(tmp) + 1) == 0 ? fopen(tmp, "wx") : NULL;
+#else
+  int fd = mkstemp(tmp);
+  if(fd < 0) return NULL;
+  fchmod(fd, 0644); // mkstemp() makes it private
+  FILE* file = fdopen(fd, "w");
+  if(!file)
+  {
+    close(fd);
+    remove(tmp);
+  }
+  return file;
+#endif
+}
+
+int lc3_profile_save(const lc3_vm* vm, const char* path)
+{
+  const lc3_profile* p = vm->profile;
+  if(!p) return 0;
+
+  // write a file of our own next to it and rename, concurrent runs of one
+  // image never see half a file and the last one to finish wins
+  size_t len = strlen(path);
+  char* tmp = malloc(len + 8);
+  if(!tmp) return 0;
+  memcpy(tmp, path, len);
+  memcpy(tmp + len, ".XXXXXX", 8);
+  FILE* file = create_temp(tmp);
+  if(!file)
+  {
+    free(tmp);
+    return 0;
+  }
+  fprintf(file, PROFILE_MAGIC " %u %08x\n", PROFILE_VERSION, p->checksum);
+  for(uint32_t addr = 0; addr < MEMORY_MAX; ++addr)
+  {
+    if(p->hits[addr]) fprintf(file, "h %04x %u\n", addr, p->hits[addr]);
+    if(p->taken[addr] || p->not_taken[addr])
+    {
+      fprintf(file, "b %04x %u %u\n", addr, p->taken[addr], p->not_taken[addr]);
+    }
+    if(p->calls[addr]) fprintf(file, "c %04x %u\n", addr, p->calls[addr]);
+  }
+  int ok = fclose(file) == 0 && rename(tmp, path) == 0;
+  if(!ok) remove(tmp);
+  free(tmp);
+  return ok;
+}
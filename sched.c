@@ -0,0 +1,389 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "lc3sched.h"
+#include "stats.h"
+
+#define MAX_EVENTS 64
+
+typedef struct guest
+{
+  lc3_vm* vm;
+  int fd;
+  int registered; // fd is in the epoll set, rearm with EPOLL_CTL_MOD
+  int parked; // waiting for input, whoever clears this under the lock queues it
+  lc3_exit_fn on_exit;
+  void* ctx;
+  lc3_stats seen; // counts already folded into a worker
+  struct guest* next; // run queue
+  struct guest* prev_all; // every guest not yet exited, for cleanup
+  struct guest* next_all; // also lc3_sched.dead once exited
+} guest;
+
+typedef struct worker_slot // one per worker thread, on cache lines of its own
+{
+  _Alignas(64) lc3_stats stats; // work done on this thread, only it writes here
+  lc3_sched* s;
+  pthread_t thread;
+} worker_slot;
+
+struct lc3_sched
+{
+  pthread_mutex_t lock;
+  pthread_cond_t ready; // run queue not empty, or quitting
+  pthread_cond_t idle;  // live dropped to zero
+  guest* head;
+  guest* tail;
+  guest* all;
+  guest* dead; // exited but were in the epoll set, freed by the poller
+  int live;
+  int quit;
+  uint64_t slice;
+  lc3_yield_fn on_yield;
+  int epfd;
+  int wakefd; // stops the poller
+  pthread_t poller;
+  int nworkers;
+  worker_slot* workers;
+};
+
+
+/*============= RUN QUEUE ==============*/
+
+static void push_locked(lc3_sched* s, guest* g)
+{
+  g->next = NULL;
+  if(s->tail) s->tail->next = g;
+  else s->head = g;
+  s->tail = g;
+  pthread_cond_signal(&s->ready);
+}
+
+static void push(lc3_sched* s, guest* g)
+{
+  pthread_mutex_lock(&s->lock);
+  push_locked(s, g);
+  pthread_mutex_unlock(&s->lock);
+}
+
+static guest* pop_locked(lc3_sched* s)
+{
+  guest* g = s->head;
+  s->head = g->next;
+  if(!s->head) s->tail = NULL;
+  return g;
+}
+
+
+/*=============== GUESTS ===============*/
+
+// the guest is suspended in GETC/IN, wake it when its input is readable
+static void park(lc3_sched* s, guest* g)
+{
+  pthread_mutex_lock(&s->lock);
+  g->parked = 1;
+  pthread_mutex_unlock(&s->lock);
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  ev.data.ptr = g;
+  int op = g->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  if(epoll_ctl(s->epfd, op, g->fd, &ev) == 0)
+  {
+    g->registered = 1;
+    return;
+  }
+  // fds epoll can't watch (regular files) are always readable
+  pthread_mutex_lock(&s->lock);
+  if(g->parked)
+  {
+    g->parked = 0;
+    push_locked(s, g);
+  }
+  pthread_mutex_unlock(&s->lock);
+}
+
+static void finish(lc3_sched* s, guest* g, int reason)
+{
+  if(g->registered)
+  {
+    epoll_ctl(s->epfd, EPOLL_CTL_DEL, g->fd, NULL);
+  }
+  pthread_mutex_lock(&s->lock);
+  if(g->prev_all) g->prev_all->next_all = g->next_all;
+  else s->all = g->next_all;
+  if(g->next_all) g->next_all->prev_all = g->prev_all;
+  pthread_mutex_unlock(&s->lock);
+
+  if(g->on_exit)
+  {
+    g->on_exit(g->vm, reason, g->ctx);
+  }
+
+  pthread_mutex_lock(&s->lock);
+  if(g->registered)
+  {
+    // epoll_wait() may have returned an event for it before the
+    // EPOLL_CTL_DEL, e.g. when lc3_sched_wake_all() queued it armed
+    g->next_all = s->dead;
+    s->dead = g;
+    g = NULL;
+  }
+  if(--s->live == 0)
+  {
+    pthread_cond_broadcast(&s->idle);
+  }
+  pthread_mutex_unlock(&s->lock);
+  free(g);
+}
+
+static void free_list(guest* g) // linked by next_all
+{
+  while(g)
+  {
+    guest* next = g->next_all;
+    free(g);
+    g = next;
+  }
+}
+
+
+/*============== THREADS ===============*/
+
+// adds what the guest did since its last turn to this worker's counters.
+// relaxed atomics, only so lc3_sched_stats() never reads a torn value.
+static void fold(worker_slot* w, guest* g)
+{
+  lc3_stats now;
+  lc3_get_stats(g->vm, &now);
+  uint64_t* to = (uint64_t*)&w->stats;
+  uint64_t* seen = (uint64_t*)&g->seen;
+  const uint64_t* cur = (const uint64_t*)&now;
+  for(size_t i = 0; i < LC3_STATS_WORDS; ++i)
+  {
+    __atomic_store_n(&to[i], to[i] + (cur[i] - seen[i]), __ATOMIC_RELAXED);
+    seen[i] = cur[i];
+  }
+}
+
+static void* worker(void* arg)
+{
+  worker_slot* w = arg;
+  lc3_sched* s = w->s;
+  for(;;)
+  {
+    pthread_mutex_lock(&s->lock);
+    while(!s->head && !s->quit)
+    {
+      pthread_cond_wait(&s->ready, &s->lock);
+    }
+    if(s->quit)
+    {
+      pthread_mutex_unlock(&s->lock);
+      return NULL;
+    }
+    guest* g = pop_locked(s);
+    pthread_mutex_unlock(&s->lock);
+
+    int reason = lc3_run(g->vm, s->slice);
+    fold(w, g);
+    if(s->on_yield)
+    {
+      s->on_yield(g->vm, reason, g->ctx);
+      if(!lc3_running(g->vm) && (reason == LC3_STOP_BUDGET || reason == LC3_STOP_INPUT))
+      {
+        reason = LC3_STOP_HALT; // halted by the hook
+      }
+    }
+    switch(reason)
+    {
+      case LC3_STOP_BUDGET:
+        push(s, g); // round robin
+        break;
+      case LC3_STOP_INPUT:
+        park(s, g);
+        break;
+      default:
+        finish(s, g, reason);
+        break;
+    }
+  }
+}
+
+static void* poller(void* arg)
+{
+  lc3_sched* s = arg;
+  struct epoll_event events[MAX_EVENTS];
+  for(;;)
+  {
+    // these left the epoll set before now and the events this thread
+    // took out before are all handled, nothing refers to them any more
+    pthread_mutex_lock(&s->lock);
+    guest* dead = s->dead;
+    s->dead = NULL;
+    pthread_mutex_unlock(&s->lock);
+    free_list(dead);
+
+    int n = epoll_wait(s->epfd, events, MAX_EVENTS, -1);
+    if(n < 0)
+    {
+      if(errno == EINTR) continue;
+      return NULL;
+    }
+    pthread_mutex_lock(&s->lock);
+    for(int i = 0; i < n; ++i)
+    {
+      if(!events[i].data.ptr)
+      {
+        pthread_mutex_unlock(&s->lock);
+        return NULL; // wakefd, shutting down
+      }
+      guest* g = events[i].data.ptr;
+      if(g->parked) // else lc3_sched_wake_all() queued it already
+      {
+        g->parked = 0;
+        push_locked(s, g);
+      }
+    }
+    pthread_mutex_unlock(&s->lock);
+  }
+}
+
+
+/*================ API =================*/
+
+lc3_sched* lc3_sched_create(int workers, uint64_t slice)
+{
+  if(workers < 1) workers = 1;
+  lc3_sched* s = calloc(1, sizeof(lc3_sched));
+  worker_slot* slots = s ? aligned_alloc(_Alignof(worker_slot), workers * sizeof(worker_slot)) : NULL;
+  if(!slots)
+  {
+    free(s);
+    return NULL;
+  }
+  memset(slots, 0, workers * sizeof(worker_slot));
+  s->workers = slots;
+  s->slice = slice;
+  s->epfd = epoll_create1(EPOLL_CLOEXEC);
+  s->wakefd = eventfd(0, EFD_CLOEXEC);
+  if(s->epfd < 0 || s->wakefd < 0)
+  {
+    if(s->epfd >= 0) close(s->epfd);
+    if(s->wakefd >= 0) close(s->wakefd);
+    free(s->workers);
+    free(s);
+    return NULL;
+  }
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  epoll_ctl(s->epfd, EPOLL_CTL_ADD, s->wakefd, &ev);
+
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->ready, NULL);
+  pthread_cond_init(&s->idle, NULL);
+  pthread_create(&s->poller, NULL, poller, s);
+  for(; s->nworkers < workers; ++s->nworkers)
+  {
+    worker_slot* w = &s->workers[s->nworkers];
+    w->s = s;
+    pthread_create(&w->thread, NULL, worker, w);
+  }
+  return s;
+}
+
+void lc3_sched_destroy(lc3_sched* s)
+{
+  if(!s) return;
+  pthread_mutex_lock(&s->lock);
+  s->quit = 1;
+  pthread_cond_broadcast(&s->ready);
+  pthread_mutex_unlock(&s->lock);
+  for(int i = 0; i < s->nworkers; ++i)
+  {
+    pthread_join(s->workers[i].thread, NULL);
+  }
+
+  uint64_t one = 1;
+  if(write(s->wakefd, &one, sizeof(one)) == sizeof(one))
+  {
+    pthread_join(s->poller, NULL);
+  }
+
+  free_list(s->all);
+  free_list(s->dead);
+  close(s->epfd);
+  close(s->wakefd);
+  pthread_cond_destroy(&s->idle);
+  pthread_cond_destroy(&s->ready);
+  pthread_mutex_destroy(&s->lock);
+  free(s->workers);
+  free(s);
+}
+
+int lc3_sched_add(lc3_sched* s, lc3_vm* vm, int input_fd, lc3_exit_fn on_exit, void* ctx)
+{
+  guest* g = calloc(1, sizeof(guest));
+  if(!g) return 0;
+  g->vm = vm;
+  g->fd = input_fd;
+  g->on_exit = on_exit;
+  g->ctx = ctx;
+
+  pthread_mutex_lock(&s->lock);
+  g->next_all = s->all;
+  if(s->all) s->all->prev_all = g;
+  s->all = g;
+  ++s->live;
+  push_locked(s, g);
+  pthread_mutex_unlock(&s->lock);
+  return 1;
+}
+
+void lc3_sched_on_yield(lc3_sched* s, lc3_yield_fn fn)
+{
+  s->on_yield = fn;
+}
+
+void lc3_sched_wake_all(lc3_sched* s)
+{
+  pthread_mutex_lock(&s->lock);
+  for(guest* g = s->all; g; g = g->next_all)
+  {
+    if(g->parked)
+    {
+      g->parked = 0;
+      push_locked(s, g);
+    }
+  }
+  pthread_mutex_unlock(&s->lock);
+}
+
+void lc3_sched_wait(lc3_sched* s)
+{
+  pthread_mutex_lock(&s->lock);
+  while(s->live)
+  {
+    pthread_cond_wait(&s->idle, &s->lock);
+  }
+  pthread_mutex_unlock(&s->lock);
+}
+
+int lc3_sched_workers(const lc3_sched* s)
+{
+  return s->nworkers;
+}
+
+void lc3_sched_stats(lc3_sched* s, int worker, lc3_stats* out)
+{
+  const uint64_t* from = (const uint64_t*)&s->workers[worker].stats;
+  uint64_t* to = (uint64_t*)out;
+  for(size_t i = 0; i < LC3_STATS_WORDS; ++i)
+  {
+    to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+  }
+}
@@ -0,0 +1,464 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "screen.h"
+
+#define MAX_PARAMS 8
+#define EMIT_MAX 4096 // escape output is staged here before going to out
+#define GAP_REWRITE 4 // rewrite unchanged cells shorter than this instead of moving the cursor
+
+// a cell is the character in the low byte and the attributes above it:
+// bit 8 bold, bits 9-12 foreground + 1, bits 13-16 background + 1 (0 = default)
+typedef uint32_t cell;
+#define CELL(ch, attr) ((cell)(unsigned char)(ch) | ((cell)(attr) << 8))
+#define CELL_CH(c) ((char)((c) & 0xFF))
+#define CELL_ATTR(c) ((c) >> 8)
+#define ATTR_BOLD 1
+#define ATTR_FG(a) (((a) >> 1) & 0xF)
+#define ATTR_BG(a) (((a) >> 5) & 0xF)
+#define BLANK CELL(' ', 0)
+
+enum // parser states
+{
+  ST_TEXT,
+  ST_ESC,
+  ST_CSI
+};
+
+struct lc3_screen
+{
+  int cols;
+  int rows;
+  cell* grid;  // what the guest has drawn
+  cell* shown; // what the real console shows
+  int cx, cy;  // guest cursor
+  uint32_t attr; // current guest attributes
+  int dirty;   // grid or cursor changed since the last flush
+  int started; // the real console has been cleared once
+
+  int state;
+  int params[MAX_PARAMS];
+  int nparams;
+  int private_seq; // CSI ? ..., not interpreted
+
+  int tx, ty;  // real console cursor
+  uint32_t tattr; // real console attributes
+  char emit[EMIT_MAX];
+  size_t emit_len;
+
+  lc3_io out;
+};
+
+
+/*============ GRID UPDATES ============*/
+
+static void fill(lc3_screen* scr, int from, int to) // blank grid cells [from, to)
+{
+  for(int i = from; i < to; ++i)
+  {
+    scr->grid[i] = BLANK;
+  }
+  scr->dirty = 1;
+}
+
+static void line_feed(lc3_screen* scr)
+{
+  if(scr->cy + 1 < scr->rows)
+  {
+    ++scr->cy;
+    return;
+  }
+  // scroll the grid up one line
+  memmove(scr->grid, scr->grid + scr->cols, (size_t)(scr->rows - 1) * scr->cols * sizeof(cell));
+  fill(scr, (scr->rows - 1) * scr->cols, scr->rows * scr->cols);
+}
+
+static void put_char(lc3_screen* scr, char ch)
+{
+  if(scr->cx >= scr->cols) // autowrap
+  {
+    scr->cx = 0;
+    line_feed(scr);
+  }
+  scr->grid[scr->cy * scr->cols + scr->cx++] = CELL(ch, scr->attr);
+  scr->dirty = 1;
+}
+
+static int param(const lc3_screen* scr, int i, int dflt)
+{
+  return i < scr->nparams && scr->params[i] > 0 ? scr->params[i] : dflt;
+}
+
+static int clamp(int v, int lo, int hi)
+{
+  return v < lo ? lo : v > hi ? hi : v;
+}
+
+static void select_graphic_rendition(lc3_screen* scr)
+{
+  if(scr->nparams == 0)
+  {
+    scr->attr = 0;
+    return;
+  }
+  for(int i = 0; i < scr->nparams; ++i)
+  {
+    int p = scr->params[i];
+    if(p == 0) scr->attr = 0;
+    else if(p == 1) scr->attr |= ATTR_BOLD;
+    else if(p == 22) scr->attr &= ~ATTR_BOLD;
+    else if(p >= 30 && p <= 37) scr->attr = (scr->attr & ~(0xFu << 1)) | ((p - 30 + 1) << 1);
+    else if(p == 39) scr->attr &= ~(0xFu << 1);
+    else if(p >= 40 && p <= 47) scr->attr = (scr->attr & ~(0xFu << 5)) | ((p - 40 + 1) << 5);
+    else if(p == 49) scr->attr &= ~(0xFu << 5);
+  }
+}
+
+static void control_sequence(lc3_screen* scr, char final)
+{
+  int here = scr->cy * scr->cols + scr->cx;
+  int end = scr->rows * scr->cols;
+  switch(final)
+  {
+    case 'H':
+    case 'f':
+      scr->cy = clamp(param(scr, 0, 1) - 1, 0, scr->rows - 1);
+      scr->cx = clamp(param(scr, 1, 1) - 1, 0, scr->cols - 1);
+      break;
+    case 'A': scr->cy = clamp(scr->cy - param(scr, 0, 1), 0, scr->rows - 1); break;
+    case 'B': scr->cy = clamp(scr->cy + param(scr, 0, 1), 0, scr->rows - 1); break;
+    case 'C': scr->cx = clamp(scr->cx + param(scr, 0, 1), 0, scr->cols - 1); break;
+    case 'D': scr->cx = clamp(scr->cx - param(scr, 0, 1), 0, scr->cols - 1); break;
+    case 'J':
+      {
+        int mode = scr->nparams ? scr->params[0] : 0;
+        if(mode == 0) fill(scr, here < end ? here : end, end);
+        else if(mode == 1) fill(scr, 0, here + 1 < end ? here + 1 : end);
+        else if(mode == 2) fill(scr, 0, end);
+        // 3J only drops scrollback, which the grid does not have
+      }
+      break;
+    case 'K':
+      {
+        int mode = scr->nparams ? scr->params[0] : 0;
+        int line = scr->cy * scr->cols;
+        int x = scr->cx < scr->cols ? scr->cx : scr->cols;
+        if(mode == 0) fill(scr, line + x, line + scr->cols);
+        else if(mode == 1) fill(scr, line, line + (x < scr->cols ? x + 1 : scr->cols));
+        else if(mode == 2) fill(scr, line, line + scr->cols);
+      }
+      break;
+    case 'm':
+      select_graphic_rendition(scr);
+      break;
+  }
+  scr->dirty = 1; // cursor moves count too
+}
+
+static void feed(lc3_screen* scr, char ch)
+{
+  switch(scr->state)
+  {
+    case ST_TEXT:
+      switch(ch)
+      {
+        case '\x1b': scr->state = ST_ESC; break;
+        case '\n': scr->cx = 0; line_feed(scr); scr->dirty = 1; break; // the tty would add the CR
+        case '\r': scr->cx = 0; scr->dirty = 1; break;
+        case '\b': if(scr->cx > 0) --scr->cx; scr->dirty = 1; break;
+        case '\t':
+          do put_char(scr, ' '); while(scr->cx % 8 && scr->cx < scr->cols);
+          break;
+        default:
+          if((unsigned char)ch >= ' ' && ch != 0x7F) put_char(scr, ch);
+          break;
+      }
+      break;
+    case ST_ESC:
+      if(ch == '[')
+      {
+        scr->state = ST_CSI;
+        scr->nparams = 0;
+        scr->private_seq = 0;
+        memset(scr->params, 0, sizeof(scr->params));
+      }
+      else
+      {
+        scr->state = ST_TEXT; // two byte escapes are dropped
+      }
+      break;
+    case ST_CSI:
+      if(ch >= '0' && ch <= '9')
+      {
+        if(scr->nparams == 0) scr->nparams = 1;
+        int* p = &scr->params[scr->nparams - 1];
+        if(*p < 10000) *p = *p * 10 + (ch - '0');
+      }
+      else if(ch == ';')
+      {
+        if(scr->nparams == 0) scr->nparams = 1;
+        if(scr->nparams < MAX_PARAMS) ++scr->nparams;
+      }
+      else if(ch == '?')
+      {
+        scr->private_seq = 1;
+      }
+      else if(ch >= 0x40 && ch <= 0x7E)
+      {
+        if(!scr->private_seq) control_sequence(scr, ch);
+        scr->state = ST_TEXT;
+      }
+      break;
+  }
+}
+
+
+/*============== EMITTING ==============*/
+
+static void emit_flush(lc3_screen* scr)
+{
+  if(scr->emit_len)
+  {
+    scr->out.write(scr->out.ctx, scr->emit, scr->emit_len);
+    scr->emit_len = 0;
+  }
+}
+
+static void emit(lc3_screen* scr, const char* s, size_t n)
+{
+  if(scr->emit_len + n > EMIT_MAX)
+  {
+    emit_flush(scr);
+  }
+  memcpy(scr->emit + scr->emit_len, s, n);
+  scr->emit_len += n;
+}
+
+static void emit_move(lc3_screen* scr, int x, int y)
+{
+  if(x == scr->tx && y == scr->ty) return;
+  char buf[24];
+  int n;
+  if(scr->tx < 0) n = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, x + 1);
+  else if(y == scr->ty && x > scr->tx && x - scr->tx < 4) n = snprintf(buf, sizeof(buf), "\x1b[%dC", x - scr->tx);
+  else if(x == 0 && y == scr->ty + 1) n = snprintf(buf, sizeof(buf), "\r\n");
+  else n = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, x + 1);
+  emit(scr, buf, n);
+  scr->tx = x;
+  scr->ty = y;
+}
+
+static void emit_attr(lc3_screen* scr, uint32_t attr)
+{
+  if(attr == scr->tattr) return;
+  char buf[24];
+  int n = snprintf(buf, sizeof(buf), "\x1b[0");
+  if(attr & ATTR_BOLD) n += snprintf(buf + n, sizeof(buf) - n, ";1");
+  if(ATTR_FG(attr)) n += snprintf(buf + n, sizeof(buf) - n, ";%d", 30 + ATTR_FG(attr) - 1);
+  if(ATTR_BG(attr)) n += snprintf(buf + n, sizeof(buf) - n, ";%d", 40 + ATTR_BG(attr) - 1);
+  n += snprintf(buf + n, sizeof(buf) - n, "m");
+  emit(scr, buf, n);
+  scr->tattr = attr;
+}
+
+static void emit_cell(lc3_screen* scr, int x, int y, cell c)
+{
+  emit_move(scr, x, y);
+  emit_attr(scr, CELL_ATTR(c));
+  char ch = CELL_CH(c);
+  emit(scr, &ch, 1);
+  scr->shown[y * scr->cols + x] = c;
+  if(++scr->tx >= scr->cols)
+  {
+    // don't trust where the terminal parks the cursor after the last column
+    scr->tx = -1;
+    scr->ty = -1;
+  }
+}
+
+static int same_attr(const cell* row, int from, int to, uint32_t attr)
+{
+  for(int x = from; x < to; ++x)
+  {
+    if(CELL_ATTR(row[x]) != attr) return 0;
+  }
+  return 1;
+}
+
+void lc3_screen_flush(lc3_screen* scr)
+{
+  if(!scr->dirty) return;
+  if(!scr->started)
+  {
+    static const char clear[] = "\x1b[0m\x1b[H\x1b[2J";
+    emit(scr, clear, sizeof(clear) - 1);
+    scr->started = 1;
+    scr->tx = scr->ty = 0;
+    scr->tattr = 0;
+  }
+
+  for(int y = 0; y < scr->rows; ++y)
+  {
+    const cell* row = scr->grid + y * scr->cols;
+    const cell* seen = scr->shown + y * scr->cols;
+    if(memcmp(row, seen, scr->cols * sizeof(cell)) == 0) continue;
+    for(int x = 0; x < scr->cols; ++x)
+    {
+      if(row[x] == seen[x]) continue;
+      // rewriting a short unchanged gap is cheaper than a cursor move
+      if(scr->ty == y && scr->tx >= 0 && scr->tx < x && x - scr->tx < GAP_REWRITE &&
+         same_attr(row, scr->tx, x, scr->tattr))
+      {
+        for(int k = scr->tx; k < x; ++k) emit_cell(scr, k, y, row[k]);
+      }
+      emit_cell(scr, x, y, row[x]);
+    }
+  }
+
+  emit_move(scr, scr->cx < scr->cols ? scr->cx : scr->cols - 1, scr->cy);
+  emit_attr(scr, scr->attr);
+  emit_flush(scr);
+  scr->out.flush(scr->out.ctx);
+  scr->dirty = 0;
+}
+
+
+/*============== CONSOLE ===============*/
+
+static void screen_write(void* ctx, const char* buf, size_t n)
+{
+  lc3_screen* scr = ctx;
+  for(size_t i = 0; i < n; ++i)
+  {
+    feed(scr, buf[i]);
+  }
+}
+
+static void screen_flush(void* ctx)
+{
+  // guests flush after every OUT/PUTS, frames are only sent at input polls
+}
+
+static int screen_key_ready(void* ctx)
+{
+  lc3_screen* scr = ctx;
+  lc3_screen_flush(scr); // the guest is done drawing for now
+  return scr->out.key_ready(scr->out.ctx);
+}
+
+static int screen_getc(void* ctx)
+{
+  lc3_screen* scr = ctx;
+  lc3_screen_flush(scr);
+  return scr->out.getc(scr->out.ctx);
+}
+
+lc3_io lc3_screen_io(lc3_screen* scr)
+{
+  lc3_io io = { screen_getc, screen_key_ready, screen_write, screen_flush, scr };
+  return io;
+}
+
+lc3_screen* lc3_screen_create(int cols, int rows, const lc3_io* out)
+{
+  lc3_screen* scr = calloc(1, sizeof(lc3_screen));
+  if(!scr) return NULL;
+  scr->cols = cols;
+  scr->rows = rows;
+  scr->grid = malloc((size_t)cols * rows * sizeof(cell));
+  scr->shown = malloc((size_t)cols * rows * sizeof(cell));
+  if(!scr->grid || !scr->shown)
+  {
+    lc3_screen_free(scr);
+    return NULL;
+  }
+  for(int i = 0; i < cols * rows; ++i)
+  {
+    scr->grid[i] = BLANK;
+    scr->shown[i] = BLANK;
+  }
+  scr->out = *out;
+  scr->dirty = 1;
+  return scr;
+}
+
+void lc3_screen_free(lc3_screen* scr)
+{
+  if(!scr) return;
+  free(scr->grid);
+  free(scr->shown);
+  free(scr);
+}
+
+
+/*============ SAVE AND LOAD ===========*/
+
+enum // int32_t fields ahead of the grids in a saved screen
+{
+  SAVED_COLS,
+  SAVED_ROWS,
+  SAVED_CX,
+  SAVED_CY,
+  SAVED_ATTR,
+  SAVED_STARTED,
+  SAVED_STATE,
+  SAVED_NPARAMS,
+  SAVED_PRIVATE,
+  SAVED_TX,
+  SAVED_TY,
+  SAVED_TATTR,
+  SAVED_PARAMS,
+  SAVED_FIELDS = SAVED_PARAMS + MAX_PARAMS
+};
+
+size_t lc3_screen_save(lc3_screen* scr, void* buf, size_t cap)
+{
+  size_t cells = (size_t)scr->cols * scr->rows;
+  size_t size = SAVED_FIELDS * sizeof(int32_t) + 2 * cells * sizeof(cell);
+  if(size > cap) return size;
+  lc3_screen_flush(scr); // nothing left in emit, dirty is clear
+  int32_t f[SAVED_FIELDS] = {
+    scr->cols, scr->rows, scr->cx, scr->cy, (int32_t)scr->attr, scr->started,
+    scr->state, scr->nparams, scr->private_seq, scr->tx, scr->ty, (int32_t)scr->tattr
+  };
+  for(int i = 0; i < MAX_PARAMS; ++i)
+  {
+    f[SAVED_PARAMS + i] = scr->params[i];
+  }
+  char* p = buf;
+  memcpy(p, f, sizeof(f));
+  memcpy(p + sizeof(f), scr->grid, cells * sizeof(cell));
+  memcpy(p + sizeof(f) + cells * sizeof(cell), scr->shown, cells * sizeof(cell));
+  return size;
+}
+
+lc3_screen* lc3_screen_load(const void* buf, size_t n, const lc3_io* out)
+{
+  int32_t f[SAVED_FIELDS];
+  if(n < sizeof(f)) return NULL;
+  memcpy(f, buf, sizeof(f));
+  if(f[SAVED_COLS] <= 0 || f[SAVED_ROWS] <= 0 || f[SAVED_COLS] > 1024 || f[SAVED_ROWS] > 1024) return NULL;
+  size_t cells = (size_t)f[SAVED_COLS] * f[SAVED_ROWS];
+  if(n != sizeof(f) + 2 * cells * sizeof(cell)) return NULL;
+  lc3_screen* scr = lc3_screen_create(f[SAVED_COLS], f[SAVED_ROWS], out);
+  if(!scr) return NULL;
+  scr->cx = clamp(f[SAVED_CX], 0, scr->cols);
+  scr->cy = clamp(f[SAVED_CY], 0, scr->rows - 1);
+  scr->attr = (uint32_t)f[SAVED_ATTR];
+  scr->started = f[SAVED_STARTED];
+  scr->state = f[SAVED_STATE];
+  scr->nparams = clamp(f[SAVED_NPARAMS], 0, MAX_PARAMS);
+  scr->private_seq = f[SAVED_PRIVATE];
+  scr->tx = f[SAVED_TX];
+  scr->ty = f[SAVED_TY];
+  scr->tattr = (uint32_t)f[SAVED_TATTR];
+  for(int i = 0; i < MAX_PARAMS; ++i)
+  {
+    scr->params[i] = f[SAVED_PARAMS + i];
+  }
+  const char* p = buf;
+  memcpy(scr->grid, p + sizeof(f), cells * sizeof(cell));
+  memcpy(scr->shown, p + sizeof(f) + cells * sizeof(cell), cells * sizeof(cell));
+  scr->dirty = 0; // the real console shows all of it already
+  return scr;
+}
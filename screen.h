@@ -0,0 +1,31 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+/*
+  virtual screen console device.
+
+  sits between a vm and its real console: everything the guest prints is
+  interpreted into a character grid (printable text, CR/LF/BS/TAB, and the
+  CSI cursor, erase and colour sequences full-screen guests use). nothing
+  reaches the real console until the guest looks for input or the host
+  calls lc3_screen_flush(), then only the cells that changed since the
+  last flush are sent. whole-board redraws between two key polls collapse
+  into one small update.
+*/
+
+#include "lc3vm.h"
+
+typedef struct lc3_screen lc3_screen;
+
+lc3_screen* lc3_screen_create(int cols, int rows, const lc3_io* out); // out is copied
+void lc3_screen_free(lc3_screen* scr);
+lc3_io lc3_screen_io(lc3_screen* scr); // give this to lc3_set_io()
+void lc3_screen_flush(lc3_screen* scr); // send pending changes to out
+
+// the grid, cursors and parser state, to move a screen along with its guest
+// (migrate.h). lc3_screen_save() flushes, returns the size it needs and
+// only writes buf when that fits in cap.
+size_t lc3_screen_save(lc3_screen* scr, void* buf, size_t cap);
+lc3_screen* lc3_screen_load(const void* buf, size_t n, const lc3_io* out); // NULL when buf is not a saved screen
+
+#endif
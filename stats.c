@@ -0,0 +1,74 @@
+#include <stddef.h>
+#include "stats.h"
+
+static const char* const trap_names[LC3_TRAP_STAT_COUNT] =
+{
+  "GETC", "OUT", "PUTS", "IN", "PUTSP", "HALT", "other"
+};
+
+void lc3_stats_add(lc3_stats* sum, const lc3_stats* s)
+{
+  uint64_t* to = (uint64_t*)sum;
+  const uint64_t* from = (const uint64_t*)s;
+  for(size_t i = 0; i < LC3_STATS_WORDS; ++i)
+  {
+    to[i] += from[i];
+  }
+}
+
+static void family(FILE* out, const char* name, const char* help)
+{
+  fprintf(out, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+}
+
+static void sample(FILE* out, const char* name, const char* labels, const char* extra, uint64_t v)
+{
+  int has_labels = labels && *labels;
+  if(!has_labels && !extra)
+  {
+    fprintf(out, "%s %llu\n", name, (unsigned long long)v);
+    return;
+  }
+  fprintf(out, "%s{%s%s%s} %llu\n", name, has_labels ? labels : "", has_labels && extra ? "," : "",
+          extra ? extra : "", (unsigned long long)v);
+}
+
+static void counter(FILE* out, const char* name, const char* help, size_t offset,
+                    const lc3_stats* sets, const char* const* labels, int count)
+{
+  family(out, name, help);
+  for(int i = 0; i < count; ++i)
+  {
+    const uint64_t* v = (const uint64_t*)((const char*)&sets[i] + offset);
+    sample(out, name, labels ? labels[i] : NULL, NULL, *v);
+  }
+}
+
+void lc3_stats_write(FILE* out, const lc3_stats* sets, const char* const* labels, int count)
+{
+  counter(out, "lc3_instructions_total", "Guest instructions retired.",
+          offsetof(lc3_stats, instructions), sets, labels, count);
+
+  const char* name = "lc3_traps_total";
+  family(out, name, "Guest TRAPs completed, by service routine.");
+  for(int t = 0; t < LC3_TRAP_STAT_COUNT; ++t)
+  {
+    char trap[32];
+    snprintf(trap, sizeof(trap), "trap=\"%s\"", trap_names[t]);
+    for(int i = 0; i < count; ++i)
+    {
+      sample(out, name, labels ? labels[i] : NULL, trap, sets[i].traps[t]);
+    }
+  }
+
+  counter(out, "lc3_memory_reads_total", "Guest data loads, instruction fetches excluded.",
+          offsetof(lc3_stats, mem_reads), sets, labels, count);
+  counter(out, "lc3_memory_writes_total", "Guest stores.",
+          offsetof(lc3_stats, mem_writes), sets, labels, count);
+  counter(out, "lc3_device_polls_total", "Guest reads of the keyboard status register.",
+          offsetof(lc3_stats, device_polls), sets, labels, count);
+  counter(out, "lc3_input_waits_total", "Times a guest stopped in GETC/IN for lack of input.",
+          offsetof(lc3_stats, input_waits), sets, labels, count);
+  counter(out, "lc3_interrupts_total", "Guest interrupts taken.",
+          offsetof(lc3_stats, interrupts), sets, labels, count);
+}
@@ -0,0 +1,21 @@
+#ifndef STATS_H
+#define STATS_H
+
+/*
+  prometheus text exposition of lc3_stats.
+
+  each set of counters comes with its own label text (e.g. worker="0"),
+  the families are written once with one sample per set, which is what
+  a scrape of a file or socket expects.
+*/
+
+#include <stdio.h>
+#include "lc3vm.h"
+
+#define LC3_STATS_WORDS (sizeof(lc3_stats) / sizeof(uint64_t))
+
+void lc3_stats_add(lc3_stats* sum, const lc3_stats* s);
+// labels[i] goes inside the braces of set i, NULL or "" for none
+void lc3_stats_write(FILE* out, const lc3_stats* sets, const char* const* labels, int count);
+
+#endif
@@ -0,0 +1,260 @@
+#include "opcodes.h"
+#include "isa.h"
+
+/*
+  tail call backend.
+
+  every handler ends by fetching the next instruction and tail calling its
+  handler, so there is no loop and no shared dispatch branch. the state
+  that changes on every instruction travels in the argument registers:
+  PC, the memory base, the instruction word, the instruction budget and
+  the condition codes. the condition is kept lazily as the value of the
+  last result and only turned into N/Z/P when a BR looks at it.
+
+  R0-R7 stay in vm->reg, one load off the vm pointer. x86-64 has 6
+  argument registers and room could be made for some guest registers
+  (mem is just vm->memory, PC, the instruction and the result fit in one
+  word), but which register an instruction names is only known from its
+  fields at run time, so every access turns into a compare chain on the
+  register number, and packing costs shifts on every instruction. on
+  the bench loop R0-R2 pinned that way took 1.05-1.15s against 0.72s,
+  R0 alone in the place of mem 0.89s. PC and COND are written back to
+  vm->reg only around traps, RTI, faults and on the way out.
+
+  relies on sibling call optimisation, gcc and clang do it from -O2. at
+  -O0 every instruction would take a stack frame, so unoptimised builds
+  return to run_tail() every TAIL_CHUNK instructions.
+*/
+
+#if defined(__has_attribute)
+#if __has_attribute(musttail)
+#define MUSTTAIL __attribute__((musttail))
+#endif
+#endif
+#ifndef MUSTTAIL
+#define MUSTTAIL
+#endif
+
+#if defined(__OPTIMIZE__)
+#define TAIL_CHUNK UINT64_MAX
+#else
+#define TAIL_CHUNK 4096
+#endif
+
+#define TC_ARGS lc3_vm* vm, uint16* mem, uint16 pc, uint16 instr, uint16 res, uint64_t budget
+typedef uint64_t (*tc_fn)(TC_ARGS); // returns the budget left
+
+static const tc_fn tc_table[KEY_COUNT];
+
+static inline uint16 cond_of(uint16 res) // N/Z/P of the last result
+{
+  return res == 0 ? FL_ZRO : (res >> 15) ? FL_NEG : FL_POS;
+}
+
+static inline uint16 res_of(uint16 cond) // any value with those N/Z/P
+{
+  return cond == FL_ZRO ? 0 : cond == FL_NEG ? 0x8000 : 1;
+}
+
+static uint64_t spill(lc3_vm* vm, uint16 pc, uint16 res, uint64_t budget)
+{
+  vm->reg[R_PC] = pc;
+  vm->reg[R_COND] = cond_of(res);
+  return budget;
+}
+
+// retire this instruction, then fetch and go to the next one. fetches
+// skip mem_read(), PC is never on KBSR in a real program
+#define NEXT() \
+  do { \
+    if(--budget == 0) return spill(vm, pc, res, budget); \
+    uint16 next = mem[pc]; \
+    MUSTTAIL return tc_table[DECODE_KEY(next)](vm, mem, pc + 1, next, res, budget); \
+  } while(0)
+
+#define DR (FIELD_DR(instr))
+#define SR1 (FIELD_SR1(instr))
+#define SR2 (FIELD_SR2(instr))
+
+static uint64_t tc_ADD_REG(TC_ARGS)
+{
+  res = vm->reg[DR] = vm->reg[SR1] + vm->reg[SR2];
+  NEXT();
+}
+
+static uint64_t tc_ADD_IMM(TC_ARGS)
+{
+  res = vm->reg[DR] = vm->reg[SR1] + IMM5(instr);
+  NEXT();
+}
+
+static uint64_t tc_AND_REG(TC_ARGS)
+{
+  res = vm->reg[DR] = vm->reg[SR1] & vm->reg[SR2];
+  NEXT();
+}
+
+static uint64_t tc_AND_IMM(TC_ARGS)
+{
+  res = vm->reg[DR] = vm->reg[SR1] & IMM5(instr);
+  NEXT();
+}
+
+static uint64_t tc_NOT(TC_ARGS)
+{
+  res = vm->reg[DR] = ~vm->reg[SR1];
+  NEXT();
+}
+
+static uint64_t tc_BR(TC_ARGS)
+{
+  if(FIELD_NZP(instr) & cond_of(res))
+  {
+    pc += OFF9(instr);
+  }
+  NEXT();
+}
+
+static uint64_t tc_JMP(TC_ARGS)
+{
+  pc = vm->reg[SR1];
+  NEXT();
+}
+
+static uint64_t tc_JSR(TC_ARGS)
+{
+  vm->reg[R_R7] = pc;
+  pc += OFF11(instr);
+  NEXT();
+}
+
+static uint64_t tc_JSRR(TC_ARGS)
+{
+  uint16 target = vm->reg[SR1];
+  vm->reg[R_R7] = pc;
+  pc = target;
+  NEXT();
+}
+
+// loads and stores go through mem_read/mem_write for KBSR and the block
+// backend's code map, neither needs PC or COND. a store to a device
+// register stops the run, see devices.c
+#define STORED() \
+  do { \
+    if(vm->stop) return spill(vm, pc, res, budget - 1); \
+  } while(0)
+static uint64_t tc_LD(TC_ARGS)
+{
+  res = vm->reg[DR] = mem_read(vm, pc + OFF9(instr));
+  NEXT();
+}
+
+static uint64_t tc_LDI(TC_ARGS)
+{
+  res = vm->reg[DR] = mem_read(vm, mem_read(vm, pc + OFF9(instr)));
+  NEXT();
+}
+
+static uint64_t tc_LDR(TC_ARGS)
+{
+  res = vm->reg[DR] = mem_read(vm, vm->reg[SR1] + OFF6(instr));
+  NEXT();
+}
+
+static uint64_t tc_LEA(TC_ARGS)
+{
+  res = vm->reg[DR] = pc + OFF9(instr);
+  NEXT();
+}
+
+static uint64_t tc_ST(TC_ARGS)
+{
+  mem_write(vm, pc + OFF9(instr), vm->reg[DR]);
+  STORED();
+  NEXT();
+}
+
+static uint64_t tc_STI(TC_ARGS)
+{
+  mem_write(vm, mem_read(vm, pc + OFF9(instr)), vm->reg[DR]);
+  STORED();
+  NEXT();
+}
+
+static uint64_t tc_STR(TC_ARGS)
+{
+  mem_write(vm, vm->reg[SR1] + OFF6(instr), vm->reg[DR]);
+  STORED();
+  NEXT();
+}
+
+// traps see and may change the whole register file
+static uint64_t tc_TRAP(TC_ARGS)
+{
+  spill(vm, pc, res, budget);
+  vm->reg[R_R7] = pc;
+  trap_fn fn = vm->traps[FIELD_TRAPVECT(instr)];
+  if(fn)
+  {
+    fn(vm);
+  }
+  count_trap(vm, FIELD_TRAPVECT(instr));
+  pc = vm->reg[R_PC];
+  res = res_of(vm->reg[R_COND]);
+  if(vm->stop)
+  {
+    return budget - 1;
+  }
+  NEXT();
+}
+
+static uint64_t tc_BAD(TC_ARGS)
+{
+  spill(vm, pc, res, budget);
+  BAD(vm, instr); // leaves PC on the bad instruction
+  return budget - 1;
+}
+
+static uint64_t tc_RTI(TC_ARGS)
+{
+  spill(vm, pc, res, budget);
+  rti(vm, instr);
+  pc = vm->reg[R_PC];
+  res = res_of(vm->reg[R_COND]);
+  if(vm->stop)
+  {
+    return budget - 1;
+  }
+  NEXT();
+}
+
+#define tc_RES tc_BAD
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+#endif
+
+#define TC_KEY(name, op, b11, b5, fmt, mn) LC3_KEY_INIT(op, b11, b5, tc_##name)
+static const tc_fn tc_table[KEY_COUNT] = // dispatch key -> handler
+{
+  LC3_INSNS(TC_KEY)
+};
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+uint64_t run_tail(lc3_vm* vm, uint64_t max_instructions)
+{
+  uint64_t n = 0;
+  while(!vm->stop && n < max_instructions)
+  {
+    uint64_t chunk = max_instructions - n < TAIL_CHUNK ? max_instructions - n : TAIL_CHUNK;
+    uint16 pc = vm->reg[R_PC];
+    uint16 instr = mem_fetch(vm, pc);
+    uint16 res = res_of(vm->reg[R_COND]);
+    n += chunk - tc_table[DECODE_KEY(instr)](vm, vm->memory, pc + 1, instr, res, chunk);
+  }
+  return n;
+}
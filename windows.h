@@ -9,8 +9,8 @@
 #include <conio.h>
 
 //input bufferingfor windows
-HANDLE hStdin = INVALID_HANDLE_VALUE;
-DWORD fdwMode, fdwOldMode;
+static HANDLE hStdin = INVALID_HANDLE_VALUE;
+static DWORD fdwMode, fdwOldMode;
 
 static void disable_input_buffering()
 {
@@ -29,9 +29,11 @@ static void restore_input_buffering()
     SetConsoleMode(hStdin, fdwOldMode);
 }
 
-static uint16_t check_key()
+static void wait_key() // blocks until lc3_stdin_ready() would succeed
 {
-    return WaitForSingleObject(hStdin, 1000) == WAIT_OBJECT_0 && _kbhit();
+    while(!lc3_stdin_ready())
+    {
+    }
 }
 
 